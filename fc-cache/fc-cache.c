@@ -45,7 +45,11 @@
 #include <dirent.h>
 #endif
 #include <string.h>
+#include <stdarg.h>
 #include <locale.h>
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
 
 #if defined (_WIN32)
 #define STRICT
@@ -84,6 +88,8 @@
 const struct option longopts[] = {
     {"error-on-no-fonts", 0, 0, 'E'},
     {"force", 0, 0, 'f'},
+    {"jobs", required_argument, 0, 'j'},
+    {"merged", 0, 0, 'm'},
     {"really-force", 0, 0, 'r'},
     {"sysroot", required_argument, 0, 'y'},
     {"system-only", 0, 0, 's'},
@@ -104,10 +110,10 @@ usage (char *program, int error)
 {
     FILE *file = error ? stderr : stdout;
 #if HAVE_GETOPT_LONG
-    fprintf (file, _("usage: %s [-EfrsvVh] [-y SYSROOT] [--error-on-no-fonts] [--force|--really-force] [--sysroot=SYSROOT] [--system-only] [--verbose] [--version] [--help] [dirs]\n"),
+    fprintf (file, _("usage: %s [-EfmrsvVh] [-j JOBS] [-y SYSROOT] [--error-on-no-fonts] [--force|--really-force] [--jobs=JOBS] [--merged] [--sysroot=SYSROOT] [--system-only] [--verbose] [--version] [--help] [dirs]\n"),
 	     program);
 #else
-    fprintf (file, _("usage: %s [-EfrsvVh] [-y SYSROOT] [dirs]\n"),
+    fprintf (file, _("usage: %s [-EfmrsvVh] [-j JOBS] [-y SYSROOT] [dirs]\n"),
 	     program);
 #endif
     fprintf (file, _("Build font information caches in [dirs]\n"
@@ -116,6 +122,8 @@ usage (char *program, int error)
 #if HAVE_GETOPT_LONG
     fprintf (file, _("  -E, --error-on-no-fonts  raise an error if no fonts in a directory\n"));
     fprintf (file, _("  -f, --force              scan directories with apparently valid caches\n"));
+    fprintf (file, _("  -j, --jobs=JOBS          scan up to JOBS directories at the same time\n"));
+    fprintf (file, _("  -m, --merged             also write a single font database for all directories\n"));
     fprintf (file, _("  -r, --really-force       erase all existing caches, then rescan\n"));
     fprintf (file, _("  -s, --system-only        scan system-wide directories only\n"));
     fprintf (file, _("  -y, --sysroot=SYSROOT    prepend SYSROOT to all paths for scanning\n"));
@@ -126,6 +134,8 @@ usage (char *program, int error)
     fprintf (file, _("  -E         (error-on-no-fonts)\n"));
     fprintf (file, _("                       raise an error if no fonts in a directory\n"));
     fprintf (file, _("  -f         (force)   scan directories with apparently valid caches\n"));
+    fprintf (file, _("  -j JOBS    (jobs)    scan up to JOBS directories at the same time\n"));
+    fprintf (file, _("  -m         (merged)  also write a single font database for all directories\n"));
     fprintf (file, _("  -r,   (really force) erase all existing caches, then rescan\n"));
     fprintf (file, _("  -s         (system)  scan system-wide directories only\n"));
     fprintf (file, _("  -y SYSROOT (sysroot) prepend SYSROOT to all paths for scanning\n"));
@@ -138,41 +148,53 @@ usage (char *program, int error)
 
 static FcStrSet *processed_dirs;
 
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+/*
+ * Print one line of progress for dir; with several jobs running the
+ * whole line has to come out at once.
+ */
+static void
+report (FcConfig *config, const FcChar8 *dir, const char *format, ...)
+{
+    const FcChar8   *sysroot = FcConfigGetSysRoot (config);
+    va_list	    args;
+
+#if defined(HAVE_PTHREAD)
+    flockfile (stdout);
+#endif
+    if (sysroot)
+	printf ("[%s]", sysroot);
+    printf ("%s: ", dir);
+    va_start (args, format);
+    vprintf (format, args);
+    va_end (args);
+    fflush (stdout);
+#if defined(HAVE_PTHREAD)
+    funlockfile (stdout);
+#endif
+}
+
+/*
+ * Bring the cache for a single directory up to date.  *processed is
+ * set when dir turns out to be a directory, *subdirs to its
+ * subdirectories when it could be scanned.
+ */
 static int
-scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force, FcBool verbose, FcBool error_on_no_fonts, int *changed)
+scanDir (const FcChar8 *dir, FcConfig *config, FcBool force, FcBool really_force, FcBool verbose, FcBool *processed, FcStrSet **subdirs, int *changed)
 {
-    int		    ret = 0;
-    const FcChar8   *dir;
-    FcStrSet	    *subdirs;
-    FcStrList	    *sublist;
     FcCache	    *cache;
     struct stat	    statb;
-    FcBool	    was_valid, was_processed = FcFalse;
+    FcBool	    was_valid;
+    int		    ret = 0;
     int		    i;
     const FcChar8   *sysroot = FcConfigGetSysRoot (config);
+    FcChar8	    *rooted_dir = NULL;
 
-    /*
-     * Now scan all of the directories into separate databases
-     * and write out the results
-     */
-    while ((dir = FcStrListNext (list)))
-    {
-	if (verbose)
-	{
-	    if (sysroot)
-		printf ("[%s]", sysroot);
-	    printf ("%s: ", dir);
-	    fflush (stdout);
-	}
-
-	if (FcStrSetMember (processed_dirs, dir))
-	{
-	    if (verbose)
-		printf (_("skipping, looped directory detected\n"));
-	    continue;
-	}
-
-    FcChar8 *rooted_dir = NULL;
+    *subdirs = NULL;
     if (sysroot)
     {
         rooted_dir = FcStrPlus(sysroot, dir);
@@ -181,92 +203,119 @@ scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force,
         rooted_dir = FcStrCopy(dir);
     }
 
-	if (stat ((char *) rooted_dir, &statb) == -1)
-	{
-	    switch (errno) {
-	    case ENOENT:
-	    case ENOTDIR:
-		if (verbose)
-		    printf (_("skipping, no such directory\n"));
-		break;
-	    default:
-		fprintf (stderr, "\"%s\": ", dir);
-		perror ("");
-		ret++;
-		break;
-	    }
-	    FcStrFree (rooted_dir);
-	    rooted_dir = NULL;
-	    continue;
+    if (stat ((char *) rooted_dir, &statb) == -1)
+    {
+	switch (errno) {
+	case ENOENT:
+	case ENOTDIR:
+	    if (verbose)
+		report (config, dir, _("skipping, no such directory\n"));
+	    break;
+	default:
+	    fprintf (stderr, "\"%s\": %s\n", dir, strerror (errno));
+	    ret++;
+	    break;
 	}
+	FcStrFree (rooted_dir);
+	return ret;
+    }
 
     FcStrFree(rooted_dir);
     rooted_dir = NULL;
 
-	if (!S_ISDIR (statb.st_mode))
-	{
-	    fprintf (stderr, _("\"%s\": not a directory, skipping\n"), dir);
-	    continue;
-	}
-	was_processed = FcTrue;
+    if (!S_ISDIR (statb.st_mode))
+    {
+	fprintf (stderr, _("\"%s\": not a directory, skipping\n"), dir);
+	return ret;
+    }
+    *processed = FcTrue;
 
-	if (really_force)
-	{
-	    FcDirCacheUnlink (dir, config);
-	}
+    if (really_force)
+    {
+	FcDirCacheUnlink (dir, config);
+    }
 
-	cache = NULL;
-	was_valid = FcFalse;
-	if (!force) {
-	    cache = FcDirCacheLoad (dir, config, NULL);
-	    if (cache)
-		was_valid = FcTrue;
-	}
-	
+    cache = NULL;
+    was_valid = FcFalse;
+    if (!force) {
+	cache = FcDirCacheLoad (dir, config, NULL);
+	if (cache)
+	    was_valid = FcTrue;
+    }
+
+    if (!cache)
+    {
+	(*changed)++;
+	cache = FcDirCacheRead (dir, FcTrue, config);
 	if (!cache)
 	{
-	    (*changed)++;
-	    cache = FcDirCacheRead (dir, FcTrue, config);
-	    if (!cache)
-	    {
-		fprintf (stderr, _("\"%s\": scanning error\n"), dir);
-		ret++;
-		continue;
-	    }
+	    fprintf (stderr, _("\"%s\": scanning error\n"), dir);
+	    ret++;
+	    return ret;
 	}
+    }
+
+    if (was_valid)
+    {
+	if (verbose)
+	    report (config, dir, _("skipping, existing cache is valid: %d fonts, %d dirs\n"),
+		    FcCacheNumFont (cache), FcCacheNumSubdir (cache));
+    }
+    else
+    {
+	if (verbose)
+	    report (config, dir, _("caching, new cache contents: %d fonts, %d dirs\n"),
+		    FcCacheNumFont (cache), FcCacheNumSubdir (cache));
 
-	if (was_valid)
+	if (!FcDirCacheValid (dir))
 	{
-	    if (verbose)
-		printf (_("skipping, existing cache is valid: %d fonts, %d dirs\n"),
-			FcCacheNumFont (cache), FcCacheNumSubdir (cache));
+	    fprintf (stderr, _("%s: failed to write cache\n"), dir);
+	    (void) FcDirCacheUnlink (dir, config);
+	    ret++;
 	}
-	else
+    }
+
+    *subdirs = FcStrSetCreate ();
+    if (!*subdirs)
+    {
+	fprintf (stderr, _("%s: Can't create subdir set\n"), dir);
+	ret++;
+	FcDirCacheUnload (cache);
+	return ret;
+    }
+    for (i = 0; i < FcCacheNumSubdir (cache); i++)
+	FcStrSetAdd (*subdirs, FcCacheSubdir (cache, i));
+
+    FcDirCacheUnload (cache);
+
+    return ret;
+}
+
+static int
+scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force, FcBool verbose, FcBool error_on_no_fonts, int *changed)
+{
+    int		    ret = 0;
+    const FcChar8   *dir;
+    FcStrSet	    *subdirs;
+    FcStrList	    *sublist;
+    FcBool	    was_processed = FcFalse;
+
+    /*
+     * Now scan all of the directories into separate databases
+     * and write out the results
+     */
+    while ((dir = FcStrListNext (list)))
+    {
+	if (FcStrSetMember (processed_dirs, dir))
 	{
 	    if (verbose)
-		printf (_("caching, new cache contents: %d fonts, %d dirs\n"),
-			FcCacheNumFont (cache), FcCacheNumSubdir (cache));
-
-	    if (!FcDirCacheValid (dir))
-	    {
-		fprintf (stderr, _("%s: failed to write cache\n"), dir);
-		(void) FcDirCacheUnlink (dir, config);
-		ret++;
-	    }
+		report (config, dir, _("skipping, looped directory detected\n"));
+	    continue;
 	}
 
-	subdirs = FcStrSetCreate ();
+	ret += scanDir (dir, config, force, really_force, verbose, &was_processed, &subdirs, changed);
 	if (!subdirs)
-	{
-	    fprintf (stderr, _("%s: Can't create subdir set\n"), dir);
-	    ret++;
-	    FcDirCacheUnload (cache);
 	    continue;
-	}
-	for (i = 0; i < FcCacheNumSubdir (cache); i++)
-	    FcStrSetAdd (subdirs, FcCacheSubdir (cache, i));
-	
-	FcDirCacheUnload (cache);
 
 	sublist = FcStrListCreate (subdirs);
 	FcStrSetDestroy (subdirs);
@@ -286,6 +335,208 @@ scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force,
     return ret;
 }
 
+#if defined(HAVE_PTHREAD)
+
+/*
+ * With --jobs, directories go through a shared stack instead of being
+ * recursed into; whichever job is free takes the most recently found
+ * one.  A group stands for one list scanDirs would have walked, so that
+ * --error-on-no-fonts still applies per list.
+ */
+typedef struct _ScanGroup {
+    int		    pending;
+    FcBool	    processed;
+} ScanGroup;
+
+typedef struct _ScanItem {
+    struct _ScanItem	*next;
+    ScanGroup		*group;
+    FcChar8		*dir;
+} ScanItem;
+
+typedef struct _ScanQueue {
+    ScanItem	    *items;
+    int		    active;
+    FcConfig	    *config;
+    FcBool	    force;
+    FcBool	    really_force;
+    FcBool	    verbose;
+    FcBool	    error_on_no_fonts;
+    int		    ret;
+    int		    changed;
+} ScanQueue;
+
+/* Called with scan_lock held */
+static void
+scanGroupDone (ScanQueue *queue, ScanGroup *group)
+{
+    if (--group->pending > 0)
+	return;
+    if (queue->error_on_no_fonts && !group->processed)
+	queue->ret++;
+    free (group);
+}
+
+/* Called with scan_lock held */
+static FcBool
+scanQueueAdd (ScanQueue *queue, FcStrSet *dirs)
+{
+    ScanGroup	    *group;
+    ScanItem	    *item, *items = NULL, **tail = &items;
+    FcStrList	    *list;
+    const FcChar8   *dir;
+
+    list = FcStrListCreate (dirs);
+    if (!list)
+	return FcFalse;
+    group = malloc (sizeof (ScanGroup));
+    if (!group)
+    {
+	FcStrListDone (list);
+	return FcFalse;
+    }
+    group->pending = 1;
+    group->processed = FcFalse;
+    while ((dir = FcStrListNext (list)))
+    {
+	item = malloc (sizeof (ScanItem));
+	if (!item || !(item->dir = FcStrCopy (dir)))
+	{
+	    fprintf (stderr, _("Out of Memory\n"));
+	    free (item);
+	    queue->ret++;
+	    continue;
+	}
+	item->group = group;
+	*tail = item;
+	tail = &item->next;
+	group->pending++;
+    }
+    FcStrListDone (list);
+    /* Put them on top, in order */
+    *tail = queue->items;
+    queue->items = items;
+    scanGroupDone (queue, group);
+
+    return FcTrue;
+}
+
+static void *
+scanWorker (void *arg)
+{
+    ScanQueue	*queue = arg;
+    ScanItem	*item;
+    FcStrSet	*subdirs;
+    FcBool	processed, looped;
+    int		ret, changed;
+
+    pthread_mutex_lock (&scan_lock);
+    for (;;)
+    {
+	while (!queue->items && queue->active > 0)
+	    pthread_cond_wait (&scan_cond, &scan_lock);
+	if (!queue->items)
+	    break;
+	item = queue->items;
+	queue->items = item->next;
+	looped = FcStrSetMember (processed_dirs, item->dir);
+	if (!looped)
+	    FcStrSetAdd (processed_dirs, item->dir);
+	queue->active++;
+	pthread_mutex_unlock (&scan_lock);
+
+	ret = 0;
+	changed = 0;
+	processed = FcFalse;
+	subdirs = NULL;
+	if (looped)
+	{
+	    if (queue->verbose)
+		report (queue->config, item->dir, _("skipping, looped directory detected\n"));
+	}
+	else
+	    ret = scanDir (item->dir, queue->config, queue->force, queue->really_force,
+			   queue->verbose, &processed, &subdirs, &changed);
+
+	pthread_mutex_lock (&scan_lock);
+	queue->ret += ret;
+	queue->changed += changed;
+	if (processed)
+	    item->group->processed = FcTrue;
+	if (subdirs)
+	{
+	    if (!scanQueueAdd (queue, subdirs))
+	    {
+		fprintf (stderr, _("%s: Can't create subdir list\n"), item->dir);
+		queue->ret++;
+	    }
+	    FcStrSetDestroy (subdirs);
+	}
+	scanGroupDone (queue, item->group);
+	FcStrFree (item->dir);
+	free (item);
+	queue->active--;
+	pthread_cond_broadcast (&scan_cond);
+    }
+    pthread_mutex_unlock (&scan_lock);
+
+    return NULL;
+}
+
+static int
+scanDirsParallel (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force, FcBool verbose, FcBool error_on_no_fonts, int jobs, int *changed)
+{
+    ScanQueue	    queue;
+    FcStrSet	    *dirs;
+    const FcChar8   *dir;
+    pthread_t	    *threads;
+    int		    i, nthread = 0;
+
+    dirs = FcStrSetCreate ();
+    if (!dirs)
+    {
+	fprintf (stderr, _("Out of Memory\n"));
+	return 1;
+    }
+    while ((dir = FcStrListNext (list)))
+	FcStrSetAdd (dirs, dir);
+
+    memset (&queue, 0, sizeof (queue));
+    queue.config = config;
+    queue.force = force;
+    queue.really_force = really_force;
+    queue.verbose = verbose;
+    queue.error_on_no_fonts = error_on_no_fonts;
+    if (!scanQueueAdd (&queue, dirs))
+    {
+	fprintf (stderr, _("Out of Memory\n"));
+	FcStrSetDestroy (dirs);
+	return 1;
+    }
+    FcStrSetDestroy (dirs);
+
+    /* This thread is one of the jobs */
+    threads = malloc ((jobs - 1) * sizeof (pthread_t));
+    if (threads)
+    {
+	for (i = 0; i < jobs - 1; i++)
+	{
+	    if (pthread_create (&threads[i], NULL, scanWorker, &queue) != 0)
+		break;
+	    nthread++;
+	}
+    }
+    scanWorker (&queue);
+    for (i = 0; i < nthread; i++)
+	pthread_join (threads[i], NULL);
+    free (threads);
+
+    *changed += queue.changed;
+    return queue.ret;
+}
+
+#endif
+
 static FcBool
 cleanCacheDirectories (FcConfig *config, FcBool verbose)
 {
@@ -315,6 +566,9 @@ main (int argc, char **argv)
     FcBool    	verbose = FcFalse;
     FcBool	force = FcFalse;
     FcBool	really_force = FcFalse;
+    FcBool	merged = FcFalse;
+    FcBool	dirs_given = FcFalse;
+    int		jobs = 1;
     FcBool	systemOnly = FcFalse;
     FcBool	error_on_no_fonts = FcFalse;
     FcConfig	*config;
@@ -327,9 +581,9 @@ main (int argc, char **argv)
 
     setlocale (LC_ALL, "");
 #if HAVE_GETOPT_LONG
-    while ((c = getopt_long (argc, argv, "Efrsy:Vvh", longopts, NULL)) != -1)
+    while ((c = getopt_long (argc, argv, "Efj:mrsy:Vvh", longopts, NULL)) != -1)
 #else
-    while ((c = getopt (argc, argv, "Efrsy:Vvh")) != -1)
+    while ((c = getopt (argc, argv, "Efj:mrsy:Vvh")) != -1)
 #endif
     {
 	switch (c) {
@@ -342,6 +596,14 @@ main (int argc, char **argv)
 	case 'f':
 	    force = FcTrue;
 	    break;
+	case 'j':
+	    jobs = atoi (optarg);
+	    if (jobs < 1)
+		usage (argv[0], 1);
+	    break;
+	case 'm':
+	    merged = FcTrue;
+	    break;
 	case 's':
 	    systemOnly = FcTrue;
 	    break;
@@ -387,6 +649,7 @@ main (int argc, char **argv)
 
     if (argv[i])
     {
+	dirs_given = FcTrue;
 	dirs = FcStrSetCreate ();
 	if (!dirs)
 	{
@@ -426,9 +689,47 @@ main (int argc, char **argv)
 	FcStrListFirst(list);
     }
     changed = 0;
+#if defined(HAVE_PTHREAD)
+#ifdef _SC_NPROCESSORS_ONLN
+    /* More jobs than processors only add contention */
+    {
+	long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+
+	if (ncpu > 0 && jobs > ncpu)
+	    jobs = ncpu;
+    }
+#endif
+    if (jobs > 1)
+	ret = scanDirsParallel (list, config, force, really_force, verbose, error_on_no_fonts, jobs, &changed);
+    else
+#endif
     ret = scanDirs (list, config, force, really_force, verbose, error_on_no_fonts, &changed);
     FcStrListDone (list);
 
+    /* Only fc-cache writes the compiled configuration for everyone */
+    if (!FcConfigWriteCompiledConfig (config))
+    {
+	if (verbose)
+	    printf ("%s: compiled configuration not written\n", argv[0]);
+    }
+    else if (verbose)
+	printf ("%s: compiled configuration written\n", argv[0]);
+
+    /*
+     * The font database covers the configured directories only, so
+     * there is nothing to merge when scanning the ones given.
+     */
+    if (merged && !dirs_given)
+    {
+	if (!FcConfigWriteFontDatabase (config))
+	{
+	    fprintf (stderr, _("%s: failed to write the font database\n"), argv[0]);
+	    ret++;
+	}
+	else if (verbose)
+	    printf ("%s: font database written\n", argv[0]);
+    }
+
     /*
      * Try to create CACHEDIR.TAG anyway.
      * This expects the fontconfig cache directory already exists.
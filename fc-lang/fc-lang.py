@@ -380,6 +380,62 @@ static const struct {{
         print('    {{ {}, {} }}, /* {} */'.format(start, stop, c))
     print('};\n')
 
+    # Index the leaves by page so that a font charset can be
+    # checked against every language in a single pass
+    leaf_index = {}
+    for l, leaf in enumerate(leaves):
+        leaf_index[tuple(leaf)] = l
+    pages = {}
+    for i, s in enumerate(sets):
+        for leaf_num, leaf in s.leaves.items():
+            pages.setdefault(leaf_num, []).append((i, leaf_index[tuple(leaf)]))
+    # keep languages sharing a leaf next to each other
+    for page in pages:
+        pages[page].sort(key=lambda e: (e[1], e[0]))
+    page_nums = sorted(pages.keys())
+    num_page_leaves = sum(len(v) for v in pages.values())
+
+    assert num_page_leaves < 65536
+
+    print('#define NUM_LANG_PAGE	{}\n'.format(len(page_nums)))
+    print('static const FcChar16 fcLangPages[NUM_LANG_PAGE] = {')
+    for n, page in enumerate(page_nums):
+        if n % 8 == 0:
+            print('   ', end='')
+        print(' 0x{:04x},'.format(page), end='')
+        if n % 8 == 7:
+            print('')
+    if len(page_nums) % 8 != 0:
+        print('')
+    print('};\n')
+
+    print('static const FcChar16 fcLangPageStart[NUM_LANG_PAGE + 1] = {')
+    start = 0
+    for n, page in enumerate(page_nums):
+        if n % 8 == 0:
+            print('   ', end='')
+        print(' {},'.format(start), end='')
+        if n % 8 == 7:
+            print('')
+        start += len(pages[page])
+    if len(page_nums) % 8 != 0:
+        print('')
+    print('    {}'.format(start))
+    print('};\n')
+
+    print('static const FcLangPageLeaf fcLangPageLeaves[{}] = {{'.format(num_page_leaves))
+    for page in page_nums:
+        print('    /* 0x{:04x} */'.format(page))
+        for n, (i, l) in enumerate(pages[page]):
+            if n % 4 == 0:
+                print('   ', end='')
+            print(' {{ {:3}, {:3} }},'.format(i, l), end='')
+            if n % 4 == 3:
+                print('')
+        if len(pages[page]) % 4 != 0:
+            print('')
+    print('};\n')
+
     # And flush out the rest of the input file
     for line in tmpl_file:
         print(line, end='')
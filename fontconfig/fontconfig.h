@@ -425,6 +425,12 @@ FcConfigUptoDate (FcConfig *config);
 FcPublic FcBool
 FcConfigBuildFonts (FcConfig *config);
 
+FcPublic FcBool
+FcConfigWriteFontDatabase (FcConfig *config);
+
+FcPublic FcBool
+FcConfigWriteCompiledConfig (FcConfig *config);
+
 FcPublic FcStrList *
 FcConfigGetFontDirs (FcConfig   *config);
 
@@ -479,6 +485,12 @@ FcConfigSubstitute (FcConfig	*config,
 		    FcPattern	*p,
 		    FcMatchKind	kind);
 
+FcPublic FcBool
+FcConfigSubstituteWithLangs (FcConfig	 *config,
+			     FcPattern	 *p,
+			     FcStrSet	 *langs,
+			     FcMatchKind kind);
+
 FcPublic const FcChar8 *
 FcConfigGetSysRoot (const FcConfig *config);
 
@@ -539,6 +551,9 @@ FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed);
 FcPublic FcBool
 FcCharSetHasChar (const FcCharSet *fcs, FcChar32 ucs4);
 
+FcPublic int
+FcCharSetHasChars (const FcCharSet *fcs, const FcChar32 *ucs4, int n, FcChar32 *coverage);
+
 FcPublic FcChar32
 FcCharSetCount (const FcCharSet *a);
 
@@ -666,6 +681,9 @@ FcInitReinitialize (void);
 FcPublic FcBool
 FcInitBringUptoDate (void);
 
+FcPublic FcBool
+FcInitBringUptoDateAsync (void);
+
 /* fclang.c */
 FcPublic FcStrSet *
 FcGetLangs (void);
@@ -803,9 +821,35 @@ FcFontSort (FcConfig	 *config,
 	    FcCharSet    **csp,
 	    FcResult	 *result);
 
+FcPublic FcFontSet *
+FcFontSortTopN (FcConfig    *config,
+		FcPattern   *p,
+		FcBool	    trim,
+		int	    n,
+		FcCharSet   **csp,
+		FcResult    *result);
+
+FcPublic FcFontSet *
+FcFontSortForChars (FcConfig	    *config,
+		    FcPattern	    *p,
+		    const FcChar32  *ucs4,
+		    int		    n,
+		    FcResult	    *result);
+
 FcPublic void
 FcFontSetSortDestroy (FcFontSet *fs);
 
+FcPublic FcBool
+FcConfigSetMatchCacheSize (FcConfig *config, int size);
+
+FcPublic int
+FcConfigGetMatchCacheSize (FcConfig *config);
+
+FcPublic void
+FcConfigGetMatchCacheStats (FcConfig	    *config,
+			    unsigned long   *hits,
+			    unsigned long   *misses);
+
 /* fcmatrix.c */
 FcPublic FcMatrix *
 FcMatrixCopy (const FcMatrix *mat);
@@ -451,9 +451,9 @@ FcDirCacheProcess (FcConfig *config, const FcChar8 *dir,
 #define FC_CACHE_MIN_MMAP   1024
 
 /*
- * Skip list element, make sure the 'next' pointer is the last thing
- * in the structure, it will be allocated large enough to hold all
- * of the necessary pointers
+ * Bookkeeping for each loaded cache.  Entries are only added to the
+ * registry and freed with cache_lock held; the reference count is
+ * atomic.
  */
 
 typedef struct _FcCacheSkip FcCacheSkip;
@@ -467,19 +467,40 @@ struct _FcCacheSkip {
     ino_t	    cache_ino;
     time_t	    cache_mtime;
     long	    cache_mtime_nano;
-    FcCacheSkip	    *next[1];
 };
 
 /*
- * The head of the skip list; pointers for every possible level
- * in the skip list, plus the largest level in the list
+ * The registry of loaded caches is an immutable array of address
+ * ranges sorted by address, so that finding the cache an object lives
+ * in is a binary search that never takes a lock.  Writers, serialized
+ * by cache_lock, publish a modified copy and retire the old array;
+ * retired arrays are freed once no reader is left in the registry.
+ * The ranges are copied into the array so that a reader never touches
+ * an entry other than the one it is looking for, which the caller
+ * holds a reference to.  That also lets a writer that can't allocate a
+ * new array empty an entry in place; such entries have no skip and are
+ * dropped by the next copy.
  */
 
-#define FC_CACHE_MAX_LEVEL  16
+typedef struct _FcCacheRange {
+    const char	    *begin;
+    const char	    *end;
+    FcCacheSkip	    *skip;
+} FcCacheRange;
+
+typedef struct _FcCacheRegistry FcCacheRegistry;
+
+struct _FcCacheRegistry {
+    FcCacheRegistry *retired_next;
+    int		    nrange;
+    FcCacheRange    ranges[1];
+};
+
+static FcCacheRegistry	*fcCacheRegistry;
+static fc_atomic_int_t	fcCacheRegistryReaders;
 
 /* Protected by cache_lock below */
-static FcCacheSkip	*fcCacheChains[FC_CACHE_MAX_LEVEL];
-static int		fcCacheMaxLevel;
+static FcCacheRegistry	*fcCacheRetired;
 
 
 static FcMutex *cache_lock;
@@ -498,11 +519,6 @@ retry:
       free (lock);
       goto retry;
     }
-
-    FcMutexLock (lock);
-    /* Initialize random state */
-    FcRandom ();
-    return;
   }
   FcMutexLock (lock);
 }
@@ -526,66 +542,121 @@ free_lock (void)
   }
 }
 
+/*
+ * Count the entries of r that haven't been emptied in place.
+ */
+static int
+FcCacheRegistryLive (const FcCacheRegistry *r)
+{
+    int i, n = 0;
+
+    for (i = 0; r && i < r->nrange; i++)
+	if (r->ranges[i].skip)
+	    n++;
+
+    return n;
+}
+
+static FcCacheRegistry *
+FcCacheRegistryCreate (int nrange)
+{
+    FcCacheRegistry *r;
 
+    r = malloc (sizeof (FcCacheRegistry) + (nrange - 1) * sizeof (FcCacheRange));
+    if (!r)
+	return NULL;
+    r->retired_next = NULL;
+    r->nrange = nrange;
+
+    return r;
+}
 
 /*
- * Generate a random level number, distributed
- * so that each level is 1/4 as likely as the one before
- *
- * Note that level numbers run 1 <= level <= MAX_LEVEL
+ * Free the retired arrays if nobody can be looking at them any more.
+ * The count is read with an atomic add so that it is ordered against
+ * the increment a reader does before loading the registry.
  */
-static int
-random_level (void)
+static void
+FcCacheRegistryReclaimUnlocked (void)
 {
-    /* tricky bit -- each bit is '1' 75% of the time */
-    long int	bits = FcRandom () | FcRandom ();
-    int	level = 0;
+    FcCacheRegistry *r, *next;
 
-    while (++level < FC_CACHE_MAX_LEVEL)
+    if (fc_atomic_int_add (fcCacheRegistryReaders, 0) != 0)
+	return;
+    for (r = fcCacheRetired; r; r = next)
     {
-	if (bits & 1)
-	    break;
-	bits >>= 1;
+	next = r->retired_next;
+	free (r);
     }
-    return level;
+    fcCacheRetired = NULL;
 }
 
 /*
- * Insert cache into the list
+ * Replace the registry with new, which may be NULL when there are no
+ * caches left.  Called with cache_lock held.
  */
-static FcBool
-FcCacheInsert (FcCache *cache, struct stat *cache_stat)
+static void
+FcCacheRegistryPublishUnlocked (FcCacheRegistry *new)
 {
-    FcCacheSkip    **update[FC_CACHE_MAX_LEVEL];
-    FcCacheSkip    *s, **next;
-    int		    i, level;
-
-    lock_cache ();
+    FcCacheRegistry *old;
 
-    /*
-     * Find links along each chain
-     */
-    next = fcCacheChains;
-    for (i = fcCacheMaxLevel; --i >= 0; )
+    do
+	old = fc_atomic_ptr_get (&fcCacheRegistry);
+    while (!fc_atomic_ptr_cmpexch (&fcCacheRegistry, old, new));
+    if (old)
     {
-	for (; (s = next[i]); next = s->next)
-	    if (s->cache > cache)
-		break;
-        update[i] = &next[i];
+	old->retired_next = fcCacheRetired;
+	fcCacheRetired = old;
     }
+    FcCacheRegistryReclaimUnlocked ();
+}
 
-    /*
-     * Create new list element
-     */
-    level = random_level ();
-    if (level > fcCacheMaxLevel)
+/*
+ * Return the index of the first range ending after object.
+ */
+static int
+FcCacheRegistrySearch (const FcCacheRegistry *r, const void *object)
+{
+    int lo = 0, hi = r->nrange;
+
+    while (lo < hi)
     {
-	level = fcCacheMaxLevel + 1;
-	update[fcCacheMaxLevel] = &fcCacheChains[fcCacheMaxLevel];
-	fcCacheMaxLevel = level;
+	int mid = (lo + hi) >> 1;
+
+	if ((const char *) object >= r->ranges[mid].end)
+	    lo = mid + 1;
+	else
+	    hi = mid;
     }
 
-    s = malloc (sizeof (FcCacheSkip) + (level - 1) * sizeof (FcCacheSkip *));
+    return lo;
+}
+
+static FcCacheSkip *
+FcCacheRegistryFind (const FcCacheRegistry *r, const void *object)
+{
+    int i;
+
+    if (!r || !object)
+	return NULL;
+    i = FcCacheRegistrySearch (r, object);
+    if (i < r->nrange && (const char *) object >= r->ranges[i].begin)
+	return r->ranges[i].skip;
+
+    return NULL;
+}
+
+/*
+ * Insert cache into the registry
+ */
+static FcBool
+FcCacheInsert (FcCache *cache, struct stat *cache_stat)
+{
+    FcCacheRegistry *old, *new;
+    FcCacheSkip	    *s;
+    int		    i, j, n;
+
+    s = malloc (sizeof (FcCacheSkip));
     if (!s)
 	return FcFalse;
 
@@ -612,101 +683,124 @@ FcCacheInsert (FcCache *cache, struct stat *cache_stat)
 	s->cache_mtime_nano = 0;
     }
 
-    /*
-     * Insert into all fcCacheChains
-     */
-    for (i = 0; i < level; i++)
+    lock_cache ();
+
+    old = fc_atomic_ptr_get (&fcCacheRegistry);
+    n = old ? old->nrange : 0;
+    new = FcCacheRegistryCreate (FcCacheRegistryLive (old) + 1);
+    if (!new)
     {
-	s->next[i] = *update[i];
-	*update[i] = s;
+	unlock_cache ();
+	free (s);
+	return FcFalse;
     }
+    for (i = 0, j = 0; i < n && old->ranges[i].end <= (const char *) cache; i++)
+	if (old->ranges[i].skip)
+	    new->ranges[j++] = old->ranges[i];
+    new->ranges[j].begin = (const char *) cache;
+    new->ranges[j].end = (const char *) cache + s->size;
+    new->ranges[j].skip = s;
+    for (j++; i < n; i++)
+	if (old->ranges[i].skip)
+	    new->ranges[j++] = old->ranges[i];
+    FcCacheRegistryPublishUnlocked (new);
 
     unlock_cache ();
     return FcTrue;
 }
 
+/*
+ * Look up the cache containing object with cache_lock held.
+ */
 static FcCacheSkip *
 FcCacheFindByAddrUnlocked (void *object)
 {
-    int	    i;
-    FcCacheSkip    **next = fcCacheChains;
-    FcCacheSkip    *s;
-
-    if (!object)
-	return NULL;
-
-    /*
-     * Walk chain pointers one level at a time
-     */
-    for (i = fcCacheMaxLevel; --i >= 0;)
-	while (next[i] && (char *) object >= ((char *) next[i]->cache + next[i]->size))
-	    next = next[i]->next;
-    /*
-     * Here we are
-     */
-    s = next[0];
-    if (s && (char *) object < ((char *) s->cache + s->size))
-	return s;
-    return NULL;
+    return FcCacheRegistryFind (fc_atomic_ptr_get (&fcCacheRegistry), object);
 }
 
+/*
+ * Look up the cache containing object without taking the lock.  The
+ * caller must hold a reference to that cache for the result to stay
+ * valid.
+ */
 static FcCacheSkip *
 FcCacheFindByAddr (void *object)
 {
     FcCacheSkip *ret;
-    lock_cache ();
-    ret = FcCacheFindByAddrUnlocked (object);
-    unlock_cache ();
+
+    if (!object)
+	return NULL;
+    fc_atomic_int_add (fcCacheRegistryReaders, 1);
+    ret = FcCacheRegistryFind (fc_atomic_ptr_get (&fcCacheRegistry), object);
+    fc_atomic_int_add (fcCacheRegistryReaders, -1);
+
     return ret;
 }
 
 static void
 FcCacheRemoveUnlocked (FcCache *cache)
 {
-    FcCacheSkip	    **update[FC_CACHE_MAX_LEVEL];
-    FcCacheSkip	    *s, **next;
-    int		    i;
-    void            *allocated;
+    FcCacheRegistry *old, *new = NULL;
+    FcCacheSkip	    *s;
+    int		    i, j, k, n;
+    void            *allocated, *next;
 
-    /*
-     * Find links along each chain
-     */
-    next = fcCacheChains;
-    for (i = fcCacheMaxLevel; --i >= 0; )
+    old = fc_atomic_ptr_get (&fcCacheRegistry);
+    if (!old)
+	return;
+    n = old->nrange;
+    i = FcCacheRegistrySearch (old, cache);
+    if (i == n || old->ranges[i].begin != (const char *) cache ||
+	!old->ranges[i].skip)
+	return;
+    s = old->ranges[i].skip;
+
+    k = FcCacheRegistryLive (old) - 1;
+    if (k > 0)
+	new = FcCacheRegistryCreate (k);
+    if (k > 0 && !new)
     {
-	for (; (s = next[i]); next = s->next)
-	    if (s->cache >= cache)
-		break;
-        update[i] = &next[i];
+	/*
+	 * Empty the entry in place.  Nobody holds a reference to the
+	 * cache any more, so no reader is looking for it, and an empty
+	 * range still sorts the same for everybody else.
+	 */
+	old->ranges[i].end = old->ranges[i].begin;
+	old->ranges[i].skip = NULL;
+    }
+    else
+    {
+	for (j = 0, k = 0; j < n; j++)
+	    if (j != i && old->ranges[j].skip)
+		new->ranges[k++] = old->ranges[j];
+	FcCacheRegistryPublishUnlocked (new);
     }
-    s = next[0];
-    for (i = 0; i < fcCacheMaxLevel && *update[i] == s; i++)
-	*update[i] = s->next[i];
-    while (fcCacheMaxLevel > 0 && fcCacheChains[fcCacheMaxLevel - 1] == NULL)
-	fcCacheMaxLevel--;
 
-    if (s)
+    allocated = s->allocated;
+    while (allocated)
     {
-	allocated = s->allocated;
-	while (allocated)
-	{
-	    /* First element in allocated chunk is the free list */
-	    next = *(void **)allocated;
-	    free (allocated);
-	    allocated = next;
-	}
-	free (s);
+	/* First element in allocated chunk is the free list */
+	next = *(void **)allocated;
+	free (allocated);
+	allocated = next;
     }
+    free (s);
 }
 
 static FcCache *
 FcCacheFindByStat (struct stat *cache_stat)
 {
+    FcCacheRegistry *r;
     FcCacheSkip	    *s;
+    int		    i;
 
     lock_cache ();
-    for (s = fcCacheChains[0]; s; s = s->next[0])
-	if (s->cache_dev == cache_stat->st_dev &&
+    r = fc_atomic_ptr_get (&fcCacheRegistry);
+    for (i = 0; r && i < r->nrange; i++)
+    {
+	s = r->ranges[i].skip;
+	if (s &&
+	    s->cache_dev == cache_stat->st_dev &&
 	    s->cache_ino == cache_stat->st_ino &&
 	    s->cache_mtime == cache_stat->st_mtime)
 	{
@@ -718,6 +812,7 @@ FcCacheFindByStat (struct stat *cache_stat)
 	    unlock_cache ();
 	    return s->cache;
 	}
+    }
     unlock_cache ();
     return NULL;
 }
@@ -755,14 +850,20 @@ FcCacheObjectDereference (void *object)
 {
     FcCacheSkip	*skip;
 
-    lock_cache ();
-    skip = FcCacheFindByAddrUnlocked (object);
-    if (skip)
+    skip = FcCacheFindByAddr (object);
+    if (skip && FcRefDec (&skip->ref) == 1)
     {
-	if (FcRefDec (&skip->ref) == 1)
+	/*
+	 * FcCacheFindByStat may have handed the cache out again in the
+	 * meantime, or somebody else disposed of it already, so check
+	 * again under the lock.
+	 */
+	lock_cache ();
+	skip = FcCacheFindByAddrUnlocked (object);
+	if (skip && fc_atomic_int_add (skip->ref.count, 0) == 0)
 	    FcDirCacheDisposeUnlocked (skip->cache);
+	unlock_cache ();
     }
-    unlock_cache ();
 }
 
 void *
@@ -792,24 +893,28 @@ FcCacheAllocate (FcCache *cache, size_t len)
 void
 FcCacheFini (void)
 {
+    FcCacheRegistry *r;
     int		    i;
 
+    r = fc_atomic_ptr_get (&fcCacheRegistry);
     if (FcDebug() & FC_DBG_CACHE)
     {
-	for (i = 0; i < FC_CACHE_MAX_LEVEL; i++)
+	for (i = 0; r && i < r->nrange; i++)
 	{
-	    if (fcCacheChains[i] != NULL)
-	    {
-		FcCacheSkip *s = fcCacheChains[i];
-		fprintf(stderr, "Fontconfig error: not freed %p (dir: %s, refcount %" FC_ATOMIC_INT_FORMAT ")\n", s->cache, FcCacheDir(s->cache), s->ref.count);
-	    }
+	    FcCacheSkip *s = r->ranges[i].skip;
+	    if (!s)
+		continue;
+	    fprintf(stderr, "Fontconfig error: not freed %p (dir: %s, refcount %" FC_ATOMIC_INT_FORMAT ")\n", s->cache, FcCacheDir(s->cache), s->ref.count);
 	}
     }
 
+    lock_cache ();
+    FcCacheRegistryReclaimUnlocked ();
+    unlock_cache ();
     free_lock ();
 }
 
-static FcBool
+FcBool
 FcCacheTimeValid (FcConfig *config, FcCache *cache, struct stat *dir_stat)
 {
     struct stat	dir_static;
@@ -846,8 +951,30 @@ FcCacheTimeValid (FcConfig *config, FcCache *cache, struct stat *dir_stat)
     return dir_stat->st_mtime == 0 || (cache->checksum == (int) dir_stat->st_mtime && fnano);
 }
 
+/*
+ * Cache files that could only have been written by this user or by
+ * root are as trustworthy as the library reading them; anything else
+ * may have been crafted by someone else.
+ */
 static FcBool
-FcCacheOffsetsValid (FcCache *cache)
+FcCacheFileTrusted (struct stat *fd_stat)
+{
+#ifndef _WIN32
+    return (fd_stat->st_uid == 0 || fd_stat->st_uid == geteuid ()) &&
+	!(fd_stat->st_mode & (S_IWGRP | S_IWOTH));
+#else
+    return FcFalse;
+#endif
+}
+
+/*
+ * Check that the offsets in cache stay within the file.  Walking every
+ * pattern faults in nearly every page of the file, so for trusted files
+ * only the header, the directory list and the font offsets are checked;
+ * the patterns are paged in as matching gets to them.
+ */
+static FcBool
+FcCacheOffsetsValid (FcCache *cache, FcBool trusted)
 {
     char		*base = (char *)cache;
     char		*end = base + cache->size;
@@ -901,8 +1028,11 @@ FcCacheOffsetsValid (FcCache *cache)
 	    char                *last_offset;
 
             if ((char *) font < base ||
-                (char *) font > end - sizeof (FcFontSet) ||
-                font->elts_offset < 0 ||
+                (char *) font > end - sizeof (FcFontSet))
+                return FcFalse;
+	    if (trusted)
+		continue;
+            if (font->elts_offset < 0 ||
                 font->elts_offset > end - (char *) font ||
                 font->num > (end - (char *) font - font->elts_offset) / sizeof (FcPatternElt) ||
 		!FcRefIsConst (&font->ref))
@@ -996,7 +1126,7 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
     if (cache->magic != FC_CACHE_MAGIC_MMAP ||
 	cache->version < FC_CACHE_VERSION_NUMBER ||
 	cache->size != (intptr_t) fd_stat->st_size ||
-        !FcCacheOffsetsValid (cache) ||
+        !FcCacheOffsetsValid (cache, FcCacheFileTrusted (fd_stat)) ||
 	!FcCacheTimeValid (config, cache, dir_stat) ||
 	!FcCacheInsert (cache, fd_stat))
     {
@@ -1214,6 +1344,139 @@ FcDirCacheValidConfig (const FcChar8 *dir, FcConfig *config)
 			      NULL, NULL);
 }
 
+/*
+ * Stat the cache file of dir in each cache directory, under the name
+ * FcDirCacheProcess would open, and pass those that exist to callback
+ * until it returns FcFalse.  Returns FcFalse if it couldn't look at all
+ * of them.
+ */
+static FcBool
+FcDirCacheStatFiles (FcConfig *config, const FcChar8 *dir,
+		     FcBool (*callback) (struct stat *file_stat, void *closure),
+		     void *closure)
+{
+    const FcChar8   *sysroot = FcConfigGetSysRoot (config);
+    FcChar8	    cache_base[CACHEBASE_LEN];
+#ifndef _WIN32
+    FcChar8	    uuid_cache_base[CACHEBASE_LEN];
+    FcBool	    uuid_tried = FcFalse;
+#endif
+    FcStrList	    *list;
+    FcChar8	    *cache_dir, *cache_hashed;
+    struct stat	    file_stat;
+    FcBool	    ret = FcTrue;
+    int		    r;
+
+    FcDirCacheBasenameMD5 (config, dir, cache_base);
+#ifndef _WIN32
+    uuid_cache_base[0] = 0;
+#endif
+    list = FcStrListCreate (config->cacheDirs);
+    if (!list)
+	return FcFalse;
+    while ((cache_dir = FcStrListNext (list)))
+    {
+	if (sysroot)
+	    cache_hashed = FcStrBuildFilename (sysroot, cache_dir, cache_base, NULL);
+	else
+	    cache_hashed = FcStrBuildFilename (cache_dir, cache_base, NULL);
+	if (!cache_hashed)
+	{
+	    ret = FcFalse;
+	    break;
+	}
+	r = FcStat (cache_hashed, &file_stat);
+	FcStrFree (cache_hashed);
+#ifndef _WIN32
+	if (r < 0)
+	{
+	    if (!uuid_tried)
+	    {
+		FcDirCacheBasenameUUID (config, dir, uuid_cache_base);
+		uuid_tried = FcTrue;
+	    }
+	    if (!uuid_cache_base[0])
+		continue;
+	    if (sysroot)
+		cache_hashed = FcStrBuildFilename (sysroot, cache_dir, uuid_cache_base, NULL);
+	    else
+		cache_hashed = FcStrBuildFilename (cache_dir, uuid_cache_base, NULL);
+	    if (!cache_hashed)
+	    {
+		ret = FcFalse;
+		break;
+	    }
+	    r = FcStat (cache_hashed, &file_stat);
+	    FcStrFree (cache_hashed);
+	}
+#endif
+	if (r == 0 && !(*callback) (&file_stat, closure))
+	    break;
+    }
+    FcStrListDone (list);
+
+    return ret;
+}
+
+typedef struct _FcCacheFileCurrent {
+    dev_t   dev;
+    ino_t   ino;
+    time_t  mtime;
+    long    nano;
+    FcBool  found;
+    FcBool  newer;
+} FcCacheFileCurrent;
+
+static FcBool
+FcDirCacheCurrentHelper (struct stat *file_stat, void *closure)
+{
+    FcCacheFileCurrent	*c = closure;
+    long		nano = 0;
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    nano = file_stat->st_mtim.tv_nsec;
+#endif
+    if (c->ino != 0 && file_stat->st_dev == c->dev && file_stat->st_ino == c->ino &&
+	file_stat->st_mtime == c->mtime && nano == c->nano)
+	c->found = FcTrue;
+    else if (c->ino == 0 || file_stat->st_mtime > c->mtime ||
+	     (file_stat->st_mtime == c->mtime && nano >= c->nano))
+	c->newer = FcTrue;
+
+    return !c->newer;
+}
+
+/*
+ * Whether loading the cache of cache's directory would give cache
+ * itself, rather than a cache file written since, as fc-cache -f does
+ * without touching the directory.  Only the cache files are stat'ed:
+ * cache has to be one of them, and none of the others may be as new.
+ * A cache that wasn't loaded from a file is current until one shows up.
+ */
+FcBool
+FcDirCacheFileCurrent (FcConfig *config, FcCache *cache)
+{
+    FcCacheFileCurrent	c;
+    FcCacheSkip		*skip;
+
+    memset (&c, 0, sizeof (c));
+    lock_cache ();
+    skip = FcCacheFindByAddrUnlocked (cache);
+    if (skip)
+    {
+	c.dev = skip->cache_dev;
+	c.ino = skip->cache_ino;
+	c.mtime = skip->cache_mtime;
+	c.nano = skip->cache_mtime_nano;
+    }
+    unlock_cache ();
+    if (!skip ||
+	!FcDirCacheStatFiles (config, FcCacheDir (cache), FcDirCacheCurrentHelper, &c))
+	return FcFalse;
+
+    return !c.newer && (c.ino == 0 || c.found);
+}
+
 FcBool
 FcDirCacheValid (const FcChar8 *dir)
 {
@@ -1341,12 +1604,11 @@ FcDirCacheRebuild (FcCache *cache, struct stat *dir_stat, FcStrSet *dirs)
     return new;
 }
 
-/* write serialized state to the cache file */
-FcBool
-FcDirCacheWrite (FcCache *cache, FcConfig *config)
+/* write serialized state to the file named cache_base in the first writable cache directory */
+static FcBool
+FcCacheWriteFile (FcCache *cache, FcConfig *config, const FcChar8 *cache_base)
 {
     FcChar8	    *dir = FcCacheDir (cache);
-    FcChar8	    cache_base[CACHEBASE_LEN];
     FcChar8	    *cache_hashed;
     int 	    fd;
     FcAtomic 	    *atomic;
@@ -1435,7 +1697,6 @@ FcDirCacheWrite (FcCache *cache, FcConfig *config)
     if (!cache_dir)
 	return FcFalse;
 
-    FcDirCacheBasenameMD5 (config, dir, cache_base);
     cache_hashed = FcStrBuildFilename (cache_dir, cache_base, NULL);
     FcStrFree (cache_dir);
     if (!cache_hashed)
@@ -1517,6 +1778,486 @@ FcDirCacheWrite (FcCache *cache, FcConfig *config)
     return FcFalse;
 }
 
+/* write serialized state to the cache file */
+FcBool
+FcDirCacheWrite (FcCache *cache, FcConfig *config)
+{
+    FcChar8	    cache_base[CACHEBASE_LEN];
+
+    FcDirCacheBasenameMD5 (config, FcCacheDir (cache), cache_base);
+
+    return FcCacheWriteFile (cache, config, cache_base);
+}
+
+/*
+ * A font database holds the fonts from all directories of a
+ * configuration in a single cache file, already passed through the
+ * configuration's accept and reject rules.  Its directory name is the
+ * key FcConfigBuildFonts looks it up by, its subdirectories are all the
+ * font directories that went into it and its checksum covers the state
+ * of every one of those.
+ */
+#define FC_FONT_DATABASE_SUFFIX	".fontdb-" FC_CACHE_VERSION
+#define FONTDBBASE_LEN (1 + 32 + 1 + sizeof (FC_ARCHITECTURE) + sizeof (FC_FONT_DATABASE_SUFFIX))
+
+static void
+FcFontDatabaseBasename (const FcChar8 *key, FcChar8 db_base[FONTDBBASE_LEN])
+{
+    unsigned char	hash[16];
+    struct MD5Context	ctx;
+    int			cnt;
+
+    MD5Init (&ctx);
+    MD5Update (&ctx, (const unsigned char *) key, strlen ((const char *) key));
+    MD5Final (hash, &ctx);
+
+    db_base[0] = '/';
+    for (cnt = 0; cnt < 16; ++cnt)
+    {
+	db_base[1 + 2*cnt] = bin2hex[hash[cnt] >> 4];
+	db_base[1 + 2*cnt+1] = bin2hex[hash[cnt] & 0xf];
+    }
+    db_base[1 + 2*cnt] = 0;
+    strcat ((char *) db_base, "-" FC_ARCHITECTURE FC_FONT_DATABASE_SUFFIX);
+}
+
+static uint64_t
+FcFontDatabaseChecksumAdd (uint64_t checksum, int64_t v)
+{
+    int i;
+
+    /* FNV-1a */
+    for (i = 0; i < 8; i++)
+    {
+	checksum ^= (uint64_t) (v >> (i * 8)) & 0xff;
+	checksum *= 0x100000001b3ULL;
+    }
+
+    return checksum;
+}
+
+static FcBool
+FcFontDatabaseChecksumHelper (struct stat *file_stat, void *closure)
+{
+    uint64_t	*checksum = closure;
+    long	nano = 0;
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    nano = file_stat->st_mtim.tv_nsec;
+#endif
+    *checksum = FcFontDatabaseChecksumAdd (*checksum, file_stat->st_dev);
+    *checksum = FcFontDatabaseChecksumAdd (*checksum, file_stat->st_ino);
+    *checksum = FcFontDatabaseChecksumAdd (*checksum, file_stat->st_mtime);
+    *checksum = FcFontDatabaseChecksumAdd (*checksum, nano);
+
+    return FcTrue;
+}
+
+/*
+ * Fold the state of dir and of its cache files into the checksum.  A
+ * missing directory counts too, so that creating it makes the database
+ * stale.  The cache files catch fonts changed in place, which leave the
+ * directory alone, once fc-cache -f has rewritten the cache.
+ */
+static uint64_t
+FcFontDatabaseChecksumDir (FcConfig *config, uint64_t checksum, const FcChar8 *dir)
+{
+    const FcChar8   *sysroot = FcConfigGetSysRoot (config);
+    struct stat	    statb;
+    FcChar8	    *d;
+
+    if (sysroot)
+	d = FcStrBuildFilename (sysroot, dir, NULL);
+    else
+	d = FcStrdup (dir);
+    if (!d || FcStatChecksum (d, &statb) < 0)
+	checksum = FcFontDatabaseChecksumAdd (checksum, -1);
+    else
+    {
+	checksum = FcFontDatabaseChecksumAdd (checksum, FcDirChecksum (&statb));
+	checksum = FcFontDatabaseChecksumAdd (checksum, FcDirChecksumNano (&statb));
+    }
+    if (d)
+	FcStrFree (d);
+    if (!FcDirCacheStatFiles (config, dir, FcFontDatabaseChecksumHelper, &checksum))
+	checksum = FcFontDatabaseChecksumAdd (checksum, -1);
+    /* Tells where the files of one directory end */
+    checksum = FcFontDatabaseChecksumAdd (checksum, -2);
+
+    return checksum;
+}
+
+int64_t
+FcFontDatabaseChecksum (FcConfig *config, FcStrSet *dirs)
+{
+    uint64_t	checksum = 0xcbf29ce484222325ULL;
+    int		i;
+
+    for (i = 0; i < dirs->num; i++)
+	checksum = FcFontDatabaseChecksumDir (config, checksum, dirs->strs[i]);
+
+    return (int64_t) checksum;
+}
+
+static FcBool
+FcFontDatabaseValid (FcConfig *config, FcCache *cache)
+{
+    uint64_t	checksum = 0xcbf29ce484222325ULL;
+    int		i;
+
+    for (i = 0; i < cache->dirs_count; i++)
+	checksum = FcFontDatabaseChecksumDir (config, checksum, FcCacheSubdir (cache, i));
+    if (FcDebug () & FC_DBG_CACHE)
+	printf ("FcFontDatabaseValid %d dirs checksum %" FC_UINT64_FORMAT " current checksum %" FC_UINT64_FORMAT "\n",
+		cache->dirs_count, (unsigned long long) cache->checksum_nano, (unsigned long long) checksum);
+
+    return cache->checksum_nano == (int64_t) checksum &&
+	cache->checksum == (int) (checksum >> 32);
+}
+
+/*
+ * Map the font database in file if it is up to date.
+ */
+static FcCache *
+FcFontDatabaseMapFile (FcConfig *config, const FcChar8 *file)
+{
+    struct stat	file_stat, dir_stat;
+    FcCache	*cache = NULL;
+    int		fd;
+
+    fd = FcDirCacheOpenFile (file, &file_stat);
+    if (fd < 0)
+	return NULL;
+    /* There is no single directory to check the time of */
+    memset (&dir_stat, 0, sizeof (dir_stat));
+    cache = FcDirCacheMapFd (config, fd, &file_stat, &dir_stat);
+    close (fd);
+    if (cache && !FcFontDatabaseValid (config, cache))
+    {
+	FcDirCacheUnload (cache);
+	cache = NULL;
+    }
+
+    return cache;
+}
+
+/*
+ * Find an up to date font database for key in the cache directories.
+ */
+FcCache *
+FcFontDatabaseLoad (FcConfig *config, const FcChar8 *key)
+{
+    FcChar8	    db_base[FONTDBBASE_LEN];
+    FcChar8	    *cache_dir, *db_file;
+    const FcChar8   *sysroot = FcConfigGetSysRoot (config);
+    FcStrList	    *list;
+    FcCache	    *cache = NULL;
+
+    FcFontDatabaseBasename (key, db_base);
+    list = FcStrListCreate (config->cacheDirs);
+    if (!list)
+	return NULL;
+    while (!cache && (cache_dir = FcStrListNext (list)))
+    {
+	if (sysroot)
+	    db_file = FcStrBuildFilename (sysroot, cache_dir, db_base, NULL);
+	else
+	    db_file = FcStrBuildFilename (cache_dir, db_base, NULL);
+	if (!db_file)
+	    break;
+	cache = FcFontDatabaseMapFile (config, db_file);
+	if (cache && strcmp ((const char *) FcCacheDir (cache), (const char *) key) != 0)
+	{
+	    FcDirCacheUnload (cache);
+	    cache = NULL;
+	}
+	if (FcDebug () & FC_DBG_CACHE)
+	    printf ("FcFontDatabaseLoad file \"%s\": %s\n", db_file, cache ? "used" : "not usable");
+	FcStrFree (db_file);
+    }
+    FcStrListDone (list);
+
+    return cache;
+}
+
+/*
+ * Write set and dirs out as the font database for key.  checksum has to
+ * be taken from dirs before the fonts in them were read.
+ */
+FcBool
+FcFontDatabaseWrite (FcConfig *config, const FcChar8 *key, FcFontSet *set, FcStrSet *dirs, int64_t checksum)
+{
+    FcChar8	db_base[FONTDBBASE_LEN];
+    struct stat	dir_stat;
+    FcFontSet	*copy;
+    FcCache	*cache;
+    FcBool	ret = FcFalse;
+    int		i;
+
+    /*
+     * The fonts mostly come from mapped caches, which the serializer
+     * can't walk; give it plain patterns instead.
+     */
+    copy = FcFontSetCreate ();
+    if (!copy)
+	return FcFalse;
+    for (i = 0; i < set->nfont; i++)
+    {
+	FcPattern *font = FcPatternDuplicate (set->fonts[i]);
+
+	if (!font || !FcFontSetAdd (copy, font))
+	{
+	    if (font)
+		FcPatternDestroy (font);
+	    goto bail;
+	}
+    }
+
+    memset (&dir_stat, 0, sizeof (dir_stat));
+    cache = FcDirCacheBuild (copy, key, &dir_stat, dirs);
+    if (!cache)
+	goto bail;
+    cache->checksum = (int) ((uint64_t) checksum >> 32);
+    cache->checksum_nano = checksum;
+
+    FcFontDatabaseBasename (key, db_base);
+    ret = FcCacheWriteFile (cache, config, db_base);
+    FcDirCacheUnload (cache);
+bail:
+    FcFontSetDestroy (copy);
+
+    return ret;
+}
+
+/*
+ * A compiled configuration holds the result of parsing the
+ * configuration files so that they needn't be parsed again.  It has to
+ * be found before any <cachedir> element has been seen, so it lives in
+ * the default cache directories: the system one, written by fc-cache
+ * only, and the user's own.
+ */
+#define FC_COMPILED_CONFIG_SUFFIX	".config-" FC_CACHE_VERSION
+#define CONFIGBASE_LEN (32 + 1 + sizeof (FC_ARCHITECTURE) + sizeof (FC_COMPILED_CONFIG_SUFFIX))
+
+static void
+FcCompiledConfigBasename (const FcChar8 *key, FcChar8 config_base[CONFIGBASE_LEN])
+{
+    unsigned char	hash[16];
+    struct MD5Context	ctx;
+    int			cnt;
+
+    MD5Init (&ctx);
+    MD5Update (&ctx, (const unsigned char *) key, strlen ((const char *) key));
+    MD5Final (hash, &ctx);
+
+    /* Unlike the cache names, without a leading slash */
+    for (cnt = 0; cnt < 16; ++cnt)
+    {
+	config_base[2*cnt] = bin2hex[hash[cnt] >> 4];
+	config_base[2*cnt+1] = bin2hex[hash[cnt] & 0xf];
+    }
+    config_base[2*cnt] = 0;
+    strcat ((char *) config_base, "-" FC_ARCHITECTURE FC_COMPILED_CONFIG_SUFFIX);
+}
+
+static FcStrSet *
+FcCompiledConfigDirs (FcConfig *config)
+{
+    const FcChar8   *sysroot = FcConfigGetSysRoot (config);
+    FcStrSet	    *dirs;
+    FcChar8	    *xdg, *d;
+
+    dirs = FcStrSetCreate ();
+    if (!dirs)
+	return NULL;
+    /* The system one comes first */
+    if (sysroot)
+	d = FcStrBuildFilename (sysroot, FC_CACHEDIR, NULL);
+    else
+	d = FcStrCopyFilename ((const FcChar8 *) FC_CACHEDIR);
+    if (!d || !FcStrSetAdd (dirs, d))
+    {
+	if (d)
+	    FcStrFree (d);
+	FcStrSetDestroy (dirs);
+	return NULL;
+    }
+    FcStrFree (d);
+    /* The home directory might be disabled */
+    xdg = FcConfigXdgCacheHome ();
+    if (xdg)
+    {
+	if (sysroot)
+	    d = FcStrBuildFilename (sysroot, xdg, "fontconfig", NULL);
+	else
+	    d = FcStrBuildFilename (xdg, "fontconfig", NULL);
+	if (d)
+	{
+	    FcStrSetAdd (dirs, d);
+	    FcStrFree (d);
+	}
+	FcStrFree (xdg);
+    }
+
+    return dirs;
+}
+
+/*
+ * Hand the contents of the compiled configuration in file to callback.
+ */
+static FcBool
+FcCompiledConfigProcessFile (FcConfig *config, const FcChar8 *file,
+			     FcBool (*callback) (FcConfig *config, const FcChar8 *data, size_t size, void *closure),
+			     void *closure)
+{
+    struct stat	file_stat;
+    FcChar8	*data = NULL;
+    FcBool	ret = FcFalse, mapped = FcFalse;
+    int		fd;
+
+    fd = FcDirCacheOpenFile (file, &file_stat);
+    if (fd < 0)
+	return FcFalse;
+    if (file_stat.st_size <= 0 || file_stat.st_size > INTPTR_MAX)
+	goto bail;
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+    if (FcCacheIsMmapSafe (fd))
+    {
+	data = mmap (0, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	    data = NULL;
+	else
+	    mapped = FcTrue;
+    }
+#endif
+    if (!data)
+    {
+	data = malloc (file_stat.st_size);
+	if (!data)
+	    goto bail;
+	if (read (fd, data, file_stat.st_size) != file_stat.st_size)
+	{
+	    free (data);
+	    goto bail;
+	}
+    }
+    ret = (*callback) (config, data, file_stat.st_size, closure);
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+    if (mapped)
+	munmap (data, file_stat.st_size);
+    else
+#endif
+	free (data);
+bail:
+    close (fd);
+
+    return ret;
+}
+
+/*
+ * Hand the contents of each compiled configuration for key to callback
+ * until it accepts one.
+ */
+FcBool
+FcCompiledConfigProcess (FcConfig *config, const FcChar8 *key,
+			 FcBool (*callback) (FcConfig *config, const FcChar8 *data, size_t size, void *closure),
+			 void *closure)
+{
+    FcChar8	config_base[CONFIGBASE_LEN];
+    FcChar8	*dir, *file;
+    FcStrSet	*dirs;
+    FcStrList	*list;
+    FcBool	ret = FcFalse;
+
+    FcCompiledConfigBasename (key, config_base);
+    dirs = FcCompiledConfigDirs (config);
+    if (!dirs)
+	return FcFalse;
+    list = FcStrListCreate (dirs);
+    FcStrSetDestroy (dirs);
+    if (!list)
+	return FcFalse;
+    while (!ret && (dir = FcStrListNext (list)))
+    {
+	file = FcStrBuildFilename (dir, config_base, NULL);
+	if (!file)
+	    break;
+	ret = FcCompiledConfigProcessFile (config, file, callback, closure);
+	if (FcDebug () & FC_DBG_CACHE)
+	    printf ("FcCompiledConfigProcess file \"%s\": %s\n", file, ret ? "used" : "not usable");
+	FcStrFree (file);
+    }
+    FcStrListDone (list);
+
+    return ret;
+}
+
+/*
+ * Write data out as the compiled configuration for key, to the user's
+ * cache directory.  With system set, as for fc-cache, the system cache
+ * directory is preferred when it is writable.
+ */
+FcBool
+FcCompiledConfigWrite (FcConfig *config, const FcChar8 *key, const FcChar8 *data, int size, FcBool system)
+{
+    FcChar8	config_base[CONFIGBASE_LEN];
+    FcChar8	*dir, *file = NULL;
+    FcStrSet	*dirs;
+    FcAtomic	*atomic;
+    FcBool	ret = FcFalse;
+    int		fd, i;
+
+    FcCompiledConfigBasename (key, config_base);
+    dirs = FcCompiledConfigDirs (config);
+    if (!dirs)
+	return FcFalse;
+    for (i = system ? 0 : 1; i < dirs->num; i++)
+    {
+	dir = dirs->strs[i];
+	if (access ((char *) dir, W_OK) == 0)
+	    break;
+	/* Only the user's cache directory is created here */
+	if (i > 0 && access ((char *) dir, F_OK) == -1 && FcMakeDirectory (dir))
+	{
+	    FcDirCacheCreateTagFile (dir);
+	    break;
+	}
+    }
+    if (i < dirs->num)
+	file = FcStrBuildFilename (dirs->strs[i], config_base, NULL);
+    FcStrSetDestroy (dirs);
+    if (!file)
+	return FcFalse;
+
+    if (FcDebug () & FC_DBG_CACHE)
+	printf ("FcCompiledConfigWrite file \"%s\"\n", file);
+
+    atomic = FcAtomicCreate (file);
+    if (!atomic)
+	goto bail;
+    if (!FcAtomicLock (atomic))
+	goto bail1;
+    fd = FcOpen ((char *) FcAtomicNewFile (atomic), O_RDWR | O_CREAT | O_BINARY, 0666);
+    if (fd == -1)
+	goto bail2;
+    if (write (fd, data, size) != size)
+    {
+	perror ("write compiled config");
+	close (fd);
+	goto bail2;
+    }
+    close (fd);
+    ret = FcAtomicReplaceOrig (atomic);
+bail2:
+    FcAtomicUnlock (atomic);
+bail1:
+    FcAtomicDestroy (atomic);
+bail:
+    FcStrFree (file);
+
+    return ret;
+}
+
 FcBool
 FcDirCacheClean (const FcChar8 *cache_dir, FcBool verbose)
 {
@@ -1565,12 +2306,19 @@ FcDirCacheClean (const FcChar8 *cache_dir, FcBool verbose)
     {
 	FcChar8	*file_name;
 	const FcChar8	*target_dir;
+	FcBool	is_db = FcFalse, is_config = FcFalse;
 
 	if (ent->d_name[0] == '.')
 	    continue;
 	/* skip cache files for different architectures and */
 	/* files which are not cache files at all */
-	if (strlen(ent->d_name) != 32 + strlen ("-" FC_ARCHITECTURE FC_CACHE_SUFFIX) ||
+	if (strlen(ent->d_name) == 32 + strlen ("-" FC_ARCHITECTURE FC_FONT_DATABASE_SUFFIX) &&
+	    !strcmp(ent->d_name + 32, "-" FC_ARCHITECTURE FC_FONT_DATABASE_SUFFIX))
+	    is_db = FcTrue;
+	else if (strlen(ent->d_name) == 32 + strlen ("-" FC_ARCHITECTURE FC_COMPILED_CONFIG_SUFFIX) &&
+		 !strcmp(ent->d_name + 32, "-" FC_ARCHITECTURE FC_COMPILED_CONFIG_SUFFIX))
+	    is_config = FcTrue;
+	else if (strlen(ent->d_name) != 32 + strlen ("-" FC_ARCHITECTURE FC_CACHE_SUFFIX) ||
 	    strcmp(ent->d_name + 32, "-" FC_ARCHITECTURE FC_CACHE_SUFFIX))
 	    continue;
 
@@ -1582,8 +2330,30 @@ FcDirCacheClean (const FcChar8 *cache_dir, FcBool verbose)
 	    break;
 	}
 	remove = FcFalse;
-	cache = FcDirCacheLoadFile (file_name, NULL);
-	if (!cache)
+	if (is_config)
+	{
+	    /* So are compiled configurations */
+	    if (!FcCompiledConfigProcessFile (config, file_name, FcConfigCompiledCurrent, NULL))
+	    {
+		if (verbose || FcDebug () & FC_DBG_CACHE)
+		    printf ("%s: stale compiled configuration: %s\n", dir, ent->d_name);
+		remove = FcTrue;
+	    }
+	}
+	else if (is_db)
+	{
+	    /* Font databases are only kept while they are up to date */
+	    cache = FcFontDatabaseMapFile (config, file_name);
+	    if (cache)
+		FcDirCacheUnload (cache);
+	    else
+	    {
+		if (verbose || FcDebug () & FC_DBG_CACHE)
+		    printf ("%s: stale font database: %s\n", dir, ent->d_name);
+		remove = FcTrue;
+	    }
+	}
+	else if (!(cache = FcDirCacheLoadFile (file_name, NULL)))
 	{
 	    if (verbose || FcDebug () & FC_DBG_CACHE)
 		printf ("%s: invalid cache file: %s\n", dir, ent->d_name);
@@ -29,6 +29,9 @@
 #include <dirent.h>
 #endif
 #include <sys/types.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #if defined (_WIN32) && !defined (R_OK)
 #define R_OK 4
@@ -162,6 +165,8 @@ FcConfigCreate (void)
     config->rejectGlobs = FcStrSetCreate ();
     if (!config->rejectGlobs)
 	goto bail5;
+    config->acceptGlobMatcher = NULL;
+    config->rejectGlobMatcher = NULL;
 
     config->acceptPatterns = FcFontSetCreate ();
     if (!config->acceptPatterns)
@@ -170,6 +175,8 @@ FcConfigCreate (void)
     config->rejectPatterns = FcFontSetCreate ();
     if (!config->rejectPatterns)
 	goto bail7;
+    config->acceptPatternIndex = NULL;
+    config->rejectPatternIndex = NULL;
 
     config->cacheDirs = FcStrSetCreate ();
     if (!config->cacheDirs)
@@ -187,6 +194,18 @@ FcConfigCreate (void)
     config->maxObjects = 0;
     for (set = FcSetSystem; set <= FcSetApplication; set++)
 	config->fonts[set] = 0;
+    config->familyIndex = NULL;
+    config->matchCache = NULL;
+    config->scoreTable = NULL;
+    config->coverageIndex = NULL;
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	config->substProgram[k] = NULL;
+    config->fontDatabaseKey = NULL;
+    config->fontSources = NULL;
+    config->watchFd = -1;
+    config->watchDirty = FcFalse;
+    config->watches = NULL;
+    config->nwatches = 0;
 
     config->rescanTime = time(0);
     config->rescanInterval = 30;
@@ -201,11 +220,17 @@ FcConfigCreate (void)
     config->availConfigFiles = FcStrSetCreate ();
     if (!config->availConfigFiles)
 	goto bail10;
+    config->missingConfigFiles = FcStrSetCreate ();
+    if (!config->missingConfigFiles)
+	goto bail11;
+    config->uncompilable = FcFalse;
 
     FcRefInit (&config->ref, 1);
 
     return config;
 
+bail11:
+    FcStrSetDestroy (config->availConfigFiles);
 bail10:
     FcPtrListDestroy (config->rulesetList);
 bail9:
@@ -255,6 +280,225 @@ FcConfigNewestFile (FcStrSet *files)
     return newest;
 }
 
+/*
+ * A watch on a file or directory itself, or on the nearest parent of
+ * one that doesn't exist yet, waiting for name to show up there.
+ */
+struct _FcWatch {
+    int	    wd;
+    FcChar8 *name;
+};
+
+static void
+FcConfigUnwatch (FcConfig *config)
+{
+    int	i;
+
+    if (config->watchFd >= 0)
+	close (config->watchFd);
+    config->watchFd = -1;
+    for (i = 0; i < config->nwatches; i++)
+	if (config->watches[i].name)
+	    FcStrFree (config->watches[i].name);
+    free (config->watches);
+    config->watches = NULL;
+    config->nwatches = 0;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/* What changes the mtime FcConfigNewestFile would look at */
+#define FC_WATCH_FILE_EVENTS	(IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define FC_WATCH_DIR_EVENTS	(IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+				 IN_MOVED_TO | IN_MOVE_SELF | IN_DELETE_SELF)
+/* What makes a missing file appear */
+#define FC_WATCH_PARENT_EVENTS	(IN_CREATE | IN_MOVED_TO)
+
+static FcBool
+FcConfigWatchAdd (FcConfig *config, int wd, const FcChar8 *name)
+{
+    FcWatch *w;
+
+    w = realloc (config->watches, (config->nwatches + 1) * sizeof (FcWatch));
+    if (!w)
+	return FcFalse;
+    config->watches = w;
+    w[config->nwatches].wd = wd;
+    w[config->nwatches].name = NULL;
+    if (name && !(w[config->nwatches].name = FcStrdup (name)))
+	return FcFalse;
+    config->nwatches++;
+
+    return FcTrue;
+}
+
+/*
+ * Watch the nearest existing parent of file for the entry leading to
+ * it, since polling notices the file once it turns up.
+ */
+static FcBool
+FcConfigWatchParent (FcConfig *config, int fd, const FcChar8 *file)
+{
+    FcChar8 *path = FcStrCopy (file), *parent, *name;
+    FcBool  ret = FcFalse;
+    int	    wd;
+
+    while (path)
+    {
+	parent = FcStrDirname (path);
+	if (!parent || !strcmp ((const char *) parent, (const char *) path))
+	{
+	    if (parent)
+		FcStrFree (parent);
+	    break;
+	}
+	wd = inotify_add_watch (fd, (const char *) parent, FC_WATCH_PARENT_EVENTS | IN_MASK_ADD);
+	if (wd >= 0)
+	{
+	    name = FcStrBasename (path);
+	    ret = name && FcConfigWatchAdd (config, wd, name);
+	    if (name)
+		FcStrFree (name);
+	    FcStrFree (parent);
+	    break;
+	}
+	if (errno != ENOENT)
+	{
+	    FcStrFree (parent);
+	    break;
+	}
+	FcStrFree (path);
+	path = parent;
+    }
+    if (path)
+	FcStrFree (path);
+
+    return ret;
+}
+
+static FcBool
+FcConfigWatchSet (FcConfig *config, int fd, FcStrSet *set, uint32_t events)
+{
+    int	i, wd;
+
+    for (i = 0; i < set->num; i++)
+    {
+	/* The same directory may be watched for a missing entry already */
+	wd = inotify_add_watch (fd, (const char *) set->strs[i], events | IN_MASK_ADD);
+	if (wd >= 0)
+	{
+	    if (!FcConfigWatchAdd (config, wd, NULL))
+		return FcFalse;
+	}
+	else if (errno != ENOENT || !FcConfigWatchParent (config, fd, set->strs[i]))
+	    return FcFalse;
+    }
+
+    return FcTrue;
+}
+
+/*
+ * With FC_WATCH set, ask the kernel to tell about changes to the
+ * configuration files and the directories instead of checking their
+ * times in FcConfigUptoDate.  Without it, or if some can't be watched,
+ * FcConfigUptoDate goes on polling.
+ */
+static void
+FcConfigWatch (FcConfig *config)
+{
+    const char	*env = getenv ("FC_WATCH");
+    int		fd;
+    FcFileTime	config_time, config_dir_time, font_time;
+
+    FcConfigUnwatch (config);
+    if (!env || !env[0] || !strcmp (env, "0"))
+	return;
+
+    fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+	return;
+    if (!FcConfigWatchSet (config, fd, config->configFiles, FC_WATCH_FILE_EVENTS) ||
+	!FcConfigWatchSet (config, fd, config->configDirs, FC_WATCH_DIR_EVENTS) ||
+	!FcConfigWatchSet (config, fd, config->fontDirs, FC_WATCH_DIR_EVENTS))
+    {
+	if (FcDebug () & FC_DBG_CACHE)
+	    printf ("FcConfigWatch: polling instead, %s\n", strerror (errno));
+	close (fd);
+	FcConfigUnwatch (config);
+	return;
+    }
+    config->watchFd = fd;
+
+    /*
+     * The watches only see what happens from now on.  What changed
+     * while the fonts were being scanned shows in the times, which
+     * polling would have compared too.
+     */
+    config_time = FcConfigNewestFile (config->configFiles);
+    config_dir_time = FcConfigNewestFile (config->configDirs);
+    font_time = FcConfigNewestFile (config->fontDirs);
+    config->watchDirty =
+	(config_time.set && config_time.time - config->rescanTime > 0) ||
+	(config_dir_time.set && config_dir_time.time - config->rescanTime > 0) ||
+	(font_time.set && font_time.time - config->rescanTime > 0);
+}
+
+/*
+ * Whether ev is about something FcConfigUptoDate would notice.  Of a
+ * parent watched for missing entries, only those entries count.
+ */
+static FcBool
+FcConfigWatchEvent (FcConfig *config, const struct inotify_event *ev)
+{
+    int	    i;
+    FcBool  found = FcFalse;
+
+    for (i = 0; i < config->nwatches; i++)
+    {
+	if (config->watches[i].wd != ev->wd)
+	    continue;
+	if (!config->watches[i].name ||
+	    (ev->len && !strcmp ((const char *) config->watches[i].name, ev->name)))
+	    return FcTrue;
+	found = FcTrue;
+    }
+
+    /* Overflows and watches going away count too */
+    return !found || (ev->mask & IN_IGNORED);
+}
+
+static FcBool
+FcConfigWatchChanged (FcConfig *config)
+{
+    union {
+	struct inotify_event ev;
+	char		     buf[sizeof (struct inotify_event) + FC_PATH_MAX + 1];
+    } u;
+    const struct inotify_event *ev;
+    ssize_t len, i;
+
+    while ((len = read (config->watchFd, u.buf, sizeof (u.buf))) > 0)
+    {
+	for (i = 0; i < len; i += sizeof (struct inotify_event) + ev->len)
+	{
+	    ev = (const struct inotify_event *) (u.buf + i);
+	    if (FcConfigWatchEvent (config, ev))
+		config->watchDirty = FcTrue;
+	}
+    }
+
+    return config->watchDirty;
+}
+
+#else
+
+static void
+FcConfigWatch (FcConfig *config)
+{
+}
+
+#endif
+
 FcBool
 FcConfigUptoDate (FcConfig *config)
 {
@@ -266,6 +510,16 @@ FcConfigUptoDate (FcConfig *config)
     if (!config)
 	return FcFalse;
 
+#ifdef HAVE_SYS_INOTIFY_H
+    if (config->watchFd >= 0)
+    {
+	if (FcConfigWatchChanged (config))
+	    ret = FcFalse;
+	else
+	    config->rescanTime = now;
+	goto bail;
+    }
+#endif
     config_time = FcConfigNewestFile (config->configFiles);
     config_dir_time = FcConfigNewestFile (config->configDirs);
     font_time = FcConfigNewestFile (config->fontDirs);
@@ -349,6 +603,35 @@ FcConfigReference (FcConfig *config)
     return config;
 }
 
+/*
+ * The caches the system font set was built from, each with the run of
+ * fonts it contributed, so that a later configuration with the same
+ * font database key can take those over from caches that haven't
+ * changed instead of loading and filtering them again.
+ */
+typedef struct _FcFontSource {
+    FcCache	    *cache;
+    const FcChar8   *dir;	/* in fontDirs */
+    int		    first;	/* in fonts[FcSetSystem] */
+    int		    count;
+} FcFontSource;
+
+struct _FcFontSources {
+    int		    num;
+    int		    size;
+    FcFontSource    *sources;
+};
+
+static void
+FcFontSourcesDestroy (FcFontSources *sources)
+{
+    if (sources)
+    {
+	free (sources->sources);
+	free (sources);
+    }
+}
+
 void
 FcConfigDestroy (FcConfig *config)
 {
@@ -369,13 +652,28 @@ FcConfigDestroy (FcConfig *config)
 	FcStrSetDestroy (config->configFiles);
 	FcStrSetDestroy (config->acceptGlobs);
 	FcStrSetDestroy (config->rejectGlobs);
+	FcGlobMatcherDestroy (config->acceptGlobMatcher);
+	FcGlobMatcherDestroy (config->rejectGlobMatcher);
 	FcFontSetDestroy (config->acceptPatterns);
 	FcFontSetDestroy (config->rejectPatterns);
+	FcSelectorIndexDestroy (config->acceptPatternIndex);
+	FcSelectorIndexDestroy (config->rejectPatternIndex);
 
 	for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
 	    FcPtrListDestroy (config->subst[k]);
 	FcPtrListDestroy (config->rulesetList);
 	FcStrSetDestroy (config->availConfigFiles);
+	FcStrSetDestroy (config->missingConfigFiles);
+	FcFamilyIndexDestroy (config->familyIndex);
+	FcMatchCacheDestroy (config->matchCache);
+	FcScoreTableDestroy (config->scoreTable);
+	FcCoverageIndexDestroy (config->coverageIndex);
+	for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	    FcSubstProgramDestroy (config->substProgram[k]);
+	if (config->fontDatabaseKey)
+	    FcStrFree (config->fontDatabaseKey);
+	FcFontSourcesDestroy (config->fontSources);
+	FcConfigUnwatch (config);
 	for (set = FcSetSystem; set <= FcSetApplication; set++)
 	    if (config->fonts[set])
 		FcFontSetDestroy (config->fonts[set]);
@@ -394,21 +692,82 @@ FcConfigDestroy (FcConfig *config)
     }
 }
 
+/*
+ * Drop whatever was derived from the font sets; to be called whenever
+ * fonts are added to or removed from the configuration.
+ */
+static void
+FcConfigFontsChanged (FcConfig *config)
+{
+    FcFamilyIndexDestroy (config->familyIndex);
+    config->familyIndex = NULL;
+    FcScoreTableDestroy (config->scoreTable);
+    config->scoreTable = NULL;
+    FcCoverageIndexDestroy (config->coverageIndex);
+    config->coverageIndex = NULL;
+    FcMatchCacheFlush (config->matchCache);
+}
+
+/*
+ * Likewise for the substitution rules.
+ */
+void
+FcConfigRulesChanged (FcConfig *config)
+{
+    FcMatchKind k;
+
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+    {
+	FcSubstProgramDestroy (config->substProgram[k]);
+	config->substProgram[k] = NULL;
+    }
+    FcMatchCacheFlush (config->matchCache);
+}
+
+static void
+FcConfigAddCacheDirs (FcConfig *config, FcCache *cache,
+		      FcStrSet *dirSet, const FcChar8 *forDir)
+{
+    FcBool  relocated = strcmp ((char *) FcCacheDir (cache), (char *) forDir) != 0;
+    int	    i;
+
+    if (!FcCacheDirs (cache))
+	return;
+    for (i = 0; i < cache->dirs_count; i++)
+    {
+	const FcChar8 *dir = FcCacheSubdir (cache, i);
+	FcChar8 *s = NULL;
+
+	if (relocated)
+	{
+	    FcChar8 *base = FcStrBasename (dir);
+	    dir = s = FcStrBuildFilename (forDir, base, NULL);
+	    FcStrFree (base);
+	}
+	if (FcConfigAcceptFilename (config, dir))
+	    FcStrSetAddFilename (dirSet, dir);
+	if (s)
+	    FcStrFree (s);
+    }
+}
+
 /*
  * Add cache to configuration, adding fonts and directories
  */
 
 FcBool
 FcConfigAddCache (FcConfig *config, FcCache *cache,
-		  FcSetName set, FcStrSet *dirSet, FcChar8 *forDir)
+		  FcFontSet *fonts, FcStrSet *dirSet, FcChar8 *forDir)
 {
     FcFontSet	*fs;
-    intptr_t	*dirs;
     int		i;
     FcBool      relocated = FcFalse;
+    FcBool	filter;
 
     if (strcmp ((char *)FcCacheDir(cache), (char *)forDir) != 0)
       relocated = FcTrue;
+    /* Accept rules only ever override reject rules */
+    filter = config->rejectGlobs->num > 0 || config->rejectPatterns->nfont > 0;
 
     /*
      * Add fonts
@@ -424,6 +783,14 @@ FcConfigAddCache (FcConfig *config, FcCache *cache,
 	    FcChar8	*font_file;
 	    FcChar8	*relocated_font_file = NULL;
 
+	    /* Leave the pattern alone; it may not even be paged in yet */
+	    if (!relocated && !filter)
+	    {
+		if (FcFontSetAdd (fonts, font))
+		    nref++;
+		continue;
+	    }
+
 	    if (FcPatternObjectGetString (font, FC_FILE_OBJECT,
 					  0, &font_file) == FcResultMatch)
 	    {
@@ -459,110 +826,409 @@ FcConfigAddCache (FcConfig *config, FcCache *cache,
 	      free (relocated_font_file);
 	    }
 
-	    if (FcFontSetAdd (config->fonts[set], font))
+	    if (FcFontSetAdd (fonts, font))
 		nref++;
 	}
 	FcDirCacheReference (cache, nref);
     }
 
-    /*
-     * Add directories
-     */
-    dirs = FcCacheDirs (cache);
-    if (dirs)
+    FcConfigAddCacheDirs (config, cache, dirSet, forDir);
+
+    return FcTrue;
+}
+
+static FcBool
+FcFontSourcesAdd (FcFontSources *sources, FcCache *cache, const FcChar8 *dir,
+		  int first, int count)
+{
+    FcFontSource *source;
+
+    if (sources->num == sources->size)
     {
-	for (i = 0; i < cache->dirs_count; i++)
-	{
-	    const FcChar8 *dir = FcCacheSubdir (cache, i);
-	    FcChar8 *s = NULL;
+	int size = sources->size ? sources->size * 2 : 64;
 
-	    if (relocated)
-	    {
-		FcChar8 *base = FcStrBasename (dir);
-		dir = s = FcStrBuildFilename (forDir, base, NULL);
-		FcStrFree (base);
-	    }
-	    if (FcConfigAcceptFilename (config, dir))
-		FcStrSetAddFilename (dirSet, dir);
-	    if (s)
-		FcStrFree (s);
-	}
+	source = realloc (sources->sources, size * sizeof (FcFontSource));
+	if (!source)
+	    return FcFalse;
+	sources->sources = source;
+	sources->size = size;
     }
+    source = &sources->sources[sources->num++];
+    source->cache = cache;
+    source->dir = dir;
+    source->first = first;
+    source->count = count;
+
     return FcTrue;
 }
 
+static int
+FcFontSourceCompare (const void *a, const void *b)
+{
+    return strcmp ((const char *) ((const FcFontSource *) a)->dir,
+		   (const char *) ((const FcFontSource *) b)->dir);
+}
+
+/*
+ * The sources of from sorted by directory, if config may take fonts
+ * over from it.
+ */
+static FcFontSource *
+FcConfigReusableSources (FcConfig *config, FcConfig *from, int *n)
+{
+    FcFontSource *sorted;
+
+    if (!from || from == config || !from->fontSources || !from->fonts[FcSetSystem] ||
+	!from->fontDatabaseKey || !config->fontDatabaseKey ||
+	strcmp ((const char *) from->fontDatabaseKey, (const char *) config->fontDatabaseKey) != 0)
+	return NULL;
+    *n = from->fontSources->num;
+    if (*n == 0 || !(sorted = malloc (*n * sizeof (FcFontSource))))
+	return NULL;
+    memcpy (sorted, from->fontSources->sources, *n * sizeof (FcFontSource));
+    qsort (sorted, *n, sizeof (FcFontSource), FcFontSourceCompare);
+
+    return sorted;
+}
+
+/*
+ * If the cache from took the fonts of dir from is still up to date and
+ * no other cache file has been written for dir since, add those fonts,
+ * which were filtered the same way already, and the subdirectories,
+ * without loading the cache again.  Only caches
+ * that contributed fonts are still around for sure, as from holds on to
+ * those; relocated caches aren't checked against the right directory.
+ */
+static FcCache *
+FcConfigReuseCache (FcConfig *config, FcConfig *from, FcFontSource *sorted, int n,
+		    FcFontSet *fonts, FcStrSet *dirSet, const FcChar8 *dir)
+{
+    FcFontSource    key, *source;
+    FcFontSet	    *fs = from->fonts[FcSetSystem];
+    int		    i;
+
+    key.dir = dir;
+    source = bsearch (&key, sorted, n, sizeof (FcFontSource), FcFontSourceCompare);
+    if (!source || source->count == 0 || source->first + source->count > fs->nfont ||
+	strcmp ((const char *) FcCacheDir (source->cache), (const char *) dir) != 0 ||
+	!FcCacheTimeValid (config, source->cache, NULL) ||
+	!FcDirCacheFileCurrent (config, source->cache))
+	return NULL;
+    for (i = 0; i < source->count; i++)
+    {
+	FcPattern *font = fs->fonts[source->first + i];
+
+	FcPatternReference (font);
+	if (!FcFontSetAdd (fonts, font))
+	    FcPatternDestroy (font);
+    }
+    FcConfigAddCacheDirs (config, source->cache, dirSet, dir);
+    if (FcDebug () & FC_DBG_FONTSET)
+	printf ("took over %d fonts from %s\n", source->count, dir);
+
+    return source->cache;
+}
+
+/*
+ * Add the fonts from each directory in dirSet.  When building the system
+ * fonts, note where they come from, and take them over from the caches
+ * in from that are still current.
+ */
 static FcBool
-FcConfigAddDirList (FcConfig *config, FcSetName set, FcStrSet *dirSet)
+FcConfigAddDirList (FcConfig *config, FcFontSet *fonts, FcStrSet *dirSet, FcConfig *from)
 {
     FcStrList	    *dirlist;
     FcChar8	    *dir;
     FcCache	    *cache;
+    FcFontSources   *sources = NULL;
+    FcFontSource    *sorted = NULL;
+    int		    nsorted = 0, first;
 
     dirlist = FcStrListCreate (dirSet);
     if (!dirlist)
         return FcFalse;
 
+    if (fonts == config->fonts[FcSetSystem])
+    {
+	sources = calloc (1, sizeof (FcFontSources));
+	sorted = FcConfigReusableSources (config, from, &nsorted);
+    }
     while ((dir = FcStrListNext (dirlist)))
     {
 	if (FcDebug () & FC_DBG_FONTSET)
 	    printf ("adding fonts from %s\n", dir);
-	cache = FcDirCacheRead (dir, FcFalse, config);
+	first = fonts->nfont;
+	cache = NULL;
+	if (sorted)
+	    cache = FcConfigReuseCache (config, from, sorted, nsorted, fonts, dirSet, dir);
 	if (!cache)
-	    continue;
-	FcConfigAddCache (config, cache, set, dirSet, dir);
-	FcDirCacheUnload (cache);
+	{
+	    cache = FcDirCacheRead (dir, FcFalse, config);
+	    if (!cache)
+		continue;
+	    FcConfigAddCache (config, cache, fonts, dirSet, dir);
+	    FcDirCacheUnload (cache);
+	}
+	if (sources && !FcFontSourcesAdd (sources, cache, dir, first, fonts->nfont - first))
+	{
+	    FcFontSourcesDestroy (sources);
+	    sources = NULL;
+	}
     }
     FcStrListDone (dirlist);
+    free (sorted);
+    FcConfigFontsChanged (config);
+    if (sources)
+    {
+	FcFontSourcesDestroy (config->fontSources);
+	config->fontSources = sources;
+    }
     return FcTrue;
 }
 
 /*
- * Scan the current list of directories in the configuration
- * and build the set of available fonts.
+ * Describe everything the system font set depends on besides the
+ * contents of the font directories: the configured directories, how
+ * their caches are found and which fonts are accepted.  Configurations
+ * with the same key can share a font database.
  */
-
-FcBool
-FcConfigBuildFonts (FcConfig *config)
+static FcChar8 *
+FcConfigFontDatabaseKey (FcConfig *config)
 {
-    FcFontSet	    *fonts;
-    FcBool	    ret = FcTrue;
-
-    config = FcConfigReference (config);
-    if (!config)
-	return FcFalse;
-
-    fonts = FcFontSetCreate ();
-    if (!fonts)
+    FcStrBuf	    buf;
+    FcStrList	    *list;
+    FcChar8	    *s, *map;
+    const FcChar8   *salt;
+    int		    i;
+
+    FcStrBufInit (&buf, NULL, 0);
+    FcStrBufString (&buf, (const FcChar8 *) "fontdb " FC_CACHE_VERSION);
+    if (config->sysRoot)
     {
-	ret = FcFalse;
-	goto bail;
+	FcStrBufString (&buf, (const FcChar8 *) "\nsysroot ");
+	FcStrBufString (&buf, config->sysRoot);
     }
-
-    FcConfigSetFonts (config, fonts, FcSetSystem);
-
-    if (!FcConfigAddDirList (config, FcSetSystem, config->fontDirs))
-    {
-	ret = FcFalse;
+    list = FcStrListCreate (config->fontDirs);
+    if (!list)
 	goto bail;
+    while ((s = FcStrListNext (list)))
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\ndir ");
+	FcStrBufString (&buf, s);
+	if ((map = FcConfigMapFontPath (config, s)))
+	{
+	    FcStrBufString (&buf, (const FcChar8 *) "\nmap ");
+	    FcStrBufString (&buf, map);
+	    FcStrFree (map);
+	}
+	if ((salt = FcConfigMapSalt (config, s)))
+	{
+	    FcStrBufString (&buf, (const FcChar8 *) "\nsalt ");
+	    FcStrBufString (&buf, salt);
+	}
     }
-    if (FcDebug () & FC_DBG_FONTSET)
-	FcFontSetPrint (fonts);
-bail:
-    FcConfigDestroy (config);
-
-    return ret;
-}
-
-FcBool
-FcConfigSetCurrent (FcConfig *config)
-{
-    FcConfig *cfg;
-
-    if (config)
+    FcStrListDone (list);
+    list = FcStrListCreate (config->cacheDirs);
+    if (!list)
+	goto bail;
+    while ((s = FcStrListNext (list)))
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\ncachedir ");
+	FcStrBufString (&buf, s);
+    }
+    FcStrListDone (list);
+    for (i = 0; i < config->acceptGlobs->num; i++)
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\naccept ");
+	FcStrBufString (&buf, config->acceptGlobs->strs[i]);
+    }
+    for (i = 0; i < config->rejectGlobs->num; i++)
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\nreject ");
+	FcStrBufString (&buf, config->rejectGlobs->strs[i]);
+    }
+    for (i = 0; i < config->acceptPatterns->nfont; i++)
+    {
+	if (!(s = FcNameUnparse (config->acceptPatterns->fonts[i])))
+	    goto bail;
+	FcStrBufString (&buf, (const FcChar8 *) "\naccept-pattern ");
+	FcStrBufString (&buf, s);
+	FcStrFree (s);
+    }
+    for (i = 0; i < config->rejectPatterns->nfont; i++)
+    {
+	if (!(s = FcNameUnparse (config->rejectPatterns->fonts[i])))
+	    goto bail;
+	FcStrBufString (&buf, (const FcChar8 *) "\nreject-pattern ");
+	FcStrBufString (&buf, s);
+	FcStrFree (s);
+    }
+
+    return FcStrBufDone (&buf);
+
+bail:
+    FcStrBufDestroy (&buf);
+
+    return NULL;
+}
+
+/*
+ * Add the fonts and directories from the font database, if there is
+ * an up to date one.
+ */
+static FcBool
+FcConfigAddFontDatabase (FcConfig *config, FcFontSet *fonts)
+{
+    FcCache	*cache;
+    FcFontSet	*fs;
+    int		i, nref = 0;
+
+    if (!config->fontDatabaseKey)
+	return FcFalse;
+    cache = FcFontDatabaseLoad (config, config->fontDatabaseKey);
+    if (!cache)
+	return FcFalse;
+
+    /* Everything in there has been filtered already */
+    fs = FcCacheSet (cache);
+    for (i = 0; i < fs->nfont; i++)
+	if (FcFontSetAdd (fonts, FcFontSetFont (fs, i)))
+	    nref++;
+    FcDirCacheReference (cache, nref);
+    for (i = 0; i < cache->dirs_count; i++)
+	FcStrSetAddFilename (config->fontDirs, FcCacheSubdir (cache, i));
+    FcDirCacheUnload (cache);
+    FcConfigFontsChanged (config);
+
+    return FcTrue;
+}
+
+/*
+ * Scan the current list of directories in the configuration
+ * and build the set of available fonts.
+ */
+
+FcBool
+FcConfigBuildFonts (FcConfig *config)
+{
+    FcFontSet	    *fonts;
+    FcConfig	    *current;
+    FcBool	    ret = FcTrue;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    /* Reloading usually means there's a current configuration to start from */
+    lock_config ();
+    current = fc_atomic_ptr_get (&_fcConfig);
+    if (current)
+	FcRefInc (&current->ref);
+    unlock_config ();
+
+    fonts = FcFontSetCreate ();
+    if (!fonts)
+    {
+	ret = FcFalse;
+	goto bail;
+    }
+
+    FcConfigSetFonts (config, fonts, FcSetSystem);
+
+    /* The key describes the directories as configured, before expansion */
+    if (!config->fontDatabaseKey)
+	config->fontDatabaseKey = FcConfigFontDatabaseKey (config);
+    if (FcConfigAddFontDatabase (config, fonts))
+    {
+	if (FcDebug () & FC_DBG_FONTSET)
+	    printf ("adding fonts from the font database\n");
+    }
+    else if (!FcConfigAddDirList (config, fonts, config->fontDirs, current))
+    {
+	ret = FcFalse;
+	goto bail;
+    }
+    if (FcDebug () & FC_DBG_FONTSET)
+	FcFontSetPrint (fonts);
+    FcConfigWatch (config);
+bail:
+    if (current)
+	FcConfigDestroy (current);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcBool
+FcConfigWriteFontDatabase (FcConfig *config)
+{
+    FcFontSet	*fonts = NULL;
+    FcStrSet	*dirs = NULL, *from;
+    int64_t	checksum;
+    int		i, ndirs, tries;
+    FcBool	ret = FcFalse;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    if (!config->fontDatabaseKey && !config->fonts[FcSetSystem])
+	config->fontDatabaseKey = FcConfigFontDatabaseKey (config);
+    if (!config->fontDatabaseKey)
+	goto bail;
+
+    /*
+     * The checksum is taken before the fonts are read, so that a change
+     * in between makes the database stale rather than wrong.  Reading
+     * may turn up new subdirectories, or write the caches the checksum
+     * covers; start over until neither happens.
+     */
+    from = config->fontDirs;
+    for (tries = 0; tries < 3; tries++)
+    {
+	FcStrSet *next = FcStrSetCreate ();
+
+	if (!next)
+	    goto bail;
+	for (i = 0; i < from->num; i++)
+	    FcStrSetAdd (next, from->strs[i]);
+	if (dirs)
+	    FcStrSetDestroy (dirs);
+	from = dirs = next;
+	ndirs = dirs->num;
+	checksum = FcFontDatabaseChecksum (config, dirs);
+
+	if (fonts)
+	    FcFontSetDestroy (fonts);
+	fonts = FcFontSetCreate ();
+	if (!fonts || !FcConfigAddDirList (config, fonts, dirs, NULL))
+	    goto bail;
+	if (dirs->num == ndirs && FcFontDatabaseChecksum (config, dirs) == checksum)
+	{
+	    ret = FcFontDatabaseWrite (config, config->fontDatabaseKey, fonts, dirs, checksum);
+	    break;
+	}
+    }
+
+bail:
+    if (fonts)
+	FcFontSetDestroy (fonts);
+    if (dirs)
+	FcStrSetDestroy (dirs);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcBool
+FcConfigSetCurrent (FcConfig *config)
+{
+    FcConfig *cfg;
+
+    if (config)
     {
 	if (!config->fonts[FcSetSystem])
 	    if (!FcConfigBuildFonts (config))
 		return FcFalse;
+	FcMatchCacheFlush (config->matchCache);
 	FcRefInc (&config->ref);
     }
 
@@ -587,6 +1253,25 @@ retry:
     return FcTrue;
 }
 
+/*
+ * Make config current in place of old, unless something else has been
+ * made current since old was.  Those still using old keep it, and the
+ * caches it refers to, until they release it.
+ */
+FcBool
+FcConfigReplaceCurrent (FcConfig *old, FcConfig *config)
+{
+    FcBool  ret;
+
+    FcRefInc (&config->ref);
+    lock_config ();
+    ret = fc_atomic_ptr_cmpexch (&_fcConfig, old, config);
+    unlock_config ();
+    FcConfigDestroy (ret ? old : config);
+
+    return ret;
+}
+
 FcConfig *
 FcConfigGetCurrent (void)
 {
@@ -806,6 +1491,12 @@ FcConfigSetFonts (FcConfig	*config,
 		  FcFontSet	*fonts,
 		  FcSetName	set)
 {
+    FcConfigFontsChanged (config);
+    if (set == FcSetSystem)
+    {
+	FcFontSourcesDestroy (config->fontSources);
+	config->fontSources = NULL;
+    }
     if (config->fonts[set])
 	FcFontSetDestroy (config->fonts[set]);
     config->fonts[set] = fonts;
@@ -1209,7 +1900,7 @@ FcConfigCompareValue (const FcValue	*left_o,
 #define FcDoubleRound(d)	FcDoubleFloor ((d) + 0.5)
 #define FcDoubleTrunc(d)	((d) >= 0 ? _FcDoubleFloor (d) : -_FcDoubleFloor (-(d)))
 
-static FcValue
+FcValue
 FcConfigEvaluate (FcPattern *p, FcPattern *p_pat, FcMatchKind kind, FcExpr *e)
 {
     FcValue	v, vl, vr, vle, vre;
@@ -1553,23 +2244,610 @@ FcConfigEvaluate (FcPattern *p, FcPattern *p_pat, FcMatchKind kind, FcExpr *e)
     return v;
 }
 
+/*
+ * Tests only compare the value of their expression, so literals and
+ * pattern elements can be handed to them as they are instead of being
+ * copied by FcConfigEvaluate.  *own tells whether the value has to be
+ * destroyed afterwards.
+ */
+static FcValue
+FcConfigEvaluateShared (FcPattern *p, FcPattern *p_pat, FcMatchKind kind, FcExpr *e, FcBool *own)
+{
+    FcValue v;
+
+    *own = FcFalse;
+    switch ((int) FC_OP_GET_OP (e->op)) {
+    case FcOpInteger:
+	v.type = FcTypeInteger;
+	v.u.i = e->u.ival;
+	return v;
+    case FcOpDouble:
+	v.type = FcTypeDouble;
+	v.u.d = e->u.dval;
+	return v;
+    case FcOpBool:
+	v.type = FcTypeBool;
+	v.u.b = e->u.bval;
+	return v;
+    case FcOpString:
+	v.type = FcTypeString;
+	v.u.s = e->u.sval;
+	return v;
+    case FcOpCharSet:
+	v.type = FcTypeCharSet;
+	v.u.c = e->u.cval;
+	return v;
+    case FcOpLangSet:
+	v.type = FcTypeLangSet;
+	v.u.l = e->u.lval;
+	return v;
+    case FcOpRange:
+	v.type = FcTypeRange;
+	v.u.r = e->u.rval;
+	return v;
+    case FcOpField:
+	if (kind == FcMatchPattern && e->u.name.kind == FcMatchFont)
+	    break;
+	if (kind == FcMatchFont && e->u.name.kind == FcMatchPattern)
+	    p = p_pat;
+	if (FcResultMatch != FcPatternObjectGet (p, e->u.name.object, 0, &v))
+	    v.type = FcTypeVoid;
+	return v;
+    }
+    *own = FcTrue;
+
+    return FcConfigEvaluate (p, p_pat, kind, e);
+}
+
+/*
+ * The rules for one kind of substitution, in the order they are run,
+ * along with what their first test needs to find in the pattern to
+ * have any chance of matching.  Most rules are aliases testing for a
+ * single family name, and most tests can't match when their object is
+ * missing altogether, so for a given pattern only a few rules need to
+ * be looked at.  Rules that might match are marked in a bitmap while
+ * substituting; whenever an edit adds a family or an object, the rules
+ * waiting for it get marked as well.
+ */
+typedef struct _FcSubstRule {
+    FcRule	*rule;
+    FcRuleSet	*rs;		/* for debugging output */
+    FcBool	first_in_set;
+    FcBool	pattern_test;	/* the first test looks at the query pattern */
+} FcSubstRule;
+
+typedef struct _FcSubstRuleList {
+    int		nrule;
+    int		size;
+    int		*rules;
+} FcSubstRuleList;
+
+struct _FcSubstProgram {
+    int		    nrule;
+    FcSubstRule	    *rules;
+    int		    nmark;	    /* words in a bitmap of rules */
+    FcChar32	    *always;	    /* rules that have to be run regardless */
+    int		    nobject;
+    int		    *object_start;  /* rules testing for objects in the pattern */
+    int		    *object_rules;
+    int		    npattern;	    /* rules testing for objects in the query */
+    int		    *pattern_rules;
+    FcHashTable	    *family_hash;   /* rules testing for a family name */
+    FcHashTable	    *family_blank_hash;
+};
+
+static void
+FcSubstRuleListDestroy (void *data)
+{
+    FcSubstRuleList *list = data;
+
+    free (list->rules);
+    free (list);
+}
+
+static FcBool
+FcSubstRuleListAdd (FcHashTable *hash, const FcChar8 *family, int rule)
+{
+    FcSubstRuleList *list;
+
+    if (!FcHashTableFind (hash, family, (void **) &list))
+    {
+	list = calloc (1, sizeof (FcSubstRuleList));
+	if (!list)
+	    return FcFalse;
+	if (!FcHashTableAdd (hash, (void *) family, list))
+	{
+	    free (list);
+	    return FcFalse;
+	}
+    }
+    if (list->nrule == list->size)
+    {
+	int size = list->size ? list->size * 2 : 4;
+	int *rules = realloc (list->rules, size * sizeof (int));
+
+	if (!rules)
+	    return FcFalse;
+	list->rules = rules;
+	list->size = size;
+    }
+    list->rules[list->nrule++] = rule;
+
+    return FcTrue;
+}
+
+void
+FcSubstProgramDestroy (FcSubstProgram *program)
+{
+    if (!program)
+	return;
+    if (program->family_hash)
+	FcHashTableDestroy (program->family_hash);
+    if (program->family_blank_hash)
+	FcHashTableDestroy (program->family_blank_hash);
+    free (program->pattern_rules);
+    free (program->object_rules);
+    free (program->object_start);
+    free (program->always);
+    free (program->rules);
+    free (program);
+}
+
+static FcSubstProgram *
+FcSubstProgramCreate (FcConfig *config, FcMatchKind kind)
+{
+    FcSubstProgram  *program;
+    FcPtrList	    *s = config->subst[kind];
+    FcPtrListIter   iter, iter2;
+    FcRuleSet	    *rs;
+    FcRule	    *r;
+    FcTest	    *t;
+    FcHashTable	    *hash;
+    int		    i, n, object;
+
+    program = calloc (1, sizeof (FcSubstProgram));
+    if (!program)
+	return NULL;
+
+    n = 0;
+    FcPtrListIterInit (s, &iter);
+    for (; FcPtrListIterIsValid (s, &iter); FcPtrListIterNext (s, &iter))
+    {
+	rs = (FcRuleSet *) FcPtrListIterGetValue (s, &iter);
+	FcPtrListIterInit (rs->subst[kind], &iter2);
+	for (; FcPtrListIterIsValid (rs->subst[kind], &iter2); FcPtrListIterNext (rs->subst[kind], &iter2))
+	    n++;
+    }
+
+    program->nrule = n;
+    program->nmark = (n + 31) >> 5;
+    program->nobject = FC_MAX_BASE_OBJECT + config->maxObjects + 2;
+    program->rules = malloc ((n + 1) * sizeof (FcSubstRule));
+    program->always = calloc (program->nmark + 1, sizeof (FcChar32));
+    program->object_start = calloc (program->nobject + 1, sizeof (int));
+    program->object_rules = malloc ((n + 1) * sizeof (int));
+    program->pattern_rules = malloc ((n + 1) * sizeof (int));
+    program->family_hash = FcHashTableCreate ((FcHashFunc) FcStrHashIgnoreCase,
+					      (FcCompareFunc) FcStrCmpIgnoreCase,
+					      FcHashStrCopy,
+					      NULL,
+					      free,
+					      FcSubstRuleListDestroy);
+    program->family_blank_hash = FcHashTableCreate ((FcHashFunc) FcStrHashIgnoreBlanksAndCase,
+						    (FcCompareFunc) FcStrCmpIgnoreBlanksAndCase,
+						    FcHashStrCopy,
+						    NULL,
+						    free,
+						    FcSubstRuleListDestroy);
+    if (!program->rules || !program->always || !program->object_start ||
+	!program->object_rules || !program->pattern_rules ||
+	!program->family_hash || !program->family_blank_hash)
+	goto bail;
+
+    i = 0;
+    FcPtrListIterInit (s, &iter);
+    for (; FcPtrListIterIsValid (s, &iter); FcPtrListIterNext (s, &iter))
+    {
+	FcBool first = FcTrue;
+
+	rs = (FcRuleSet *) FcPtrListIterGetValue (s, &iter);
+	FcPtrListIterInit (rs->subst[kind], &iter2);
+	for (; FcPtrListIterIsValid (rs->subst[kind], &iter2); FcPtrListIterNext (rs->subst[kind], &iter2))
+	{
+	    program->rules[i].rule = (FcRule *) FcPtrListIterGetValue (rs->subst[kind], &iter2);
+	    program->rules[i].rs = rs;
+	    program->rules[i].first_in_set = first;
+	    program->rules[i].pattern_test = FcFalse;
+	    first = FcFalse;
+	    i++;
+	}
+    }
+
+    /*
+     * A missing object fails any test but one for all values, and a
+     * family name comparison only matches names in the family table.
+     */
+    for (i = 0; i < n; i++)
+    {
+	r = program->rules[i].rule;
+	if (r->type != FcRuleTest || r->u.test->qual == FcQualAll)
+	{
+	    program->always[i >> 5] |= 1U << (i & 31);
+	    continue;
+	}
+	t = r->u.test;
+	object = FC_OBJ_ID (t->object);
+	if (kind == FcMatchFont && t->kind == FcMatchPattern)
+	{
+	    program->rules[i].pattern_test = FcTrue;
+	    program->pattern_rules[program->npattern++] = i;
+	}
+	else if (t->object == FC_FAMILY_OBJECT && t->expr &&
+		 FC_OP_GET_OP (t->expr->op) == FcOpString &&
+		 (FC_OP_GET_OP (t->op) == FcOpEqual || FC_OP_GET_OP (t->op) == FcOpListing))
+	{
+	    if (FC_OP_GET_FLAGS (t->op) & FcOpFlagIgnoreBlanks)
+		hash = program->family_blank_hash;
+	    else
+		hash = program->family_hash;
+	    if (!FcSubstRuleListAdd (hash, t->expr->u.sval, i))
+		goto bail;
+	}
+	else if (object < program->nobject)
+	    program->object_start[object + 1]++;
+	else
+	    program->always[i >> 5] |= 1U << (i & 31);
+    }
+    for (object = 0; object < program->nobject; object++)
+	program->object_start[object + 1] += program->object_start[object];
+    for (i = 0; i < n; i++)
+    {
+	r = program->rules[i].rule;
+	if (r->type != FcRuleTest || r->u.test->qual == FcQualAll ||
+	    program->rules[i].pattern_test)
+	    continue;
+	t = r->u.test;
+	object = FC_OBJ_ID (t->object);
+	if (t->object == FC_FAMILY_OBJECT && t->expr &&
+	    FC_OP_GET_OP (t->expr->op) == FcOpString &&
+	    (FC_OP_GET_OP (t->op) == FcOpEqual || FC_OP_GET_OP (t->op) == FcOpListing))
+	    continue;
+	if (object < program->nobject)
+	    program->object_rules[program->object_start[object]++] = i;
+    }
+    /* Filling in moved each start to the next one */
+    for (object = program->nobject; object > 0; object--)
+	program->object_start[object] = program->object_start[object - 1];
+    program->object_start[0] = 0;
+
+    return program;
+
+bail:
+    FcSubstProgramDestroy (program);
+
+    return NULL;
+}
+
+static FcSubstProgram *
+FcConfigSubstProgram (FcConfig *config, FcMatchKind kind)
+{
+    FcSubstProgram *program;
+
+retry:
+    program = fc_atomic_ptr_get (&config->substProgram[kind]);
+    if (!program)
+    {
+	program = FcSubstProgramCreate (config, kind);
+	if (!program)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->substProgram[kind], NULL, program))
+	{
+	    FcSubstProgramDestroy (program);
+	    goto retry;
+	}
+    }
+
+    return program;
+}
+
+static void
+FcSubstProgramMarkList (FcHashTable *hash, const FcChar8 *family, FcChar32 *marks)
+{
+    FcSubstRuleList *list;
+    int		    i;
+
+    if (FcHashTableFind (hash, family, (void **) &list))
+	for (i = 0; i < list->nrule; i++)
+	    marks[list->rules[i] >> 5] |= 1U << (list->rules[i] & 31);
+}
+
+static void
+FcSubstProgramMarkObject (const FcSubstProgram *program, FcObject object, FcChar32 *marks)
+{
+    int i;
+
+    object = FC_OBJ_ID (object);
+    if (object >= program->nobject)
+	return;
+    for (i = program->object_start[object]; i < program->object_start[object + 1]; i++)
+	marks[program->object_rules[i] >> 5] |= 1U << (program->object_rules[i] & 31);
+}
+
+/*
+ * Mark the rules that might match before any edits; family names are
+ * marked as they are entered into the family table.
+ */
+static void
+FcSubstProgramStart (const FcSubstProgram	*program,
+		     FcPattern			*p,
+		     FcPattern			*p_pat,
+		     FcChar32			*marks)
+{
+    int i, object;
+
+    if (FcDebug () & FC_DBG_EDIT)
+    {
+	/* Show every rule being tried */
+	memset (marks, 0xff, program->nmark * sizeof (FcChar32));
+	return;
+    }
+    memcpy (marks, program->always, program->nmark * sizeof (FcChar32));
+    for (object = 0; object < program->nobject; object++)
+	if (program->object_start[object] != program->object_start[object + 1] &&
+	    FcPatternObjectFindElt (p, object))
+	    FcSubstProgramMarkObject (program, object, marks);
+    for (i = 0; i < program->npattern; i++)
+    {
+	int rule = program->pattern_rules[i];
+
+	/* Edits would change the query too if it is the same pattern */
+	if (p_pat == p ||
+	    (p_pat && FcPatternObjectFindElt (p_pat, program->rules[rule].rule->u.test->object)))
+	    marks[rule >> 5] |= 1U << (rule & 31);
+    }
+}
+
+static int
+FcSubstProgramNext (const FcSubstProgram *program, const FcChar32 *marks, int rule)
+{
+    int	    w = rule >> 5;
+    FcChar32 bits;
+
+    if (rule >= program->nrule)
+	return program->nrule;
+    bits = marks[w] & (~0U << (rule & 31));
+    while (!bits)
+    {
+	if (++w >= program->nmark)
+	    return program->nrule;
+	bits = marks[w];
+    }
+    rule = w << 5;
+    while (!(bits & 1))
+    {
+	bits >>= 1;
+	rule++;
+    }
+
+    return rule < program->nrule ? rule : program->nrule;
+}
+
+/*
+ * Scratch memory for one substitution.  It is handed out from a
+ * buffer inside the arena itself, which lives on the caller's stack,
+ * and only what doesn't fit there comes from the heap.  Nothing is
+ * freed until the substitution is over.
+ */
+#define FC_SUBST_ARENA_SIZE	16384
+
+typedef union _FcSubstArenaBlock {
+    union _FcSubstArenaBlock	*next;
+    double			align;
+} FcSubstArenaBlock;
+
+typedef struct
+{
+    FcSubstArenaBlock	*blocks;	/* from the heap */
+    char		*next;
+    size_t		left;
+    FcSubstArenaBlock	buf[FC_SUBST_ARENA_SIZE / sizeof (FcSubstArenaBlock)];
+} FcSubstArena;
+
+static void
+FcSubstArenaInit (FcSubstArena *arena)
+{
+    arena->blocks = NULL;
+    arena->next = (char *) arena->buf;
+    arena->left = sizeof (arena->buf);
+}
+
+static void *
+FcSubstArenaAlloc (FcSubstArena *arena, size_t size)
+{
+    FcSubstArenaBlock	*block;
+    size_t		bsize;
+    void		*p;
+
+    size = (size + sizeof (FcSubstArenaBlock) - 1) & ~(sizeof (FcSubstArenaBlock) - 1);
+    if (size > arena->left)
+    {
+	bsize = FC_MAX (size, FC_SUBST_ARENA_SIZE);
+	block = malloc (sizeof (FcSubstArenaBlock) + bsize);
+	if (!block)
+	    return NULL;
+	block->next = arena->blocks;
+	arena->blocks = block;
+	arena->next = (char *) (block + 1);
+	arena->left = bsize;
+    }
+    p = arena->next;
+    arena->next += size;
+    arena->left -= size;
+
+    return p;
+}
+
+static void *
+FcSubstArenaAlloc0 (FcSubstArena *arena, size_t size)
+{
+    void *p = FcSubstArenaAlloc (arena, size);
+
+    if (p)
+	memset (p, 0, size);
+
+    return p;
+}
+
+static void
+FcSubstArenaFini (FcSubstArena *arena)
+{
+    FcSubstArenaBlock *block, *next;
+
+    for (block = arena->blocks; block; block = next)
+    {
+	next = block->next;
+	free (block);
+    }
+}
+
 /* The bulk of the time in FcConfigSubstitute is spent walking
  * lists of family names. We speed this up with a hash table.
  * Since we need to take the ignore-blanks option into account,
- * we use two separate hash tables.
+ * we use two separate hash tables.  They are open-addressed and
+ * kept in the substitution's arena along with copies of the names;
+ * names which are deleted again keep their slot with a zero count.
  */
+#define FC_SUBST_FAMILY_SLOTS	256
+
 typedef struct
 {
+  const FcChar8 *key;
+  FcChar32 hash;
   int count;
 } FamilyTableEntry;
 
+typedef struct
+{
+  FamilyTableEntry *entries;
+  unsigned int mask;
+  unsigned int used;
+  FcChar32 (*hash_func) (const FcChar8 *);
+  int (*cmp_func) (const FcChar8 *, const FcChar8 *);
+  FcHashTable *program_hash;	/* from the FcSubstProgram */
+} FamilyHash;
 
 typedef struct
 {
-  FcHashTable *family_blank_hash;
-  FcHashTable *family_hash;
+  FamilyHash family_blank_hash;
+  FamilyHash family_hash;
+  FcSubstArena *arena;
+  const FcSubstProgram *program;  /* rules to mark as names are added */
+  FcChar32 *marks;
 } FamilyTable;
 
+static FcBool
+FamilyHashInit (FamilyHash	*hash,
+		FcSubstArena	*arena,
+		unsigned int	nslot)
+{
+    hash->entries = FcSubstArenaAlloc0 (arena, nslot * sizeof (FamilyTableEntry));
+    if (!hash->entries)
+	return FcFalse;
+    hash->mask = nslot - 1;
+    hash->used = 0;
+
+    return FcTrue;
+}
+
+/*
+ * Return the entry for s, or the empty slot it would go in.
+ */
+static FamilyTableEntry *
+FamilyHashFind (const FamilyHash *hash,
+		const FcChar8	 *s,
+		FcChar32	 h)
+{
+    FamilyTableEntry *fe;
+    unsigned int i;
+
+    for (i = h & hash->mask; ; i = (i + 1) & hash->mask)
+    {
+	fe = &hash->entries[i];
+	if (!fe->key || (fe->hash == h && !(*hash->cmp_func) (fe->key, s)))
+	    return fe;
+    }
+}
+
+static FcBool
+FamilyHashGrow (FamilyHash *hash, FcSubstArena *arena)
+{
+    FamilyHash old = *hash;
+    FamilyTableEntry *fe;
+    unsigned int i;
+
+    if (!FamilyHashInit (hash, arena, (old.mask + 1) * 2))
+    {
+	*hash = old;
+	return FcFalse;
+    }
+    for (i = 0; i <= old.mask; i++)
+    {
+	if (!old.entries[i].key)
+	    continue;
+	fe = FamilyHashFind (hash, old.entries[i].key, old.entries[i].hash);
+	*fe = old.entries[i];
+	hash->used++;
+    }
+
+    return FcTrue;
+}
+
+static void
+FamilyHashAdd (FamilyTable	*table,
+	       FamilyHash	*hash,
+	       const FcChar8	*s,
+	       const FcChar8	**copy)
+{
+    FcChar32 h = (*hash->hash_func) (s);
+    FamilyTableEntry *fe = FamilyHashFind (hash, s, h);
+    size_t len;
+
+    if (!fe->key)
+    {
+	/* Keep the table at most three quarters full */
+	if ((hash->used + 1) * 4 > (hash->mask + 1) * 3)
+	{
+	    if (!FamilyHashGrow (hash, table->arena))
+		return;
+	    fe = FamilyHashFind (hash, s, h);
+	}
+	/* The value may be gone before the entry is */
+	if (!*copy)
+	{
+	    len = strlen ((const char *) s) + 1;
+	    *copy = FcSubstArenaAlloc (table->arena, len);
+	    if (!*copy)
+		return;
+	    memcpy ((FcChar8 *) *copy, s, len);
+	}
+	fe->key = *copy;
+	fe->hash = h;
+	fe->count = 0;
+	hash->used++;
+    }
+    if (fe->count++ == 0 && table->marks)
+	FcSubstProgramMarkList (hash->program_hash, s, table->marks);
+}
+
+static void
+FamilyHashDel (FamilyHash *hash, const FcChar8 *s)
+{
+    FamilyTableEntry *fe = FamilyHashFind (hash, s, (*hash->hash_func) (s));
+
+    if (fe->key && fe->count > 0)
+	fe->count--;
+}
+
 static FcBool
 FamilyTableLookup (FamilyTable   *table,
                    FcOp           _op,
@@ -1577,14 +2855,15 @@ FamilyTableLookup (FamilyTable   *table,
 {
     FamilyTableEntry *fe;
     int flags = FC_OP_GET_FLAGS (_op);
-    FcHashTable *hash;
+    FamilyHash *hash;
 
     if (flags & FcOpFlagIgnoreBlanks)
-        hash = table->family_blank_hash;
+        hash = &table->family_blank_hash;
     else
-        hash = table->family_hash;
+        hash = &table->family_hash;
 
-    return FcHashTableFind (hash, (const void *)s, (void **)&fe);
+    fe = FamilyHashFind (hash, s, (*hash->hash_func) (s));
+    return fe->key && fe->count > 0;
 }
 
 static void
@@ -1595,23 +2874,10 @@ FamilyTableAdd (FamilyTable    *table,
     for (ll = values; ll; ll = FcValueListNext (ll))
         {
             const FcChar8 *s = FcValueString (&ll->value);
-            FamilyTableEntry *fe;
+            const FcChar8 *copy = NULL;
 
-            if (!FcHashTableFind (table->family_hash, (const void *)s, (void **)&fe))
-            {
-                fe = malloc (sizeof (FamilyTableEntry));
-                fe->count = 0;
-                FcHashTableAdd (table->family_hash, (void *)s, fe);
-            }
-            fe->count++;
-
-            if (!FcHashTableFind (table->family_blank_hash, (const void *)s, (void **)&fe))
-            {
-                fe = malloc (sizeof (FamilyTableEntry));
-                fe->count = 0;
-                FcHashTableAdd (table->family_blank_hash, (void *)s, fe);
-            }
-            fe->count++;
+            FamilyHashAdd (table, &table->family_hash, s, &copy);
+            FamilyHashAdd (table, &table->family_blank_hash, s, &copy);
        }
 }
 
@@ -1619,60 +2885,37 @@ static void
 FamilyTableDel (FamilyTable   *table,
                 const FcChar8 *s)
 {
-    FamilyTableEntry *fe;
-
-    if (FcHashTableFind (table->family_hash, (void *)s, (void **)&fe))
-    {
-        fe->count--;
-        if (fe->count == 0)
-            FcHashTableRemove (table->family_hash, (void *)s);
-    }
-
-    if (FcHashTableFind (table->family_blank_hash, (void *)s, (void **)&fe))
-    {
-        fe->count--;
-        if (fe->count == 0)
-            FcHashTableRemove (table->family_blank_hash, (void *)s);
-    }
+    FamilyHashDel (&table->family_hash, s);
+    FamilyHashDel (&table->family_blank_hash, s);
 }
 
 static FcBool
-copy_string (const void *src, void **dest)
-{
-  *dest = strdup ((char *)src);
-  return FcTrue;
-}
-
-static void
 FamilyTableInit (FamilyTable *table,
-                 FcPattern *p)
+                 FcPattern *p,
+                 const FcSubstProgram *program,
+                 FcChar32 *marks,
+                 FcSubstArena *arena)
 {
     FcPatternElt *e;
 
-    table->family_blank_hash = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreBlanksAndCase,
-                                          (FcCompareFunc)FcStrCmpIgnoreBlanksAndCase,
-                                          (FcCopyFunc)copy_string,
-                                          NULL,
-                                          free,
-                                          free);
-    table->family_hash = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreCase,
-                                          (FcCompareFunc)FcStrCmpIgnoreCase,
-                                          (FcCopyFunc)copy_string,
-                                          NULL,
-                                          free,
-                                          free);
+    table->arena = arena;
+    table->program = program;
+    table->marks = marks;
+
+    if (!FamilyHashInit (&table->family_blank_hash, arena, FC_SUBST_FAMILY_SLOTS) ||
+        !FamilyHashInit (&table->family_hash, arena, FC_SUBST_FAMILY_SLOTS))
+        return FcFalse;
+    table->family_blank_hash.hash_func = FcStrHashIgnoreBlanksAndCase;
+    table->family_blank_hash.cmp_func = FcStrCmpIgnoreBlanksAndCase;
+    table->family_blank_hash.program_hash = program->family_blank_hash;
+    table->family_hash.hash_func = FcStrHashIgnoreCase;
+    table->family_hash.cmp_func = FcStrCmpIgnoreCase;
+    table->family_hash.program_hash = program->family_hash;
     e = FcPatternObjectFindElt (p, FC_FAMILY_OBJECT);
     if (e)
         FamilyTableAdd (table, FcPatternEltValues (e));
-}
 
-static void
-FamilyTableClear (FamilyTable *table)
-{
-    if (table->family_blank_hash)
-        FcHashTableDestroy (table->family_blank_hash);
-    if (table->family_hash)
-        FcHashTableDestroy (table->family_hash);
+    return FcTrue;
 }
 
 static FcValueList *
@@ -1688,18 +2931,19 @@ FcConfigMatchValueList (FcPattern	*p,
     FcValue	    value;
     FcValueList	    *v;
     FcOp            op;
+    FcBool	    own;
 
     while (e)
     {
 	/* Compute the value of the match expression */
 	if (FC_OP_GET_OP (e->op) == FcOpComma)
 	{
-	    value = FcConfigEvaluate (p, p_pat, kind, e->u.tree.left);
+	    value = FcConfigEvaluateShared (p, p_pat, kind, e->u.tree.left, &own);
 	    e = e->u.tree.right;
 	}
 	else
 	{
-	    value = FcConfigEvaluate (p, p_pat, kind, e);
+	    value = FcConfigEvaluateShared (p, p_pat, kind, e, &own);
 	    e = 0;
 	}
 
@@ -1744,7 +2988,8 @@ FcConfigMatchValueList (FcPattern	*p,
 	    }
 	}
 done:
-	FcValueDestroy (value);
+	if (own)
+	    FcValueDestroy (value);
     }
     return ret;
 }
@@ -1950,27 +3195,311 @@ FcConfigPatternCanon (FcPattern	    *p,
 	FcPatternObjectDel (p, object);
 }
 
-FcBool
-FcConfigSubstituteWithPat (FcConfig    *config,
-			   FcPattern   *p,
-			   FcPattern   *p_pat,
-			   FcMatchKind kind)
+/*
+ * Run one rule: its tests, and if they all match, its edits.  The
+ * family table to use carries over from one rule to the next.
+ */
+static void
+FcConfigSubstituteRule (FcRule		*rule,
+			FcPattern	*p,
+			FcPattern	*p_pat,
+			FcMatchKind	kind,
+			FcPatternElt	**elt,
+			FcValueList	**value,
+			FcTest		**tst,
+			FamilyTable	*data,
+			FamilyTable	**tablep)
+{
+    FcRule	    *r = rule;
+    FcValueList	    *l, *vl;
+    FcPattern	    *m;
+    FcObject	    object;
+    FcPatternElt    *e;
+    FamilyTable	    *table = *tablep;
+
+	for (; r; r = r->next)
+	{
+	    switch (r->type) {
+	    case FcRuleUnknown:
+		/* shouldn't be reached */
+		break;
+	    case FcRuleTest:
+		object = FC_OBJ_ID (r->u.test->object);
+		/*
+		 * Check the tests to see if
+		 * they all match the pattern
+		 */
+		if (FcDebug () & FC_DBG_EDIT)
+		{
+		    printf ("FcConfigSubstitute test ");
+		    FcTestPrint (r->u.test);
+		}
+		if (kind == FcMatchFont && r->u.test->kind == FcMatchPattern)
+		{
+		    m = p_pat;
+		    table = NULL;
+		}
+		else
+		{
+		    m = p;
+		    table = data;
+		}
+		if (m)
+		    e = FcPatternObjectFindElt (m, r->u.test->object);
+		else
+		    e = NULL;
+		/* different 'kind' won't be the target of edit */
+		if (!elt[object] && kind == r->u.test->kind)
+		{
+		    elt[object] = e;
+		    tst[object] = r->u.test;
+		}
+		/*
+		 * If there's no such field in the font,
+		 * then FcQualAll matches while FcQualAny does not
+		 */
+		if (!e)
+		{
+		    if (r->u.test->qual == FcQualAll)
+		    {
+			value[object] = NULL;
+			continue;
+		    }
+		    else
+		    {
+			if (FcDebug () & FC_DBG_EDIT)
+			    printf ("No match\n");
+			goto bail;
+		    }
+		}
+		/*
+		 * Check to see if there is a match, mark the location
+		 * to apply match-relative edits
+		 */
+		vl = FcConfigMatchValueList (m, p_pat, kind, r->u.test, e->values, table);
+		/* different 'kind' won't be the target of edit */
+		if (!value[object] && kind == r->u.test->kind)
+		    value[object] = vl;
+		if (!vl ||
+		    (r->u.test->qual == FcQualFirst && vl != e->values) ||
+		    (r->u.test->qual == FcQualNotFirst && vl == e->values))
+		{
+		    if (FcDebug () & FC_DBG_EDIT)
+			printf ("No match\n");
+		    goto bail;
+		}
+		break;
+	    case FcRuleEdit:
+		object = FC_OBJ_ID (r->u.edit->object);
+		if (FcDebug () & FC_DBG_EDIT)
+		{
+		    printf ("Substitute ");
+		    FcEditPrint (r->u.edit);
+		    printf ("\n\n");
+		}
+		/*
+		 * Evaluate the list of expressions
+		 */
+		l = FcConfigValues (p, p_pat, kind, r->u.edit->expr, r->u.edit->binding);
+		if (tst[object] && (tst[object]->kind == FcMatchFont || kind == FcMatchPattern))
+		    elt[object] = FcPatternObjectFindElt (p, tst[object]->object);
+
+		switch (FC_OP_GET_OP (r->u.edit->op)) {
+		case FcOpAssign:
+		    /*
+		     * If there was a test, then replace the matched
+		     * value with the new list of values
+		     */
+		    if (value[object])
+		    {
+			FcValueList	*thisValue = value[object];
+			FcValueList	*nextValue = l;
+
+			/*
+			 * Append the new list of values after the current value
+			 */
+			FcConfigAdd (&elt[object]->values, thisValue, FcTrue, l, r->u.edit->object, table);
+			/*
+			 * Delete the marked value
+			 */
+			if (thisValue)
+			    FcConfigDel (&elt[object]->values, thisValue, object, table);
+			/*
+			 * Adjust a pointer into the value list to ensure
+			 * future edits occur at the same place
+			 */
+			value[object] = nextValue;
+			break;
+		    }
+		    /* fall through ... */
+		case FcOpAssignReplace:
+		    /*
+		     * Delete all of the values and insert
+		     * the new set
+		     */
+		    FcConfigPatternDel (p, r->u.edit->object, table);
+		    FcConfigPatternAdd (p, r->u.edit->object, l, FcTrue, table);
+		    /*
+		     * Adjust a pointer into the value list as they no
+		     * longer point to anything valid
+		     */
+		    value[object] = NULL;
+		    break;
+		case FcOpPrepend:
+		    if (value[object])
+		    {
+			FcConfigAdd (&elt[object]->values, value[object], FcFalse, l, r->u.edit->object, table);
+			break;
+		    }
+		    /* fall through ... */
+		case FcOpPrependFirst:
+		    FcConfigPatternAdd (p, r->u.edit->object, l, FcFalse, table);
+		    break;
+		case FcOpAppend:
+		    if (value[object])
+		    {
+			FcConfigAdd (&elt[object]->values, value[object], FcTrue, l, r->u.edit->object, table);
+			break;
+		    }
+		    /* fall through ... */
+		case FcOpAppendLast:
+		    FcConfigPatternAdd (p, r->u.edit->object, l, FcTrue, table);
+		    break;
+		case FcOpDelete:
+		    if (value[object])
+		    {
+			FcConfigDel (&elt[object]->values, value[object], object, table);
+			FcValueListDestroy (l);
+			break;
+		    }
+		    /* fall through ... */
+		case FcOpDeleteAll:
+		    FcConfigPatternDel (p, r->u.edit->object, table);
+		    FcValueListDestroy (l);
+		    break;
+		default:
+		    FcValueListDestroy (l);
+		    break;
+		}
+		/*
+		 * Now go through the pattern and eliminate
+		 * any properties without data
+		 */
+		FcConfigPatternCanon (p, r->u.edit->object);
+		if (data->marks)
+		    FcSubstProgramMarkObject (data->program, r->u.edit->object, data->marks);
+
+		if (FcDebug () & FC_DBG_EDIT)
+		{
+		    printf ("FcConfigSubstitute edit");
+		    FcPatternPrint (p);
+		}
+		break;
+	    }
+	}
+bail:
+    *tablep = table;
+    /* Only what the rule refers to has been set */
+    for (r = rule; r; r = r->next)
+    {
+	if (r->type == FcRuleTest)
+	    object = FC_OBJ_ID (r->u.test->object);
+	else if (r->type == FcRuleEdit)
+	    object = FC_OBJ_ID (r->u.edit->object);
+	else
+	    continue;
+	elt[object] = NULL;
+	value[object] = NULL;
+	tst[object] = NULL;
+    }
+}
+
+/*
+ * Append the languages in langs to the pattern, most preferred first,
+ * stopping at the first one it already asks for or after "und"; nothing
+ * is added when it asks for "und".  sets and und hold the same languages as language
+ * sets when the caller has them at hand.
+ */
+static void
+FcConfigAddDefaultLangs (FcPattern	*p,
+			 FcStrSet	*langs,
+			 FcLangSet	**sets,
+			 FcLangSet	*und)
+{
+    FcPatternElt	    *e = FcPatternObjectFindElt (p, FC_LANG_OBJECT);
+    FcValueListPtr	    ll;
+    FcValuePromotionBuffer  buf_und, buf_lang;
+    FcLangSet		    *ls;
+    FcValue		    v;
+    int			    i, j, n;
+
+    if (e)
+    {
+	if (!und)
+	    und = FcLangSetPromote ((const FcChar8 *) "und", &buf_und);
+	for (ll = FcPatternEltValues (e); ll; ll = FcValueListNext (ll))
+	{
+	    v = FcValueCanonicalize (&ll->value);
+	    if (v.type == FcTypeLangSet ? FcLangSetContains (v.u.l, und) :
+		FcStrCmpIgnoreCase (v.u.s, (const FcChar8 *) "und") == 0)
+		return;
+	}
+    }
+    /* Find where the pattern's own languages take over */
+    for (n = 0; n < langs->num; n++)
+    {
+	const FcChar8 *lang = langs->strs[n];
+
+	/* Earlier languages will have been added by then */
+	for (j = 0; j < n; j++)
+	    if (FcStrCmpIgnoreCase (langs->strs[j], lang) == 0)
+		goto add;
+	if (e)
+	{
+	    ls = sets ? sets[n] : FcLangSetPromote (lang, &buf_lang);
+	    for (ll = FcPatternEltValues (e); ll; ll = FcValueListNext (ll))
+	    {
+		v = FcValueCanonicalize (&ll->value);
+		if (v.type == FcTypeLangSet ? FcLangSetContains (v.u.l, ls) :
+		    FcStrCmpIgnoreCase (v.u.s, lang) == 0)
+		    goto add;
+	    }
+	}
+	/* The pattern asks for "und" once it is added */
+	if (FcStrCmpIgnoreCase (lang, (const FcChar8 *) "und") == 0)
+	{
+	    n++;
+	    break;
+	}
+    }
+add:
+    for (i = 0; i < n; i++)
+    {
+	v.type = FcTypeString;
+	v.u.s = langs->strs[i];
+	FcPatternObjectAddWithBinding (p, FC_LANG_OBJECT, v, FcValueBindingWeak, FcTrue);
+    }
+}
+
+static FcBool
+FcConfigSubstituteFull (FcConfig    *config,
+			FcPattern   *p,
+			FcPattern   *p_pat,
+			FcStrSet    *langs,
+			FcMatchKind kind)
 {
     FcValue v;
-    FcPtrList	    *s;
-    FcPtrListIter    iter, iter2;
-    FcRule          *r;
-    FcRuleSet	    *rs;
-    FcValueList	    *l, **value = NULL, *vl;
-    FcPattern	    *m;
-    FcStrSet	    *strs;
-    FcObject	    object = FC_INVALID_OBJECT;
-    FcPatternElt    **elt = NULL, *e;
-    int		    i, nobjs;
+    FcSubstProgram  *program;
+    FcSubstRule	    *rule;
+    FcValueList	    **value = NULL;
+    FcPatternElt    **elt = NULL;
+    int		    i, prev, nobjs;
     FcBool	    retval = FcTrue;
     FcTest	    **tst = NULL;
+    FcChar32	    *marks;
     FamilyTable     data;
     FamilyTable     *table = &data;
+    FcSubstArena    arena;
 
     if (kind < FcMatchKindBegin || kind >= FcMatchKindEnd)
 	return FcFalse;
@@ -1978,62 +3507,18 @@ FcConfigSubstituteWithPat (FcConfig    *config,
     config = FcConfigReference (config);
     if (!config)
 	return FcFalse;
+    FcSubstArenaInit (&arena);
 
-    s = config->subst[kind];
     if (kind == FcMatchPattern)
     {
-	strs = FcGetDefaultLangs ();
-	if (strs)
+	if (langs)
+	    FcConfigAddDefaultLangs (p, langs, NULL, NULL);
+	else
 	{
-	    FcStrList *l = FcStrListCreate (strs);
-	    FcChar8 *lang;
-	    FcValue v;
-	    FcLangSet *lsund = FcLangSetCreate ();
-
-	    FcLangSetAdd (lsund, (const FcChar8 *)"und");
-	    FcStrSetDestroy (strs);
-	    while (l && (lang = FcStrListNext (l)))
-	    {
-		FcPatternElt *e = FcPatternObjectFindElt (p, FC_LANG_OBJECT);
-
-		if (e)
-		{
-		    FcValueListPtr ll;
-
-		    for (ll = FcPatternEltValues (e); ll; ll = FcValueListNext (ll))
-		    {
-			FcValue vv = FcValueCanonicalize (&ll->value);
-
-			if (vv.type == FcTypeLangSet)
-			{
-			    FcLangSet *ls = FcLangSetCreate ();
-			    FcBool b;
-
-			    FcLangSetAdd (ls, lang);
-			    b = FcLangSetContains (vv.u.l, ls);
-			    FcLangSetDestroy (ls);
-			    if (b)
-				goto bail_lang;
-			    if (FcLangSetContains (vv.u.l, lsund))
-				goto bail_lang;
-			}
-			else
-			{
-			    if (FcStrCmpIgnoreCase (vv.u.s, lang) == 0)
-				goto bail_lang;
-			    if (FcStrCmpIgnoreCase (vv.u.s, (const FcChar8 *)"und") == 0)
-				goto bail_lang;
-			}
-		    }
-		}
-		v.type = FcTypeString;
-		v.u.s = lang;
+	    const FcDefaultLangs *d = FcGetDefaultLangSets ();
 
-		FcPatternObjectAddWithBinding (p, FC_LANG_OBJECT, v, FcValueBindingWeak, FcTrue);
-	    }
-	bail_lang:
-	    FcStrListDone (l);
-	    FcLangSetDestroy (lsund);
+	    if (d)
+		FcConfigAddDefaultLangs (p, d->langs, d->sets, d->und);
 	}
 	if (FcPatternObjectGet (p, FC_PRGNAME_OBJECT, 0, &v) == FcResultNoMatch)
 	{
@@ -2043,21 +3528,20 @@ FcConfigSubstituteWithPat (FcConfig    *config,
 	}
     }
 
-    nobjs = FC_MAX_BASE_OBJECT + config->maxObjects + 2;
-    value = (FcValueList **) malloc (SIZEOF_VOID_P * nobjs);
-    if (!value)
-    {
-	retval = FcFalse;
-	goto bail1;
-    }
-    elt = (FcPatternElt **) malloc (SIZEOF_VOID_P * nobjs);
-    if (!elt)
+    program = FcConfigSubstProgram (config, kind);
+    if (!program)
     {
 	retval = FcFalse;
 	goto bail1;
     }
-    tst = (FcTest **) malloc (SIZEOF_VOID_P * nobjs);
-    if (!tst)
+
+    /* Rules clear what they set, so these only need clearing once */
+    nobjs = FC_MAX_BASE_OBJECT + config->maxObjects + 2;
+    marks = FcSubstArenaAlloc (&arena, program->nmark * sizeof (FcChar32));
+    value = FcSubstArenaAlloc0 (&arena, nobjs * sizeof (FcValueList *));
+    elt = FcSubstArenaAlloc0 (&arena, nobjs * sizeof (FcPatternElt *));
+    tst = FcSubstArenaAlloc0 (&arena, nobjs * sizeof (FcTest *));
+    if (!marks || !value || !elt || !tst)
     {
 	retval = FcFalse;
 	goto bail1;
@@ -2069,225 +3553,49 @@ FcConfigSubstituteWithPat (FcConfig    *config,
 	FcPatternPrint (p);
     }
 
-    FamilyTableInit (&data, p);
+    FcSubstProgramStart (program, p, p_pat, marks);
+    if (!FamilyTableInit (&data, p, program, marks, &arena))
+    {
+	retval = FcFalse;
+	goto bail1;
+    }
 
-    FcPtrListIterInit (s, &iter);
-    for (; FcPtrListIterIsValid (s, &iter); FcPtrListIterNext (s, &iter))
+    prev = -1;
+    for (i = FcSubstProgramNext (program, marks, 0); i < program->nrule;
+	 i = FcSubstProgramNext (program, marks, i + 1))
     {
-	rs = (FcRuleSet *) FcPtrListIterGetValue (s, &iter);
-	if (FcDebug () & FC_DBG_EDIT)
-	{
-	    printf ("\nRule Set: %s\n", rs->name);
-	}
-	FcPtrListIterInit (rs->subst[kind], &iter2);
-	for (; FcPtrListIterIsValid (rs->subst[kind], &iter2); FcPtrListIterNext (rs->subst[kind], &iter2))
+	rule = &program->rules[i];
+	if ((FcDebug () & FC_DBG_EDIT) && rule->first_in_set)
 	{
-	    r = (FcRule *) FcPtrListIterGetValue (rs->subst[kind], &iter2);
-	    for (i = 0; i < nobjs; i++)
-	    {
-		elt[i] = NULL;
-		value[i] = NULL;
-		tst[i] = NULL;
-	    }
-	    for (; r; r = r->next)
-	    {
-		switch (r->type) {
-		case FcRuleUnknown:
-		    /* shouldn't be reached */
-		    break;
-		case FcRuleTest:
-		    object = FC_OBJ_ID (r->u.test->object);
-		    /*
-		     * Check the tests to see if
-		     * they all match the pattern
-		     */
-		    if (FcDebug () & FC_DBG_EDIT)
-		    {
-			printf ("FcConfigSubstitute test ");
-			FcTestPrint (r->u.test);
-		    }
-		    if (kind == FcMatchFont && r->u.test->kind == FcMatchPattern)
-                    {
-			m = p_pat;
-                        table = NULL;
-                    }
-		    else
-                    {
-			m = p;
-                        table = &data;
-                    }
-		    if (m)
-			e = FcPatternObjectFindElt (m, r->u.test->object);
-		    else
-			e = NULL;
-		    /* different 'kind' won't be the target of edit */
-		    if (!elt[object] && kind == r->u.test->kind)
-		    {
-			elt[object] = e;
-			tst[object] = r->u.test;
-		    }
-		    /*
-		     * If there's no such field in the font,
-		     * then FcQualAll matches while FcQualAny does not
-		     */
-		    if (!e)
-		    {
-			if (r->u.test->qual == FcQualAll)
-			{
-			    value[object] = NULL;
-			    continue;
-			}
-			else
-			{
-			    if (FcDebug () & FC_DBG_EDIT)
-				printf ("No match\n");
-			    goto bail;
-			}
-		    }
-		    /*
-		     * Check to see if there is a match, mark the location
-		     * to apply match-relative edits
-		     */
-		    vl = FcConfigMatchValueList (m, p_pat, kind, r->u.test, e->values, table);
-		    /* different 'kind' won't be the target of edit */
-		    if (!value[object] && kind == r->u.test->kind)
-			value[object] = vl;
-		    if (!vl ||
-			(r->u.test->qual == FcQualFirst && vl != e->values) ||
-			(r->u.test->qual == FcQualNotFirst && vl == e->values))
-		    {
-			if (FcDebug () & FC_DBG_EDIT)
-			    printf ("No match\n");
-			goto bail;
-		    }
-		    break;
-		case FcRuleEdit:
-		    object = FC_OBJ_ID (r->u.edit->object);
-		    if (FcDebug () & FC_DBG_EDIT)
-		    {
-			printf ("Substitute ");
-			FcEditPrint (r->u.edit);
-			printf ("\n\n");
-		    }
-		    /*
-		     * Evaluate the list of expressions
-		     */
-		    l = FcConfigValues (p, p_pat, kind, r->u.edit->expr, r->u.edit->binding);
-		    if (tst[object] && (tst[object]->kind == FcMatchFont || kind == FcMatchPattern))
-			elt[object] = FcPatternObjectFindElt (p, tst[object]->object);
-
-		    switch (FC_OP_GET_OP (r->u.edit->op)) {
-		    case FcOpAssign:
-			/*
-			 * If there was a test, then replace the matched
-			 * value with the new list of values
-			 */
-			if (value[object])
-			{
-			    FcValueList	*thisValue = value[object];
-			    FcValueList	*nextValue = l;
-
-			    /*
-			     * Append the new list of values after the current value
-			     */
-			    FcConfigAdd (&elt[object]->values, thisValue, FcTrue, l, r->u.edit->object, table);
-			    /*
-			     * Delete the marked value
-			     */
-			    if (thisValue)
-				FcConfigDel (&elt[object]->values, thisValue, object, table);
-			    /*
-			     * Adjust a pointer into the value list to ensure
-			     * future edits occur at the same place
-			     */
-			    value[object] = nextValue;
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpAssignReplace:
-			/*
-			 * Delete all of the values and insert
-			 * the new set
-			 */
-			FcConfigPatternDel (p, r->u.edit->object, table);
-			FcConfigPatternAdd (p, r->u.edit->object, l, FcTrue, table);
-			/*
-			 * Adjust a pointer into the value list as they no
-			 * longer point to anything valid
-			 */
-			value[object] = NULL;
-			break;
-		    case FcOpPrepend:
-			if (value[object])
-			{
-			    FcConfigAdd (&elt[object]->values, value[object], FcFalse, l, r->u.edit->object, table);
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpPrependFirst:
-			FcConfigPatternAdd (p, r->u.edit->object, l, FcFalse, table);
-			break;
-		    case FcOpAppend:
-			if (value[object])
-			{
-			    FcConfigAdd (&elt[object]->values, value[object], FcTrue, l, r->u.edit->object, table);
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpAppendLast:
-			FcConfigPatternAdd (p, r->u.edit->object, l, FcTrue, table);
-			break;
-		    case FcOpDelete:
-			if (value[object])
-			{
-			    FcConfigDel (&elt[object]->values, value[object], object, table);
-			    FcValueListDestroy (l);
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpDeleteAll:
-			FcConfigPatternDel (p, r->u.edit->object, table);
-			FcValueListDestroy (l);
-			break;
-		    default:
-			FcValueListDestroy (l);
-			break;
-		    }
-		    /*
-		     * Now go through the pattern and eliminate
-		     * any properties without data
-		     */
-		    FcConfigPatternCanon (p, r->u.edit->object);
-
-		    if (FcDebug () & FC_DBG_EDIT)
-		    {
-			printf ("FcConfigSubstitute edit");
-			FcPatternPrint (p);
-		    }
-		    break;
-		}
-	    }
-	bail:;
+	    printf ("\nRule Set: %s\n", rule->rs->name);
 	}
+	/* A rule that was passed over would have stopped at its first test */
+	if (i > prev + 1)
+	    table = program->rules[i - 1].pattern_test ? NULL : &data;
+	FcConfigSubstituteRule (rule->rule, p, p_pat, kind, elt, value, tst, &data, &table);
+	prev = i;
     }
     if (FcDebug () & FC_DBG_EDIT)
     {
 	printf ("FcConfigSubstitute done");
 	FcPatternPrint (p);
     }
-    FamilyTableClear (&data);
 bail1:
-    if (elt)
-	free (elt);
-    if (value)
-	free (value);
-    if (tst)
-	free (tst);
+    FcSubstArenaFini (&arena);
     FcConfigDestroy (config);
 
     return retval;
 }
 
+FcBool
+FcConfigSubstituteWithPat (FcConfig    *config,
+			   FcPattern   *p,
+			   FcPattern   *p_pat,
+			   FcMatchKind kind)
+{
+    return FcConfigSubstituteFull (config, p, p_pat, NULL, kind);
+}
+
 FcBool
 FcConfigSubstitute (FcConfig	*config,
 		    FcPattern	*p,
@@ -2296,6 +3604,15 @@ FcConfigSubstitute (FcConfig	*config,
     return FcConfigSubstituteWithPat (config, p, 0, kind);
 }
 
+FcBool
+FcConfigSubstituteWithLangs (FcConfig	 *config,
+			     FcPattern	 *p,
+			     FcStrSet	 *langs,
+			     FcMatchKind kind)
+{
+    return FcConfigSubstituteFull (config, p, NULL, langs, kind);
+}
+
 #if defined (_WIN32)
 
 static FcChar8 fontconfig_path[1000] = ""; /* MT-dontcare */
@@ -2826,7 +4143,9 @@ FcConfigAppFontAddFile (FcConfig    *config,
 	FcConfigSetFonts (config, set, FcSetApplication);
     }
 
-    if (!FcFileScanConfig (set, subdirs, file, config))
+    ret = FcFileScanConfig (set, subdirs, file, config);
+    FcConfigFontsChanged (config);
+    if (!ret)
     {
 	FcStrSetDestroy (subdirs);
 	ret = FcFalse;
@@ -2881,7 +4200,7 @@ FcConfigAppFontAddDir (FcConfig	    *config,
 
     FcStrSetAddFilename (dirs, dir);
 
-    if (!FcConfigAddDirList (config, FcSetApplication, dirs))
+    if (!FcConfigAddDirList (config, config->fonts[FcSetApplication], dirs, NULL))
     {
 	FcStrSetDestroy (dirs);
 	ret = FcFalse;
@@ -2910,40 +4229,172 @@ FcConfigAppFontClear (FcConfig	    *config)
  * Manage filename-based font source selectors
  */
 
+/*
+ * Globs are looked up by the literal text they start with: walking a
+ * trie of those prefixes along the file name turns up the only globs
+ * that may match it, and only what follows the prefix is left to
+ * FcStrGlobMatch.  Globs starting with a wildcard hang off the root.
+ */
+typedef struct _FcGlobNode {
+    FcChar8	c;
+    int		child;	    /* first child, 0 if none */
+    int		next;	    /* next sibling, 0 if none */
+    int		globs;	    /* first glob with this prefix, -1 if none */
+} FcGlobNode;
+
+typedef struct _FcGlobRest {
+    const FcChar8   *rest;  /* the glob after the prefix */
+    int		    next;   /* next glob with the same prefix, -1 if none */
+} FcGlobRest;
+
+struct _FcGlobMatcher {
+    int		nnode;
+    FcGlobNode	*nodes;
+    FcGlobRest	*rests;
+};
+
+void
+FcGlobMatcherDestroy (FcGlobMatcher *matcher)
+{
+    if (matcher)
+    {
+	free (matcher->nodes);
+	free (matcher->rests);
+	free (matcher);
+    }
+}
+
+static FcGlobMatcher *
+FcGlobMatcherCreate (const FcStrSet *globs)
+{
+    FcGlobMatcher   *matcher;
+    int		    i, nnode = 1, node, child;
+    const FcChar8   *g;
+
+    /* Never more nodes than literal characters, plus the root */
+    for (i = 0; i < globs->num; i++)
+	nnode += strlen ((const char *) globs->strs[i]);
+    matcher = calloc (1, sizeof (FcGlobMatcher));
+    if (!matcher)
+	return NULL;
+    matcher->nodes = malloc (nnode * sizeof (FcGlobNode));
+    matcher->rests = malloc ((globs->num ? globs->num : 1) * sizeof (FcGlobRest));
+    if (!matcher->nodes || !matcher->rests)
+    {
+	FcGlobMatcherDestroy (matcher);
+	return NULL;
+    }
+    matcher->nnode = 1;
+    memset (&matcher->nodes[0], 0, sizeof (FcGlobNode));
+    matcher->nodes[0].globs = -1;
+
+    for (i = 0; i < globs->num; i++)
+    {
+	node = 0;
+	for (g = globs->strs[i]; *g && *g != '*' && *g != '?'; g++)
+	{
+	    for (child = matcher->nodes[node].child; child; child = matcher->nodes[child].next)
+		if (matcher->nodes[child].c == *g)
+		    break;
+	    if (!child)
+	    {
+		child = matcher->nnode++;
+		matcher->nodes[child].c = *g;
+		matcher->nodes[child].child = 0;
+		matcher->nodes[child].next = matcher->nodes[node].child;
+		matcher->nodes[child].globs = -1;
+		matcher->nodes[node].child = child;
+	    }
+	    node = child;
+	}
+	/* Which of the globs matches doesn't matter, only whether one does */
+	matcher->rests[i].rest = g;
+	matcher->rests[i].next = matcher->nodes[node].globs;
+	matcher->nodes[node].globs = i;
+    }
+
+    return matcher;
+}
+
+static FcBool
+FcGlobMatcherMatch (const FcGlobMatcher *matcher,
+		    const FcChar8	*string)
+{
+    int	node = 0, g;
+
+    for (;;)
+    {
+	for (g = matcher->nodes[node].globs; g >= 0; g = matcher->rests[g].next)
+	    if (FcStrGlobMatch (matcher->rests[g].rest, string))
+		return FcTrue;
+	if (!*string)
+	    return FcFalse;
+	for (node = matcher->nodes[node].child; node; node = matcher->nodes[node].next)
+	    if (matcher->nodes[node].c == *string)
+		break;
+	if (!node)
+	    return FcFalse;
+	string++;
+    }
+}
+
 FcBool
 FcConfigGlobAdd (FcConfig	*config,
 		 const FcChar8  *glob,
 		 FcBool		accept)
 {
     FcStrSet	*set = accept ? config->acceptGlobs : config->rejectGlobs;
+    FcGlobMatcher **matcher = accept ? &config->acceptGlobMatcher : &config->rejectGlobMatcher;
 	FcChar8	*realglob = FcStrCopyFilename(glob);
 	if (!realglob)
 		return FcFalse;
 
     FcBool	 ret = FcStrSetAdd (set, realglob);
     FcStrFree(realglob);
+    FcGlobMatcherDestroy (*matcher);
+    *matcher = NULL;
     return ret;
 }
 
 static FcBool
 FcConfigGlobsMatch (const FcStrSet	*globs,
+		    FcGlobMatcher	**matcherp,
 		    const FcChar8	*string)
 {
-    int	i;
+    FcGlobMatcher   *matcher;
+    int		    i;
 
-    for (i = 0; i < globs->num; i++)
-	if (FcStrGlobMatch (globs->strs[i], string))
-	    return FcTrue;
-    return FcFalse;
+    if (globs->num == 0)
+	return FcFalse;
+retry:
+    matcher = fc_atomic_ptr_get (matcherp);
+    if (!matcher)
+    {
+	matcher = FcGlobMatcherCreate (globs);
+	if (!matcher)
+	{
+	    for (i = 0; i < globs->num; i++)
+		if (FcStrGlobMatch (globs->strs[i], string))
+		    return FcTrue;
+	    return FcFalse;
+	}
+	if (!fc_atomic_ptr_cmpexch (matcherp, NULL, matcher))
+	{
+	    FcGlobMatcherDestroy (matcher);
+	    goto retry;
+	}
+    }
+
+    return FcGlobMatcherMatch (matcher, string);
 }
 
 FcBool
 FcConfigAcceptFilename (FcConfig	*config,
 			const FcChar8	*filename)
 {
-    if (FcConfigGlobsMatch (config->acceptGlobs, filename))
+    if (FcConfigGlobsMatch (config->acceptGlobs, &config->acceptGlobMatcher, filename))
 	return FcTrue;
-    if (FcConfigGlobsMatch (config->rejectGlobs, filename))
+    if (FcConfigGlobsMatch (config->rejectGlobs, &config->rejectGlobMatcher, filename))
 	return FcFalse;
     return FcTrue;
 }
@@ -2952,35 +4403,238 @@ FcConfigAcceptFilename (FcConfig	*config,
  * Manage font-pattern based font source selectors
  */
 
+/*
+ * Most selectors name a family, or some other string the font must
+ * have.  They are filed by that string, so a font need only be checked
+ * against the selectors filed under its own strings, besides those with
+ * nothing to file them by.
+ */
+typedef struct _FcSelectorKey {
+    FcObject	    object;
+    FcChar32	    hash;
+    const FcChar8   *string;	/* NULL for an empty slot */
+    int		    first;	/* first selector filed under it */
+} FcSelectorKey;
+
+struct _FcSelectorIndex {
+    int		    nkey;	/* a power of two */
+    FcSelectorKey   *keys;
+    int		    nobject;
+    FcObject	    *objects;	/* the objects keys are made of */
+    int		    unfiled;	/* first selector filed under nothing, -1 if none */
+    int		    *next;	/* next selector filed alike, -1 if none */
+};
+
+void
+FcSelectorIndexDestroy (FcSelectorIndex *index)
+{
+    if (index)
+    {
+	free (index->keys);
+	free (index->objects);
+	free (index->next);
+	free (index);
+    }
+}
+
+/*
+ * The string a font has to match pattern: the first value of its
+ * family, or else of its first string property.  Strings only ever
+ * match strings equal but for case and blanks.
+ */
+static FcBool
+FcSelectorKeyGet (const FcPattern *pattern, FcObject *object, const FcChar8 **string)
+{
+    FcPatternElt    *e;
+    FcValue	    v;
+    int		    i;
+
+    /* The family first, then the others in order */
+    e = FcPatternObjectFindElt (pattern, FC_FAMILY_OBJECT);
+    for (i = -1; i < pattern->num; i++)
+    {
+	if (i >= 0)
+	{
+	    e = &FcPatternElts (pattern)[i];
+	    /*
+	     * FcListPatternMatchAny ignores "namelang", strings are promoted
+	     * to language sets, and anything goes with unknown objects.
+	     */
+	    if (e->object == FC_NAMELANG_OBJECT ||
+		!FcObjectValidType (e->object, FcTypeString) ||
+		FcObjectValidType (e->object, FcTypeLangSet))
+		continue;
+	}
+	if (!e || !FcPatternEltValues (e))
+	    continue;
+	v = FcValueCanonicalize (&FcPatternEltValues (e)->value);
+	if (v.type == FcTypeString)
+	{
+	    *object = e->object;
+	    *string = v.u.s;
+	    return FcTrue;
+	}
+    }
+
+    return FcFalse;
+}
+
+static FcSelectorKey *
+FcSelectorIndexLookup (const FcSelectorIndex *index, FcObject object,
+		       FcChar32 hash, const FcChar8 *string)
+{
+    int		    mask = index->nkey - 1, i;
+    FcSelectorKey   *key;
+
+    for (i = hash & mask; (key = &index->keys[i])->string; i = (i + 1) & mask)
+	if (key->object == object && key->hash == hash &&
+	    FcStrCmpIgnoreBlanksAndCase (key->string, string) == 0)
+	    break;
+
+    return key;
+}
+
+static FcSelectorIndex *
+FcSelectorIndexCreate (const FcFontSet *patterns)
+{
+    FcSelectorIndex *index;
+    FcSelectorKey   *key;
+    FcObject	    object;
+    const FcChar8   *string;
+    FcChar32	    hash;
+    int		    i, j;
+
+    index = calloc (1, sizeof (FcSelectorIndex));
+    if (!index)
+	return NULL;
+    for (index->nkey = 8; index->nkey < patterns->nfont * 2; index->nkey *= 2)
+	;
+    index->keys = calloc (index->nkey, sizeof (FcSelectorKey));
+    index->objects = malloc ((patterns->nfont + 1) * sizeof (FcObject));
+    index->next = malloc ((patterns->nfont + 1) * sizeof (int));
+    if (!index->keys || !index->objects || !index->next)
+    {
+	FcSelectorIndexDestroy (index);
+	return NULL;
+    }
+    index->unfiled = -1;
+
+    for (i = 0; i < patterns->nfont; i++)
+    {
+	if (!FcSelectorKeyGet (patterns->fonts[i], &object, &string))
+	{
+	    index->next[i] = index->unfiled;
+	    index->unfiled = i;
+	    continue;
+	}
+	hash = FcStrHashIgnoreBlanksAndCase (string);
+	key = FcSelectorIndexLookup (index, object, hash, string);
+	if (!key->string)
+	{
+	    key->object = object;
+	    key->hash = hash;
+	    key->string = string;
+	    key->first = -1;
+	    for (j = 0; j < index->nobject; j++)
+		if (index->objects[j] == object)
+		    break;
+	    if (j == index->nobject)
+		index->objects[index->nobject++] = object;
+	}
+	index->next[i] = key->first;
+	key->first = i;
+    }
+
+    return index;
+}
+
+static FcBool
+FcSelectorIndexMatch (const FcSelectorIndex *index,
+		      const FcFontSet	    *patterns,
+		      const FcPattern	    *font)
+{
+    FcSelectorKey   *key;
+    FcPatternElt    *e;
+    FcValueListPtr  l;
+    FcValue	    v;
+    int		    i, o;
+
+    for (i = index->unfiled; i >= 0; i = index->next[i])
+	if (FcListPatternMatchAny (patterns->fonts[i], font))
+	    return FcTrue;
+    for (o = 0; o < index->nobject; o++)
+    {
+	e = FcPatternObjectFindElt (font, index->objects[o]);
+	if (!e)
+	    continue;
+	for (l = FcPatternEltValues (e); l; l = FcValueListNext (l))
+	{
+	    v = FcValueCanonicalize (&l->value);
+	    if (v.type != FcTypeString)
+		continue;
+	    key = FcSelectorIndexLookup (index, index->objects[o],
+					 FcStrHashIgnoreBlanksAndCase (v.u.s), v.u.s);
+	    for (i = key->string ? key->first : -1; i >= 0; i = index->next[i])
+		if (FcListPatternMatchAny (patterns->fonts[i], font))
+		    return FcTrue;
+	}
+    }
+
+    return FcFalse;
+}
+
 FcBool
 FcConfigPatternsAdd (FcConfig	*config,
 		     FcPattern	*pattern,
 		     FcBool	accept)
 {
     FcFontSet	*set = accept ? config->acceptPatterns : config->rejectPatterns;
+    FcSelectorIndex **index = accept ? &config->acceptPatternIndex : &config->rejectPatternIndex;
 
+    FcSelectorIndexDestroy (*index);
+    *index = NULL;
     return FcFontSetAdd (set, pattern);
 }
 
 static FcBool
 FcConfigPatternsMatch (const FcFontSet	*patterns,
+		       FcSelectorIndex	**indexp,
 		       const FcPattern	*font)
 {
-    int i;
+    FcSelectorIndex *index;
+    int		    i;
 
-    for (i = 0; i < patterns->nfont; i++)
-	if (FcListPatternMatchAny (patterns->fonts[i], font))
-	    return FcTrue;
-    return FcFalse;
+    if (patterns->nfont == 0)
+	return FcFalse;
+retry:
+    index = fc_atomic_ptr_get (indexp);
+    if (!index)
+    {
+	index = FcSelectorIndexCreate (patterns);
+	if (!index)
+	{
+	    for (i = 0; i < patterns->nfont; i++)
+		if (FcListPatternMatchAny (patterns->fonts[i], font))
+		    return FcTrue;
+	    return FcFalse;
+	}
+	if (!fc_atomic_ptr_cmpexch (indexp, NULL, index))
+	{
+	    FcSelectorIndexDestroy (index);
+	    goto retry;
+	}
+    }
+
+    return FcSelectorIndexMatch (index, patterns, font);
 }
 
 FcBool
 FcConfigAcceptFont (FcConfig	    *config,
 		    const FcPattern *font)
 {
-    if (FcConfigPatternsMatch (config->acceptPatterns, font))
+    if (FcConfigPatternsMatch (config->acceptPatterns, &config->acceptPatternIndex, font))
 	return FcTrue;
-    if (FcConfigPatternsMatch (config->rejectPatterns, font))
+    if (FcConfigPatternsMatch (config->rejectPatterns, &config->rejectPatternIndex, font))
 	return FcFalse;
     return FcTrue;
 }
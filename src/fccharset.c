@@ -406,6 +406,241 @@ FcCharSetAddLeaf (FcCharSet	*fcs,
     return FcTrue;
 }
 
+/*
+ * Leaf kernels.  A leaf is handled as four 64-bit words rather than
+ * eight 32-bit ones; the loops are simple enough for the compiler to
+ * keep a whole leaf in vector registers.  They are always inlined so
+ * that the set walks below pick up whatever instruction set the walk
+ * itself is compiled for.
+ */
+
+#if defined(__GNUC__)
+#define FC_LEAF_INLINE	inline __attribute__((always_inline))
+#else
+#define FC_LEAF_INLINE	inline
+#endif
+
+#define FC_LEAF_WORDS	(256/64)
+
+static FC_LEAF_INLINE FcChar32
+FcCharSetPopCount64 (uint64_t w)
+{
+#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+    return __builtin_popcountll (w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (FcChar32) ((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static FC_LEAF_INLINE uint64_t
+FcCharLeafWord (const FcCharLeaf *leaf, int i)
+{
+    uint64_t	w;
+
+    memcpy (&w, &leaf->map[2 * i], sizeof (w));
+    return w;
+}
+
+static FC_LEAF_INLINE void
+FcCharLeafSetWord (FcCharLeaf *leaf, int i, uint64_t w)
+{
+    memcpy (&leaf->map[2 * i], &w, sizeof (w));
+}
+
+static FC_LEAF_INLINE FcChar32
+FcCharLeafCount (const FcCharLeaf *al)
+{
+    FcChar32	count = 0;
+    int		i;
+
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+	count += FcCharSetPopCount64 (FcCharLeafWord (al, i));
+    return count;
+}
+
+static FC_LEAF_INLINE FcChar32
+FcCharLeafIntersectCount (const FcCharLeaf *al, const FcCharLeaf *bl)
+{
+    FcChar32	count = 0;
+    int		i;
+
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+	count += FcCharSetPopCount64 (FcCharLeafWord (al, i) & FcCharLeafWord (bl, i));
+    return count;
+}
+
+static FC_LEAF_INLINE FcChar32
+FcCharLeafSubtractCount (const FcCharLeaf *al, const FcCharLeaf *bl)
+{
+    FcChar32	count = 0;
+    int		i;
+
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+	count += FcCharSetPopCount64 (FcCharLeafWord (al, i) & ~FcCharLeafWord (bl, i));
+    return count;
+}
+
+/*
+ * Does al have any bits not in bl?
+ */
+static FC_LEAF_INLINE FcBool
+FcCharLeafIsSubset (const FcCharLeaf *al, const FcCharLeaf *bl)
+{
+    uint64_t	extra = 0;
+    int		i;
+
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+	extra |= FcCharLeafWord (al, i) & ~FcCharLeafWord (bl, i);
+    return extra == 0;
+}
+
+/*
+ * On x86 the set walks are built a second time for CPUs with the
+ * POPCNT instruction, which the baseline ABI does not include; without
+ * it every population count is a libgcc call.  The variant is picked
+ * at run time.  Other targets either have a native population count
+ * in their baseline (the ARM NEON CNT instruction, for instance) or
+ * get the portable code.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ >= 5) && !defined(__POPCNT__)
+#define FC_CHARSET_DISPATCH 1
+#define FC_CHARSET_TARGET_POPCNT	__attribute__((target ("popcnt")))
+
+/*
+ * Setting FC_NO_POPCNT forces the portable variant, so that it can be
+ * tested and timed on machines which have the instruction.
+ */
+static FcBool
+FcCharSetHavePopcnt (void)
+{
+    static int have_popcnt = -1; /* MT-dontcare */
+
+    if (have_popcnt < 0)
+    {
+	const char *env = getenv ("FC_NO_POPCNT");
+
+	if (env && *env && strcmp (env, "0") != 0)
+	    have_popcnt = 0;
+	else
+	    have_popcnt = __builtin_cpu_supports ("popcnt") ? 1 : 0;
+    }
+    return have_popcnt;
+}
+#endif
+
+/*
+ * The walks merge-join the sorted page numbers of the two sets,
+ * stepping over pages present in only one of them.
+ */
+
+static FC_LEAF_INLINE FcChar32
+FcCharSetCountWalk (const FcCharSet *a)
+{
+    FcChar32	count = 0;
+    int		ai;
+
+    for (ai = 0; ai < a->num; ai++)
+	count += FcCharLeafCount (FcCharSetLeaf (a, ai));
+    return count;
+}
+
+static FC_LEAF_INLINE FcChar32
+FcCharSetIntersectCountWalk (const FcCharSet *a, const FcCharSet *b)
+{
+    const FcChar16  *an = FcCharSetNumbers (a);
+    const FcChar16  *bn = FcCharSetNumbers (b);
+    FcChar32	    count = 0;
+    int		    ai = 0, bi = 0;
+
+    while (ai < a->num && bi < b->num)
+    {
+	if (an[ai] < bn[bi])
+	    ai++;
+	else if (bn[bi] < an[ai])
+	    bi++;
+	else
+	{
+	    count += FcCharLeafIntersectCount (FcCharSetLeaf (a, ai),
+					       FcCharSetLeaf (b, bi));
+	    ai++;
+	    bi++;
+	}
+    }
+    return count;
+}
+
+static FC_LEAF_INLINE FcChar32
+FcCharSetSubtractCountWalk (const FcCharSet *a, const FcCharSet *b)
+{
+    const FcChar16  *an = FcCharSetNumbers (a);
+    const FcChar16  *bn = FcCharSetNumbers (b);
+    FcChar32	    count = 0;
+    int		    ai, bi = 0;
+
+    for (ai = 0; ai < a->num; ai++)
+    {
+	const FcCharLeaf    *al = FcCharSetLeaf (a, ai);
+
+	while (bi < b->num && bn[bi] < an[ai])
+	    bi++;
+	if (bi < b->num && bn[bi] == an[ai])
+	    count += FcCharLeafSubtractCount (al, FcCharSetLeaf (b, bi));
+	else
+	    count += FcCharLeafCount (al);
+    }
+    return count;
+}
+
+static FC_LEAF_INLINE FcBool
+FcCharSetIsSubsetWalk (const FcCharSet *a, const FcCharSet *b)
+{
+    const FcChar16  *an = FcCharSetNumbers (a);
+    const FcChar16  *bn = FcCharSetNumbers (b);
+    int		    ai, bi = 0;
+
+    for (ai = 0; ai < a->num; ai++)
+    {
+	const FcCharLeaf    *al = FcCharSetLeaf (a, ai), *bl;
+
+	while (bi < b->num && bn[bi] < an[ai])
+	    bi++;
+	/*
+	 * Does a have any pages not in b?
+	 */
+	if (bi == b->num || bn[bi] != an[ai])
+	    return FcFalse;
+	bl = FcCharSetLeaf (b, bi);
+	if (al != bl && !FcCharLeafIsSubset (al, bl))
+	    return FcFalse;
+	bi++;
+    }
+    return FcTrue;
+}
+
+#ifdef FC_CHARSET_DISPATCH
+static FC_CHARSET_TARGET_POPCNT FcChar32
+FcCharSetCountPopcnt (const FcCharSet *a)
+{
+    return FcCharSetCountWalk (a);
+}
+
+static FC_CHARSET_TARGET_POPCNT FcChar32
+FcCharSetIntersectCountPopcnt (const FcCharSet *a, const FcCharSet *b)
+{
+    return FcCharSetIntersectCountWalk (a, b);
+}
+
+static FC_CHARSET_TARGET_POPCNT FcChar32
+FcCharSetSubtractCountPopcnt (const FcCharSet *a, const FcCharSet *b)
+{
+    return FcCharSetSubtractCountWalk (a, b);
+}
+#endif
+
 static FcCharSet *
 FcCharSetOperate (const FcCharSet   *a,
 		  const FcCharSet   *b,
@@ -416,56 +651,44 @@ FcCharSetOperate (const FcCharSet   *a,
 		  FcBool	bonly)
 {
     FcCharSet	    *fcs;
-    FcCharSetIter   ai, bi;
+    const FcChar16  *an, *bn;
+    int		    ai = 0, bi = 0;
 
     if (!a || !b)
 	goto bail0;
     fcs = FcCharSetCreate ();
     if (!fcs)
 	goto bail0;
-    FcCharSetIterStart (a, &ai);
-    FcCharSetIterStart (b, &bi);
-    while ((ai.leaf || (bonly && bi.leaf)) && (bi.leaf || (aonly && ai.leaf)))
+    an = FcCharSetNumbers (a);
+    bn = FcCharSetNumbers (b);
+    while ((ai < a->num || (bonly && bi < b->num)) &&
+	   (bi < b->num || (aonly && ai < a->num)))
     {
-	if (ai.ucs4 < bi.ucs4)
+	if (bi == b->num || (ai < a->num && an[ai] < bn[bi]))
 	{
-	    if (aonly)
-	    {
-		if (!FcCharSetAddLeaf (fcs, ai.ucs4, ai.leaf))
-		    goto bail1;
-		FcCharSetIterNext (a, &ai);
-	    }
-	    else
-	    {
-		ai.ucs4 = bi.ucs4;
-		FcCharSetIterSet (a, &ai);
-	    }
+	    if (aonly &&
+		!FcCharSetAddLeaf (fcs, (FcChar32) an[ai] << 8, FcCharSetLeaf (a, ai)))
+		goto bail1;
+	    ai++;
 	}
-	else if (bi.ucs4 < ai.ucs4 )
+	else if (ai == a->num || bn[bi] < an[ai])
 	{
-	    if (bonly)
-	    {
-		if (!FcCharSetAddLeaf (fcs, bi.ucs4, bi.leaf))
-		    goto bail1;
-		FcCharSetIterNext (b, &bi);
-	    }
-	    else
-	    {
-		bi.ucs4 = ai.ucs4;
-		FcCharSetIterSet (b, &bi);
-	    }
+	    if (bonly &&
+		!FcCharSetAddLeaf (fcs, (FcChar32) bn[bi] << 8, FcCharSetLeaf (b, bi)))
+		goto bail1;
+	    bi++;
 	}
 	else
 	{
 	    FcCharLeaf  leaf;
 
-	    if ((*overlap) (&leaf, ai.leaf, bi.leaf))
+	    if ((*overlap) (&leaf, FcCharSetLeaf (a, ai), FcCharSetLeaf (b, bi)))
 	    {
-		if (!FcCharSetAddLeaf (fcs, ai.ucs4, &leaf))
+		if (!FcCharSetAddLeaf (fcs, (FcChar32) an[ai] << 8, &leaf))
 		    goto bail1;
 	    }
-	    FcCharSetIterNext (a, &ai);
-	    FcCharSetIterNext (b, &bi);
+	    ai++;
+	    bi++;
 	}
     }
     return fcs;
@@ -480,13 +703,17 @@ FcCharSetIntersectLeaf (FcCharLeaf *result,
 			const FcCharLeaf *al,
 			const FcCharLeaf *bl)
 {
-    int	    i;
-    FcBool  nonempty = FcFalse;
+    uint64_t	nonempty = 0;
+    int		i;
 
-    for (i = 0; i < 256/32; i++)
-	if ((result->map[i] = al->map[i] & bl->map[i]))
-	    nonempty = FcTrue;
-    return nonempty;
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+    {
+	uint64_t    w = FcCharLeafWord (al, i) & FcCharLeafWord (bl, i);
+
+	FcCharLeafSetWord (result, i, w);
+	nonempty |= w;
+    }
+    return nonempty != 0;
 }
 
 FcCharSet *
@@ -502,8 +729,8 @@ FcCharSetUnionLeaf (FcCharLeaf *result,
 {
     int	i;
 
-    for (i = 0; i < 256/32; i++)
-	result->map[i] = al->map[i] | bl->map[i];
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+	FcCharLeafSetWord (result, i, FcCharLeafWord (al, i) | FcCharLeafWord (bl, i));
     return FcTrue;
 }
 
@@ -540,11 +767,7 @@ FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed)
 	bn = FcCharSetNumbers(b)[bi];
 
 	if (an < bn)
-	{
-	    ai = FcCharSetFindLeafForward (a, ai + 1, bn);
-	    if (ai < 0)
-		ai = -ai - 1;
-	}
+	    ai++;
 	else
 	{
 	    FcCharLeaf *bl = FcCharSetLeaf(b, bi);
@@ -572,13 +795,17 @@ FcCharSetSubtractLeaf (FcCharLeaf *result,
 		       const FcCharLeaf *al,
 		       const FcCharLeaf *bl)
 {
-    int	    i;
-    FcBool  nonempty = FcFalse;
+    uint64_t	nonempty = 0;
+    int		i;
 
-    for (i = 0; i < 256/32; i++)
-	if ((result->map[i] = al->map[i] & ~bl->map[i]))
-	    nonempty = FcTrue;
-    return nonempty;
+    for (i = 0; i < FC_LEAF_WORDS; i++)
+    {
+	uint64_t    w = FcCharLeafWord (al, i) & ~FcCharLeafWord (bl, i);
+
+	FcCharLeafSetWord (result, i, w);
+	nonempty |= w;
+    }
+    return nonempty != 0;
 }
 
 FcCharSet *
@@ -600,112 +827,110 @@ FcCharSetHasChar (const FcCharSet *fcs, FcChar32 ucs4)
     return (leaf->map[(ucs4 & 0xff) >> 5] & (1U << (ucs4 & 0x1f))) != 0;
 }
 
-static FcChar32
-FcCharSetPopCount (FcChar32 c1)
+/*
+ * Set table[page] to the position + 1 of each leaf in the Basic
+ * Multilingual Plane, leaving 0 for absent pages
+ */
+static void
+FcCharSetBmpTable (const FcCharSet *fcs, FcChar16 table[256])
 {
-#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
-    return __builtin_popcount (c1);
-#else
-    /* hackmem 169 */
-    FcChar32	c2 = (c1 >> 1) & 033333333333;
-    c2 = c1 - c2 - ((c2 >> 1) & 033333333333);
-    return (((c2 + (c2 >> 3)) & 030707070707) % 077);
-#endif
+    const FcChar16  *numbers = FcCharSetNumbers (fcs);
+    int		    i;
+
+    memset (table, '\0', 256 * sizeof (FcChar16));
+    for (i = 0; i < fcs->num && numbers[i] < 256; i++)
+	table[numbers[i]] = i + 1;
 }
 
-FcChar32
-FcCharSetIntersectCount (const FcCharSet *a, const FcCharSet *b)
+int
+FcCharSetHasChars (const FcCharSet  *fcs,
+		   const FcChar32   *ucs4,
+		   int		    n,
+		   FcChar32	    *coverage)
 {
-    FcCharSetIter   ai, bi;
-    FcChar32	    count = 0;
+    FcChar16	    bmp[256];
+    int		    switches = 0;
+    const FcCharLeaf *leaf = NULL;
+    FcChar32	    page = ~0;
+    int		    first = n, i;
 
-    if (a && b)
+    if (n < 0)
+	return 0;
+    if (coverage)
+	memset (coverage, '\0', ((n + 31) >> 5) * sizeof (FcChar32));
+    for (i = 0; i < n; i++)
     {
-	FcCharSetIterStart (a, &ai);
-	FcCharSetIterStart (b, &bi);
-	while (ai.leaf && bi.leaf)
+	FcChar32    c = ucs4[i];
+
+	/*
+	 * Runs mostly stay on one page.  Once they move between
+	 * BMP pages a direct table beats searching on each change.
+	 */
+	if ((c >> 8) != page)
 	{
-	    if (ai.ucs4 == bi.ucs4)
-	    {
-		FcChar32	*am = ai.leaf->map;
-		FcChar32	*bm = bi.leaf->map;
-		int		i = 256/32;
-		while (i--)
-		    count += FcCharSetPopCount (*am++ & *bm++);
-		FcCharSetIterNext (a, &ai);
-	    }
-	    else if (ai.ucs4 < bi.ucs4)
+	    page = c >> 8;
+	    leaf = NULL;
+	    if (!fcs)
+		;
+	    else if (page < 256 && ++switches > 1)
 	    {
-		ai.ucs4 = bi.ucs4;
-		FcCharSetIterSet (a, &ai);
-	    }
-	    if (bi.ucs4 < ai.ucs4)
-	    {
-		bi.ucs4 = ai.ucs4;
-		FcCharSetIterSet (b, &bi);
+		if (switches == 2)
+		    FcCharSetBmpTable (fcs, bmp);
+		if (bmp[page])
+		    leaf = FcCharSetLeaf (fcs, bmp[page] - 1);
 	    }
+	    else
+		leaf = FcCharSetFindLeaf (fcs, c);
+	}
+	if (leaf && (leaf->map[(c & 0xff) >> 5] & (1U << (c & 0x1f))))
+	{
+	    if (coverage)
+		coverage[i >> 5] |= 1U << (i & 0x1f);
+	}
+	else if (first == n)
+	{
+	    first = i;
+	    if (!coverage)
+		break;
 	}
     }
-    return count;
+    return first;
 }
 
 FcChar32
-FcCharSetCount (const FcCharSet *a)
+FcCharSetIntersectCount (const FcCharSet *a, const FcCharSet *b)
 {
-    FcCharSetIter   ai;
-    FcChar32	    count = 0;
-
-    if (a)
-    {
-	for (FcCharSetIterStart (a, &ai); ai.leaf; FcCharSetIterNext (a, &ai))
-	{
-	    int		    i = 256/32;
-	    FcChar32	    *am = ai.leaf->map;
+    if (!a || !b)
+	return 0;
+#ifdef FC_CHARSET_DISPATCH
+    if (FcCharSetHavePopcnt ())
+	return FcCharSetIntersectCountPopcnt (a, b);
+#endif
+    return FcCharSetIntersectCountWalk (a, b);
+}
 
-	    while (i--)
-		count += FcCharSetPopCount (*am++);
-	}
-    }
-    return count;
+FcChar32
+FcCharSetCount (const FcCharSet *a)
+{
+    if (!a)
+	return 0;
+#ifdef FC_CHARSET_DISPATCH
+    if (FcCharSetHavePopcnt ())
+	return FcCharSetCountPopcnt (a);
+#endif
+    return FcCharSetCountWalk (a);
 }
 
 FcChar32
 FcCharSetSubtractCount (const FcCharSet *a, const FcCharSet *b)
 {
-    FcCharSetIter   ai, bi;
-    FcChar32	    count = 0;
-
-    if (a && b)
-    {
-	FcCharSetIterStart (a, &ai);
-	FcCharSetIterStart (b, &bi);
-	while (ai.leaf)
-	{
-	    if (ai.ucs4 <= bi.ucs4)
-	    {
-		FcChar32	*am = ai.leaf->map;
-		int		i = 256/32;
-		if (ai.ucs4 == bi.ucs4)
-		{
-		    FcChar32	*bm = bi.leaf->map;
-		    while (i--)
-			count += FcCharSetPopCount (*am++ & ~*bm++);
-		}
-		else
-		{
-		    while (i--)
-			count += FcCharSetPopCount (*am++);
-		}
-		FcCharSetIterNext (a, &ai);
-	    }
-	    else if (bi.leaf)
-	    {
-		bi.ucs4 = ai.ucs4;
-		FcCharSetIterSet (b, &bi);
-	    }
-	}
-    }
-    return count;
+    if (!a || !b)
+	return 0;
+#ifdef FC_CHARSET_DISPATCH
+    if (FcCharSetHavePopcnt ())
+	return FcCharSetSubtractCountPopcnt (a, b);
+#endif
+    return FcCharSetSubtractCountWalk (a, b);
 }
 
 /*
@@ -714,56 +939,11 @@ FcCharSetSubtractCount (const FcCharSet *a, const FcCharSet *b)
 FcBool
 FcCharSetIsSubset (const FcCharSet *a, const FcCharSet *b)
 {
-    int		ai, bi;
-    FcChar16	an, bn;
-
     if (a == b)
 	return FcTrue;
     if (!a || !b)
 	return FcFalse;
-    bi = 0;
-    ai = 0;
-    while (ai < a->num && bi < b->num)
-    {
-	an = FcCharSetNumbers(a)[ai];
-	bn = FcCharSetNumbers(b)[bi];
-	/*
-	 * Check matching pages
-	 */
-	if (an == bn)
-	{
-	    FcChar32	*am = FcCharSetLeaf(a, ai)->map;
-	    FcChar32	*bm = FcCharSetLeaf(b, bi)->map;
-	
-	    if (am != bm)
-	    {
-		int	i = 256/32;
-		/*
-		 * Does am have any bits not in bm?
-		 */
-		while (i--)
-		    if (*am++ & ~*bm++)
-			return FcFalse;
-	    }
-	    ai++;
-	    bi++;
-	}
-	/*
-	 * Does a have any pages not in b?
-	 */
-	else if (an < bn)
-	    return FcFalse;
-	else
-	{
-	    bi = FcCharSetFindLeafForward (b, bi + 1, an);
-	    if (bi < 0)
-		bi = -bi - 1;
-	}
-    }
-    /*
-     * did we look at every page?
-     */
-    return ai >= a->num;
+    return FcCharSetIsSubsetWalk (a, b);
 }
 
 /*
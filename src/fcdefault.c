@@ -116,6 +116,61 @@ retry:
     return lang;
 }
 
+static FcDefaultLangs *default_lang_sets; /* MT-safe */
+
+static void
+FcDefaultLangsDestroy (FcDefaultLangs *d)
+{
+    int i;
+
+    if (d->und)
+	FcLangSetDestroy (d->und);
+    for (i = 0; i < d->langs->num && d->sets[i]; i++)
+	FcLangSetDestroy (d->sets[i]);
+    free (d);
+}
+
+const FcDefaultLangs *
+FcGetDefaultLangSets (void)
+{
+    FcDefaultLangs *d;
+    FcStrSet *langs;
+    int i;
+retry:
+    d = fc_atomic_ptr_get (&default_lang_sets);
+    if (!d)
+    {
+	langs = FcGetDefaultLangs ();
+	if (!langs)
+	    return NULL;
+	d = calloc (1, sizeof (FcDefaultLangs) + langs->num * sizeof (FcLangSet *));
+	if (!d)
+	    return NULL;
+	d->langs = langs;
+	d->sets = (FcLangSet **) (d + 1);
+	d->und = FcLangSetCreate ();
+	if (!d->und || !FcLangSetAdd (d->und, (const FcChar8 *) "und"))
+	    goto bail;
+	for (i = 0; i < langs->num; i++)
+	{
+	    d->sets[i] = FcLangSetCreate ();
+	    if (!d->sets[i] || !FcLangSetAdd (d->sets[i], langs->strs[i]))
+		goto bail;
+	}
+
+	if (!fc_atomic_ptr_cmpexch (&default_lang_sets, NULL, d)) {
+	    FcDefaultLangsDestroy (d);
+	    goto retry;
+	}
+    }
+
+    return d;
+
+bail:
+    FcDefaultLangsDestroy (d);
+    return NULL;
+}
+
 static FcChar8 *default_prgname;
 
 FcChar8 *
@@ -261,6 +316,7 @@ FcDefaultFini (void)
 {
     FcChar8  *lang;
     FcStrSet *langs;
+    FcDefaultLangs *lang_sets;
     FcChar8  *prgname;
     FcChar8  *desktop;
 
@@ -270,6 +326,12 @@ FcDefaultFini (void)
 	free (lang);
     }
 
+    lang_sets = fc_atomic_ptr_get (&default_lang_sets);
+    if (lang_sets && fc_atomic_ptr_cmpexch (&default_lang_sets, lang_sets, NULL))
+    {
+	FcDefaultLangsDestroy (lang_sets);
+    }
+
     langs = fc_atomic_ptr_get (&default_langs);
     if (langs && fc_atomic_ptr_cmpexch (&default_langs, langs, NULL))
     {
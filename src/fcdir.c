@@ -27,6 +27,9 @@
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
 #endif
+#if defined(HAVE_PTHREAD) && !defined(FC_NO_MT)
+#include <pthread.h>
+#endif
 
 FcBool
 FcFileIsDir (const FcChar8 *file)
@@ -191,6 +194,151 @@ cmpstringp(const void *p1, const void *p2)
     return strcmp(* (char **) p1, * (char **) p2);
 }
 
+static void
+FcDirScanFiles (FcFontSet	*set,
+		FcStrSet	*dirs,
+		FcStrSet	*files,
+		int		first,
+		int		last,
+		FcConfig	*config)
+{
+    int	i;
+
+    for (i = first; i < last; i++)
+	FcFileScanConfig (set, dirs, files->strs[i], config);
+}
+
+#if defined(HAVE_PTHREAD) && !defined(FC_NO_MT)
+
+#define FC_SCAN_MAX_THREADS		64
+#define FC_SCAN_MIN_FILES_PER_THREAD	16
+
+typedef struct _FcDirScanJob {
+    FcFontSet	*set;
+    FcStrSet	*dirs;
+    FcStrSet	*files;
+    int		first;
+    int		last;
+    FcConfig	*config;
+} FcDirScanJob;
+
+static void *
+FcDirScanThread (void *arg)
+{
+    FcDirScanJob *job = arg;
+
+    FcDirScanFiles (job->set, job->dirs, job->files, job->first, job->last, job->config);
+
+    return NULL;
+}
+
+/*
+ * The number of threads a directory may be scanned with, from
+ * FC_SCAN_THREADS; each thread opens its own files with FreeType.
+ */
+static int
+FcScanThreads (void)
+{
+    const char	*env = getenv ("FC_SCAN_THREADS");
+    long	n;
+
+    if (!env)
+	return 1;
+    n = strtol (env, NULL, 10);
+    if (n < 1)
+	return 1;
+
+    return n > FC_SCAN_MAX_THREADS ? FC_SCAN_MAX_THREADS : n;
+}
+
+/*
+ * Split the sorted file list into contiguous ranges, scan each into a
+ * set of its own and append the results in range order, so that the
+ * cache comes out the same as from a serial scan.
+ */
+static void
+FcDirScanFilesParallel (FcFontSet	*set,
+			FcStrSet	*dirs,
+			FcStrSet	*files,
+			FcConfig	*config)
+{
+    FcDirScanJob    jobs[FC_SCAN_MAX_THREADS];
+    pthread_t	    threads[FC_SCAN_MAX_THREADS];
+    FcBool	    started[FC_SCAN_MAX_THREADS];
+    int		    nthread, i, j, start;
+
+    nthread = FcScanThreads ();
+    if (nthread > files->num / FC_SCAN_MIN_FILES_PER_THREAD)
+	nthread = files->num / FC_SCAN_MIN_FILES_PER_THREAD;
+    /* Debugging output has to come out in order */
+    if (nthread < 2 || (FcDebug () & (FC_DBG_SCAN | FC_DBG_SCANV)))
+    {
+	FcDirScanFiles (set, dirs, files, 0, files->num, config);
+	return;
+    }
+
+    for (i = 0, start = 0; i < nthread; i++)
+    {
+	int end = (int) ((long) files->num * (i + 1) / nthread);
+
+	jobs[i].set = NULL;
+	jobs[i].dirs = NULL;
+	if (set && !(jobs[i].set = FcFontSetCreate ()))
+	    break;
+	if (dirs && !(jobs[i].dirs = FcStrSetCreate ()))
+	{
+	    if (jobs[i].set)
+		FcFontSetDestroy (jobs[i].set);
+	    break;
+	}
+	jobs[i].files = files;
+	jobs[i].first = start;
+	jobs[i].last = end;
+	jobs[i].config = config;
+	start = end;
+    }
+    /* Whatever could not be set up is scanned serially afterwards */
+    nthread = i;
+
+    for (i = 1; i < nthread; i++)
+	started[i] = pthread_create (&threads[i], NULL, FcDirScanThread, &jobs[i]) == 0;
+    if (nthread > 0)
+	FcDirScanThread (&jobs[0]);
+    for (i = 1; i < nthread; i++)
+    {
+	if (started[i])
+	    pthread_join (threads[i], NULL);
+	else
+	    FcDirScanThread (&jobs[i]);
+    }
+
+    for (i = 0; i < nthread; i++)
+    {
+	if (jobs[i].set)
+	{
+	    for (j = 0; j < jobs[i].set->nfont; j++)
+		if (!set || !FcFontSetAdd (set, jobs[i].set->fonts[j]))
+		    FcPatternDestroy (jobs[i].set->fonts[j]);
+	    jobs[i].set->nfont = 0;
+	    FcFontSetDestroy (jobs[i].set);
+	}
+	if (jobs[i].dirs)
+	{
+	    for (j = 0; j < jobs[i].dirs->num; j++)
+		FcStrSetAdd (dirs, jobs[i].dirs->strs[j]);
+	    FcStrSetDestroy (jobs[i].dirs);
+	}
+    }
+    FcDirScanFiles (set, dirs, files, start, files->num, config);
+}
+
+#else
+
+#define FcDirScanFilesParallel(set, dirs, files, config) \
+    FcDirScanFiles (set, dirs, files, 0, (files)->num, config)
+
+#endif
+
 FcBool
 FcDirScanConfig (FcFontSet	*set,
 		 FcStrSet	*dirs,
@@ -205,7 +353,6 @@ FcDirScanConfig (FcFontSet	*set,
     FcChar8		*base;
     const FcChar8	*sysroot = FcConfigGetSysRoot (config);
     FcBool		ret = FcTrue;
-    int			i;
 
     if (!force)
 	return FcFalse;
@@ -270,8 +417,7 @@ FcDirScanConfig (FcFontSet	*set,
     /*
      * Scan file files to build font patterns
      */
-    for (i = 0; i < files->num; i++)
-	FcFileScanConfig (set, dirs, files->strs[i], config);
+    FcDirScanFilesParallel (set, dirs, files, config);
 
 bail2:
     FcStrSetDestroy (files);
@@ -24,6 +24,9 @@
 
 #include "fcint.h"
 #include <stdlib.h>
+#if defined(HAVE_PTHREAD) && !defined(FC_NO_MT)
+#include <pthread.h>
+#endif
 
 #if defined(FC_ATOMIC_INT_NIL)
 #pragma message("Could not find any system to define atomic_int macros, library may NOT be thread-safe.")
@@ -77,6 +80,8 @@ FcGetVersion (void)
 FcConfig *
 FcInitLoadOwnConfig (FcConfig *config)
 {
+    FcChar8 *key;
+
     if (!config)
     {
 	config = FcConfigCreate ();
@@ -86,16 +91,26 @@ FcInitLoadOwnConfig (FcConfig *config)
 
     FcInitDebug ();
 
-    if (!FcConfigParseAndLoad (config, 0, FcTrue))
+    key = FcConfigCompiledKey (config);
+    if (!key || !FcConfigLoadCompiled (config, key))
     {
-	const FcChar8 *sysroot = FcConfigGetSysRoot (config);
-	FcConfig *fallback = FcInitFallbackConfig (sysroot);
+	if (!FcConfigParseAndLoad (config, 0, FcTrue))
+	{
+	    const FcChar8 *sysroot = FcConfigGetSysRoot (config);
+	    FcConfig *fallback = FcInitFallbackConfig (sysroot);
 
-	FcConfigDestroy (config);
+	    if (key)
+		FcStrFree (key);
+	    FcConfigDestroy (config);
 
-	return fallback;
+	    return fallback;
+	}
+	(void) FcConfigParseOnly (config, (const FcChar8 *)FC_TEMPLATEDIR, FcFalse);
+	if (key)
+	    (void) FcConfigWriteCompiled (config, key, FcFalse);
     }
-    (void) FcConfigParseOnly (config, (const FcChar8 *)FC_TEMPLATEDIR, FcFalse);
+    if (key)
+	FcStrFree (key);
 
     if (config->cacheDirs && config->cacheDirs->num == 0)
     {
@@ -155,6 +170,37 @@ FcInitLoadOwnConfig (FcConfig *config)
     return config;
 }
 
+FcBool
+FcConfigWriteCompiledConfig (FcConfig *config)
+{
+    FcConfig	*fresh;
+    FcChar8	*key = NULL;
+    FcBool	ret = FcFalse;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    /* Parse the files again rather than save what config has been added to */
+    fresh = FcConfigCreate ();
+    if (!fresh)
+	goto bail;
+    if (config->sysRoot)
+	FcConfigSetSysRoot (fresh, config->sysRoot);
+    key = FcConfigCompiledKey (fresh);
+    if (!key || !FcConfigParseAndLoad (fresh, 0, FcTrue))
+	goto bail;
+    (void) FcConfigParseOnly (fresh, (const FcChar8 *)FC_TEMPLATEDIR, FcFalse);
+    ret = FcConfigWriteCompiled (fresh, key, FcTrue);
+bail:
+    if (key)
+	FcStrFree (key);
+    if (fresh)
+	FcConfigDestroy (fresh);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
 FcConfig *
 FcInitLoadConfig (void)
 {
@@ -199,6 +245,7 @@ FcInit (void)
 void
 FcFini (void)
 {
+    FcInitReloadFini ();
     FcConfigFini ();
     FcConfigPathFini ();
     FcDefaultFini ();
@@ -259,6 +306,102 @@ bail:
     return ret;
 }
 
+#if defined(HAVE_PTHREAD) && !defined(FC_NO_MT)
+
+static pthread_mutex_t	reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t	reload_thread;	    /* protected by reload_lock */
+static FcBool		reload_started;	    /* protected by reload_lock */
+static FcBool		reload_done;	    /* protected by reload_lock */
+
+static void *
+FcInitReloadThread (void *arg)
+{
+    FcConfig	*config = arg, *new_config;
+
+    if (!FcConfigUptoDate (config))
+    {
+	new_config = FcInitLoadConfigAndFonts ();
+	if (new_config)
+	{
+	    FcConfigReplaceCurrent (config, new_config);
+	    FcConfigDestroy (new_config);
+	}
+    }
+    FcConfigDestroy (config);
+
+    pthread_mutex_lock (&reload_lock);
+    reload_done = FcTrue;
+    pthread_mutex_unlock (&reload_lock);
+
+    return NULL;
+}
+
+FcBool
+FcInitBringUptoDateAsync (void)
+{
+    FcConfig	*config = FcConfigReference (NULL);
+    FcBool	ret = FcTrue;
+
+    if (!config)
+	return FcFalse;
+    if (config->rescanInterval == 0 ||
+	config->rescanTime + config->rescanInterval - time (0) > 0)
+    {
+	FcConfigDestroy (config);
+	return FcTrue;
+    }
+
+    pthread_mutex_lock (&reload_lock);
+    if (reload_started && !reload_done)
+    {
+	/* A check is already under way */
+	pthread_mutex_unlock (&reload_lock);
+	FcConfigDestroy (config);
+	return FcTrue;
+    }
+    if (reload_started)
+	pthread_join (reload_thread, NULL);
+    reload_done = FcFalse;
+    /* The thread owns the reference to config */
+    reload_started = pthread_create (&reload_thread, NULL, FcInitReloadThread, config) == 0;
+    if (!reload_started)
+    {
+	FcConfigDestroy (config);
+	ret = FcFalse;
+    }
+    pthread_mutex_unlock (&reload_lock);
+
+    return ret;
+}
+
+void
+FcInitReloadFini (void)
+{
+    FcBool  started;
+
+    pthread_mutex_lock (&reload_lock);
+    started = reload_started;
+    reload_started = FcFalse;
+    pthread_mutex_unlock (&reload_lock);
+    if (started)
+	pthread_join (reload_thread, NULL);
+}
+
+#else
+
+FcBool
+FcInitBringUptoDateAsync (void)
+{
+    return FcInitBringUptoDate ();
+}
+
+void
+FcInitReloadFini (void)
+{
+}
+
+#endif
+
 #define __fcinit__
 #include "fcaliastail.h"
 #undef __fcinit__
@@ -408,6 +408,24 @@ typedef struct _FcStrBuf {
 
 typedef struct _FcHashTable	FcHashTable;
 
+typedef struct _FcFamilyIndex	FcFamilyIndex;
+
+typedef struct _FcMatchCache	FcMatchCache;
+
+typedef struct _FcScoreTable	FcScoreTable;
+
+typedef struct _FcCoverageIndex	FcCoverageIndex;
+
+typedef struct _FcWatch	FcWatch;
+
+typedef struct _FcSubstProgram	FcSubstProgram;
+
+typedef struct _FcFontSources	FcFontSources;
+
+typedef struct _FcGlobMatcher	FcGlobMatcher;
+
+typedef struct _FcSelectorIndex	FcSelectorIndex;
+
 typedef FcChar32 (* FcHashFunc)	   (const FcChar8 *data);
 typedef int	 (* FcCompareFunc) (const FcChar8 *v1, const FcChar8 *v2);
 typedef FcBool	 (* FcCopyFunc)	   (const void *src, void **dest);
@@ -555,8 +573,12 @@ struct _FcConfig {
      */
     FcStrSet	*acceptGlobs;
     FcStrSet	*rejectGlobs;
+    FcGlobMatcher *acceptGlobMatcher;	/* acceptGlobs by literal prefix, built on first use */
+    FcGlobMatcher *rejectGlobMatcher;	/* likewise for rejectGlobs */
     FcFontSet	*acceptPatterns;
     FcFontSet	*rejectPatterns;
+    FcSelectorIndex *acceptPatternIndex; /* acceptPatterns by a string they require, built on first use */
+    FcSelectorIndex *rejectPatternIndex; /* likewise for rejectPatterns */
     /*
      * The set of fonts loaded from the listed directories; the
      * order within the set does not determine the font selection,
@@ -579,9 +601,33 @@ struct _FcConfig {
 
     FcChar8     *sysRoot;	    /* override the system root directory */
     FcStrSet	*availConfigFiles;  /* config files available */
+    FcStrSet	*missingConfigFiles; /* optional config files that weren't found */
+    FcBool	uncompilable;	    /* parsing depended on more than the files */
     FcPtrList	*rulesetList;	    /* List of rulesets being installed */
+
+    FcFamilyIndex *familyIndex;	    /* fonts by family, built on first match */
+    FcMatchCache  *matchCache;	    /* remembered match and sort results */
+    FcScoreTable  *scoreTable;	    /* per-font numeric properties, built on first match */
+    FcCoverageIndex *coverageIndex; /* fonts by Unicode page, built on first use */
+    FcSubstProgram *substProgram[FcMatchKindEnd]; /* rules by what they test, built on first use */
+    FcChar8	  *fontDatabaseKey; /* identifies the font database for this configuration */
+    FcFontSources *fontSources;	    /* caches the system fonts were taken from */
+    int		watchFd;	    /* inotify descriptor watching the files, or -1 */
+    FcBool	watchDirty;	    /* watchFd has reported a change */
+    FcWatch	*watches;	    /* what each watch on watchFd is for */
+    int		nwatches;
 };
 
+/*
+ * The preferred languages with each one already turned into a
+ * language set, so substitution needn't redo it every time.
+ */
+typedef struct _FcDefaultLangs {
+    FcStrSet	*langs;		    /* FcGetDefaultLangs () */
+    FcLangSet	*und;		    /* "und", which stops the defaults */
+    FcLangSet	**sets;		    /* langs->strs[i] as a language set */
+} FcDefaultLangs;
+
 typedef struct _FcFileTime {
     time_t  time;
     FcBool  set;
@@ -618,9 +664,32 @@ FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcSt
 FcPrivate FcCache *
 FcDirCacheRebuild (FcCache *cache, struct stat *dir_stat, FcStrSet *dirs);
 
+FcPrivate FcBool
+FcCacheTimeValid (FcConfig *config, FcCache *cache, struct stat *dir_stat);
+
+FcPrivate FcBool
+FcDirCacheFileCurrent (FcConfig *config, FcCache *cache);
+
 FcPrivate FcBool
 FcDirCacheWrite (FcCache *cache, FcConfig *config);
 
+FcPrivate int64_t
+FcFontDatabaseChecksum (FcConfig *config, FcStrSet *dirs);
+
+FcPrivate FcCache *
+FcFontDatabaseLoad (FcConfig *config, const FcChar8 *key);
+
+FcPrivate FcBool
+FcFontDatabaseWrite (FcConfig *config, const FcChar8 *key, FcFontSet *set, FcStrSet *dirs, int64_t checksum);
+
+FcPrivate FcBool
+FcCompiledConfigProcess (FcConfig *config, const FcChar8 *key,
+			 FcBool (*callback) (FcConfig *config, const FcChar8 *data, size_t size, void *closure),
+			 void *closure);
+
+FcPrivate FcBool
+FcCompiledConfigWrite (FcConfig *config, const FcChar8 *key, const FcChar8 *data, int size, FcBool system);
+
 FcPrivate FcBool
 FcDirCacheCreateTagFile (const FcChar8 *cache_dir);
 
@@ -655,6 +724,9 @@ FcConfigInit (void);
 FcPrivate void
 FcConfigFini (void);
 
+FcPrivate FcBool
+FcConfigReplaceCurrent (FcConfig *old, FcConfig *config);
+
 FcPrivate FcChar8 *
 FcConfigXdgCacheHome (void);
 
@@ -718,6 +790,12 @@ FcConfigCompareValue (const FcValue *m,
 		      unsigned int   op_,
 		      const FcValue *v);
 
+FcPrivate FcValue
+FcConfigEvaluate (FcPattern	*p,
+		  FcPattern	*p_pat,
+		  FcMatchKind	kind,
+		  FcExpr	*e);
+
 FcPrivate FcBool
 FcConfigGlobAdd (FcConfig	*config,
 		 const FcChar8	*glob,
@@ -737,7 +815,7 @@ FcConfigModifiedTime (FcConfig *config);
 
 FcPrivate FcBool
 FcConfigAddCache (FcConfig *config, FcCache *cache,
-		  FcSetName set, FcStrSet *dirSet, FcChar8 *forDir);
+		  FcFontSet *fonts, FcStrSet *dirSet, FcChar8 *forDir);
 
 FcPrivate FcRuleSet *
 FcRuleSetCreate (const FcChar8 *name);
@@ -901,6 +979,9 @@ FcInitDebug (void);
 FcPrivate FcChar8 *
 FcGetDefaultLang (void);
 
+FcPrivate const FcDefaultLangs *
+FcGetDefaultLangSets (void);
+
 FcPrivate FcChar8 *
 FcGetPrgname (void);
 
@@ -989,6 +1070,9 @@ FcInitLoadOwnConfig (FcConfig *config);
 FcPrivate FcConfig *
 FcInitLoadOwnConfigAndFonts (FcConfig *config);
 
+FcPrivate void
+FcInitReloadFini (void);
+
 /* fcxml.c */
 FcPrivate void
 FcConfigPathFini (void);
@@ -1002,6 +1086,18 @@ FcEditDestroy (FcEdit *e);
 void
 FcRuleDestroy (FcRule *rule);
 
+FcPrivate FcChar8 *
+FcConfigCompiledKey (FcConfig *config);
+
+FcPrivate FcBool
+FcConfigLoadCompiled (FcConfig *config, const FcChar8 *key);
+
+FcPrivate FcBool
+FcConfigWriteCompiled (FcConfig *config, const FcChar8 *key, FcBool system);
+
+FcPrivate FcBool
+FcConfigCompiledCurrent (FcConfig *config, const FcChar8 *data, size_t size, void *closure);
+
 /* fclang.c */
 FcPrivate FcLangSet *
 FcFreeTypeLangSet (const FcCharSet  *charset,
@@ -1027,6 +1123,18 @@ FcConfigParseOnly (FcConfig		*config,
 		   const FcChar8	*name,
 		   FcBool		complain);
 
+FcPrivate void
+FcConfigRulesChanged (FcConfig *config);
+
+FcPrivate void
+FcSubstProgramDestroy (FcSubstProgram *program);
+
+FcPrivate void
+FcGlobMatcherDestroy (FcGlobMatcher *matcher);
+
+FcPrivate void
+FcSelectorIndexDestroy (FcSelectorIndex *index);
+
 FcPrivate FcChar8 *
 FcConfigRealFilename (FcConfig		*config,
 		      const FcChar8	*url);
@@ -1039,6 +1147,21 @@ FcListPatternMatchAny (const FcPattern *p,
 
 /* fcmatch.c */
 
+FcPrivate void
+FcFamilyIndexDestroy (FcFamilyIndex *index);
+
+FcPrivate void
+FcMatchCacheFlush (FcMatchCache *cache);
+
+FcPrivate void
+FcMatchCacheDestroy (FcMatchCache *cache);
+
+FcPrivate void
+FcScoreTableDestroy (FcScoreTable *table);
+
+FcPrivate void
+FcCoverageIndexDestroy (FcCoverageIndex *index);
+
 /* fcname.c */
 
 enum {
@@ -37,6 +37,11 @@ typedef struct {
     int end;
 } FcLangCharSetRange;
 
+typedef struct {
+    FcChar16	lang;
+    FcChar16	leaf;
+} FcLangPageLeaf;
+
 #include "../fc-lang/fclang.h"
 
 struct _FcLangSet {
@@ -90,12 +95,68 @@ FcLangSetBitReset (FcLangSet    *ls,
   ls->map[bucket] &= ~((FcChar32) 1U << (id & 0x1f));
 }
 
+/*
+ * Find the languages with characters missing from charset.  Rather
+ * than subtracting each language charset in turn, the pages used by
+ * any language are walked alongside those of charset once, checking
+ * every language leaf on each page.
+ */
+static void
+FcLangCharSetsMissing (const FcCharSet	*charset,
+		       FcBool		missing[NUM_LANG_CHAR_SET])
+{
+    const FcChar16  *numbers;
+    int		    p, e, ci = 0;
+
+    memset (missing, '\0', NUM_LANG_CHAR_SET * sizeof (FcBool));
+    if (!charset)
+	return;
+    numbers = FcCharSetNumbers (charset);
+    for (p = 0; p < NUM_LANG_PAGE; p++)
+    {
+	const FcCharLeaf    *leaf;
+	FcChar32	    extra = 0;
+	int		    last = -1;
+
+	while (ci < charset->num && numbers[ci] < fcLangPages[p])
+	    ci++;
+	if (ci == charset->num || numbers[ci] != fcLangPages[p])
+	{
+	    for (e = fcLangPageStart[p]; e < fcLangPageStart[p + 1]; e++)
+		missing[fcLangPageLeaves[e].lang] = FcTrue;
+	    continue;
+	}
+	leaf = FcCharSetLeaf (charset, ci);
+	/*
+	 * Languages sharing a leaf are listed together, so each distinct
+	 * leaf is checked once.  Each language appears at most once per page.
+	 */
+	for (e = fcLangPageStart[p]; e < fcLangPageStart[p + 1]; e++)
+	{
+	    const FcLangPageLeaf    *pl = &fcLangPageLeaves[e];
+
+	    if (pl->leaf != last)
+	    {
+		const FcCharLeaf    *ll = &fcLangData.leaves[pl->leaf];
+		int		    k;
+
+		extra = 0;
+		for (k = 0; k < 256/32; k++)
+		    extra |= ll->map[k] & ~leaf->map[k];
+		last = pl->leaf;
+	    }
+	    missing[pl->lang] |= extra != 0;
+	}
+    }
+}
+
 FcLangSet *
 FcFreeTypeLangSet (const FcCharSet  *charset,
 		   const FcChar8    *exclusiveLang)
 {
     int		    i, j;
     FcChar32	    missing;
+    FcBool	    missingLangs[NUM_LANG_CHAR_SET];
     const FcCharSet *exclusiveCharset = 0;
     FcLangSet	    *ls;
 
@@ -104,6 +165,7 @@ FcFreeTypeLangSet (const FcCharSet  *charset,
     ls = FcLangSetCreate ();
     if (!ls)
 	return 0;
+    FcLangCharSetsMissing (charset, missingLangs);
     if (FcDebug() & FC_DBG_LANGSET)
     {
 	printf ("font charset");
@@ -135,9 +197,9 @@ FcFreeTypeLangSet (const FcCharSet  *charset,
 		    FcCharSetLeaf(exclusiveCharset, j))
 		    continue;
 	}
-	missing = FcCharSetSubtractCount (&fcLangCharSets[i].charset, charset);
         if (FcDebug() & FC_DBG_SCANV)
 	{
+	    missing = FcCharSetSubtractCount (&fcLangCharSets[i].charset, charset);
 	    if (missing && missing < 10)
 	    {
 		FcCharSet   *missed = FcCharSetSubtract (&fcLangCharSets[i].charset,
@@ -167,6 +229,8 @@ FcFreeTypeLangSet (const FcCharSet  *charset,
 	    else
 		printf ("%s(%u) ", fcLangCharSets[i].lang, missing);
 	}
+	else
+	    missing = missingLangs[i];
 	if (!missing)
 	    FcLangSetBitSet (ls, i);
     }
@@ -23,6 +23,9 @@
  */
 
 #include "fcint.h"
+#if defined(HAVE_PTHREAD) && !defined(FC_NO_MT)
+#include <pthread.h>
+#endif
 
 static double
 FcCompareNumber (const FcValue *value1, const FcValue *value2, FcValue *bestValue)
@@ -488,72 +491,232 @@ done:
     return FcTrue;
 }
 
+/*
+ * The numeric properties most queries ask for, kept in per-font columns
+ * so that they can be scored in tight loops instead of walking each
+ * font's value lists.  A font only gets a column entry for an object
+ * when it has exactly one value of a type the comparison accepts;
+ * everything else is left to FcCompareValueList.
+ */
+typedef enum _FcScoreKind {
+    FcScoreNumber,	/* FcCompareNumber */
+    FcScoreRange,	/* FcCompareRange */
+    FcScoreSize,	/* FcCompareSize */
+    FcScoreBool		/* FcCompareBool */
+} FcScoreKind;
+
+typedef struct _FcScoreColumn {
+    FcObject	object;
+    FcScoreKind	kind;
+    int		pri;
+} FcScoreColumn;
+
+static const FcScoreColumn _FcScoreColumns[] = {
+    { FC_VARIABLE_OBJECT,	FcScoreBool,	PRI_VARIABLE },
+    { FC_SCALABLE_OBJECT,	FcScoreBool,	PRI_SCALABLE },
+    { FC_COLOR_OBJECT,		FcScoreBool,	PRI_COLOR },
+    { FC_SPACING_OBJECT,	FcScoreNumber,	PRI_SPACING },
+    { FC_SIZE_OBJECT,		FcScoreSize,	PRI_SIZE },
+    { FC_SLANT_OBJECT,		FcScoreNumber,	PRI_SLANT },
+    { FC_WEIGHT_OBJECT,		FcScoreRange,	PRI_WEIGHT },
+    { FC_WIDTH_OBJECT,		FcScoreRange,	PRI_WIDTH },
+    { FC_OUTLINE_OBJECT,	FcScoreBool,	PRI_OUTLINE },
+};
+
+#define FC_SCORE_NCOLUMN	(int) (sizeof (_FcScoreColumns) / sizeof (_FcScoreColumns[0]))
+#define FC_SCORE_MAX_VALUES	8
+
+typedef struct _FcScoreQuery {
+    int		mask;		/* columns the pattern can be scored on */
+    int		nvalue[FC_SCORE_NCOLUMN];
+    double	begin[FC_SCORE_NCOLUMN][FC_SCORE_MAX_VALUES];
+    double	end[FC_SCORE_NCOLUMN][FC_SCORE_MAX_VALUES];
+} FcScoreQuery;
+
+static int
+FcScoreColumnBit (FcObject object)
+{
+    int c;
+
+    for (c = 0; c < FC_SCORE_NCOLUMN; c++)
+	if (_FcScoreColumns[c].object == object)
+	    return 1 << c;
+
+    return 0;
+}
+
+/*
+ * Extract the range covered by v, or return FcFalse if the comparison
+ * used for kind would reject it.
+ */
+static FcBool
+FcScoreValue (FcScoreKind kind, const FcValue *v, double *begin, double *end)
+{
+    FcValue value = FcValueCanonicalize (v);
+
+    switch ((int) value.type) {
+    case FcTypeInteger:
+	if (kind == FcScoreBool)
+	    return FcFalse;
+	*begin = *end = value.u.i;
+	return FcTrue;
+    case FcTypeDouble:
+	if (kind == FcScoreBool)
+	    return FcFalse;
+	*begin = *end = value.u.d;
+	return FcTrue;
+    case FcTypeRange:
+	if (kind != FcScoreRange && kind != FcScoreSize)
+	    return FcFalse;
+	*begin = value.u.r->begin;
+	*end = value.u.r->end;
+	return FcTrue;
+    case FcTypeBool:
+	if (kind != FcScoreBool)
+	    return FcFalse;
+	*begin = *end = value.u.b;
+	return FcTrue;
+    default:
+	return FcFalse;
+    }
+}
+
+/* Same results as the FcCompare* function for kind. */
+static inline double
+FcScoreCompare (FcScoreKind kind, double b1, double e1, double b2, double e2)
+{
+    switch (kind) {
+    case FcScoreNumber:
+	return fabs (b2 - b1);
+    case FcScoreRange:
+	if (e1 < b2 || e2 < b1)
+	    return FC_MIN (fabs (b2 - e1), fabs (b1 - e2));
+	return 0.0;
+    case FcScoreSize:
+	if (e1 < b2 || e2 < b1)
+	    return FC_MIN (fabs (b2 - e1), fabs (b1 - e2));
+	if (b2 != e2 && b1 == e2)
+	    return 1e-15;
+	return 0.0;
+    case FcScoreBool:
+    default:
+	return (double) ((((int) b2) ^ ((int) b1)) == 1);
+    }
+}
+
 /* The bulk of the time in FcFontMatch and FcFontSort goes to
  * walking long lists of family names. We speed this up with a
- * hash table.
+ * hash table.  It is kept inside the FcCompareData on the caller's
+ * stack, so matching allocates nothing unless the pattern has an
+ * unusually long family list.
  */
+#define FC_COMPARE_FAMILY_SLOTS	256
+
 typedef struct
 {
+    const FcChar8 *key;
+    FcChar32 hash;
     double strong_value;
     double weak_value;
 } FamilyEntry;
 
 typedef struct
 {
-    FcHashTable *family_hash;
+    FamilyEntry *families;	/* NULL to compare families as usual */
+    unsigned int family_mask;
+    FamilyEntry family_slots[FC_COMPARE_FAMILY_SLOTS];
+    const FcScoreTable *table;	/* set by FcCompareDataSetTable */
+    FcScoreQuery query;
 } FcCompareData;
 
 static void
 FcCompareDataClear (FcCompareData *data)
 {
-    FcHashTableDestroy (data->family_hash);
+    if (data->families != data->family_slots)
+	free (data->families);
+}
+
+/*
+ * Return the entry for key, or the empty slot it would go in.
+ */
+static FamilyEntry *
+FcCompareDataFindFamily (const FcCompareData *data,
+			 const FcChar8	     *key,
+			 FcChar32	     hash)
+{
+    FamilyEntry *e;
+    unsigned int i;
+
+    for (i = hash & data->family_mask; ; i = (i + 1) & data->family_mask)
+    {
+	e = &data->families[i];
+	if (!e->key ||
+	    (e->hash == hash && !FcStrCmpIgnoreBlanksAndCase (e->key, key)))
+	    return e;
+    }
 }
 
 static void
 FcCompareDataInit (FcPattern     *pat,
                    FcCompareData *data)
 {
-    FcHashTable *table;
     FcPatternElt *elt;
     FcValueListPtr l;
-    int i;
-    const void *key;
+    int i, n = 0;
+    unsigned int nslot;
+    const FcChar8 *key;
+    FcChar32 hash;
     FamilyEntry *e;
 
-    table = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreBlanksAndCase,
-                               (FcCompareFunc)FcStrCmpIgnoreBlanksAndCase,
-                               NULL,
-                               NULL,
-                               NULL,
-                               free);
+    data->families = NULL;
+    data->family_mask = 0;
+    data->table = NULL;
 
     elt = FcPatternObjectFindElt (pat, FC_FAMILY_OBJECT);
-    if (elt)
+    if (!elt)
+	return;
+    for (l = FcPatternEltValues(elt); l; l = FcValueListNext(l))
+	n++;
+    /* Keep the table at most three quarters full */
+    if (n <= FC_COMPARE_FAMILY_SLOTS / 4 * 3)
+    {
+	nslot = FC_COMPARE_FAMILY_SLOTS;
+	data->families = data->family_slots;
+    }
+    else
+    {
+	for (nslot = FC_COMPARE_FAMILY_SLOTS; nslot < (unsigned int) n * 2; nslot *= 2)
+	    ;
+	data->families = malloc (nslot * sizeof (FamilyEntry));
+	if (!data->families)
+	    return;
+    }
+    data->family_mask = nslot - 1;
+    memset (data->families, 0, nslot * sizeof (FamilyEntry));
+
+    for (l = FcPatternEltValues(elt), i = 0; l; l = FcValueListNext(l), i++)
     {
-        for (l = FcPatternEltValues(elt), i = 0; l; l = FcValueListNext(l), i++)
+        key = FcValueString (&l->value);
+        hash = FcStrHashIgnoreBlanksAndCase (key);
+        e = FcCompareDataFindFamily (data, key, hash);
+        if (!e->key)
         {
-            key = FcValueString (&l->value);
-            if (!FcHashTableFind (table, key, (void **)&e))
-            {
-                e = malloc (sizeof (FamilyEntry));
-                e->strong_value = 1e99;
-                e->weak_value = 1e99;
-                FcHashTableAdd (table, (void *)key, e);
-            }
-            if (l->binding == FcValueBindingWeak)
-            {
-                if (i < e->weak_value)
-                    e->weak_value = i;
-            }
-            else
-            {
-                if (i < e->strong_value)
-                    e->strong_value = i;
-            }
+            e->key = key;
+            e->hash = hash;
+            e->strong_value = 1e99;
+            e->weak_value = 1e99;
+        }
+        if (l->binding == FcValueBindingWeak)
+        {
+            if (i < e->weak_value)
+                e->weak_value = i;
+        }
+        else
+        {
+            if (i < e->strong_value)
+                e->strong_value = i;
         }
     }
-
-    data->family_hash = table;
 }
 
 static FcBool
@@ -563,15 +726,15 @@ FcCompareFamilies (FcPattern       *pat,
                    FcValueListPtr   v2orig,
                    double          *value,
                    FcResult        *result,
-                   FcHashTable     *table)
+                   const FcCompareData *data)
 {
     FcValueListPtr v2;
     double strong_value;
     double weak_value;
-    const void *key;
+    const FcChar8 *key;
     FamilyEntry *e;
 
-    assert (table != NULL);
+    assert (data->families != NULL);
 
     strong_value = 1e99;
     weak_value = 1e99;
@@ -579,7 +742,8 @@ FcCompareFamilies (FcPattern       *pat,
     for (v2 = v2orig; v2; v2 = FcValueListNext(v2))
     {
         key = FcValueString (&v2->value);
-        if (FcHashTableFind (table, key, (void **)&e))
+        e = FcCompareDataFindFamily (data, key, FcStrHashIgnoreBlanksAndCase (key));
+        if (e->key)
         {
             if (e->strong_value < strong_value)
                 strong_value = e->strong_value;
@@ -604,7 +768,7 @@ FcCompareFamilies (FcPattern       *pat,
 
 /*
  * Return a value indicating the distance between the two lists of
- * values
+ * values.  Objects in the skip columns are left for FcCompareDataScore.
  */
 
 static FcBool
@@ -612,7 +776,8 @@ FcCompare (FcPattern	*pat,
 	   FcPattern	*fnt,
 	   double	*value,
 	   FcResult	*result,
-           FcCompareData *data)
+           FcCompareData *data,
+	   int		skip)
 {
     int		    i, i1, i2;
 
@@ -631,12 +796,17 @@ FcCompare (FcPattern	*pat,
 	    i2++;
 	else if (i < 0)
 	    i1++;
-	else if (elt_i1->object == FC_FAMILY_OBJECT && data->family_hash)
+	else if (skip && (FcScoreColumnBit (elt_i1->object) & skip))
+	{
+	    i1++;
+	    i2++;
+	}
+	else if (elt_i1->object == FC_FAMILY_OBJECT && data->families)
         {
             if (!FcCompareFamilies (pat, FcPatternEltValues(elt_i1),
                                     fnt, FcPatternEltValues(elt_i2),
                                     value, result,
-                                    data->family_hash))
+                                    data))
                 return FcFalse;
 	    i1++;
 	    i2++;
@@ -857,272 +1027,1686 @@ FcFontRenderPrepare (FcConfig	    *config,
     return new;
 }
 
-static FcPattern *
-FcFontSetMatchInternal (FcFontSet   **sets,
-			int	    nsets,
-			FcPattern   *p,
-			FcResult    *result)
+/*
+ * Data derived from the font sets of a configuration refers to fonts
+ * by position, so it is only good for exactly the sets it was built
+ * from, in their current state.
+ */
+typedef struct _FcFontSetsStamp {
+    int			nsets;
+    FcFontSet		*sets[FcSetApplication + 1];
+    int			nfont[FcSetApplication + 1];
+    FcPattern		**fonts[FcSetApplication + 1];
+} FcFontSetsStamp;
+
+static FcBool
+FcFontSetsStampInit (FcFontSetsStamp *stamp, FcFontSet **sets, int nsets)
 {
-    double    	    score[PRI_END], bestscore[PRI_END];
-    int		    f;
-    FcFontSet	    *s;
-    FcPattern	    *best, *pat = NULL;
-    int		    i;
-    int		    set;
-    FcCompareData   data;
-    const FcPatternElt *elt;
+    int set;
 
-    for (i = 0; i < PRI_END; i++)
-	bestscore[i] = 0;
-    best = 0;
-    if (FcDebug () & FC_DBG_MATCH)
+    stamp->nsets = 0;
+    for (set = 0; set < nsets; set++)
     {
-	printf ("Match ");
-	FcPatternPrint (p);
+	if (!sets[set])
+	    continue;
+	if (stamp->nsets > FcSetApplication)
+	    return FcFalse;
+	stamp->sets[stamp->nsets] = sets[set];
+	stamp->nfont[stamp->nsets] = sets[set]->nfont;
+	stamp->fonts[stamp->nsets] = sets[set]->fonts;
+	stamp->nsets++;
     }
 
-    FcCompareDataInit (p, &data);
+    return FcTrue;
+}
+
+static FcBool
+FcFontSetsStampValid (const FcFontSetsStamp *stamp,
+		      FcFontSet		    **sets,
+		      int		    nsets)
+{
+    int set, n = 0;
 
     for (set = 0; set < nsets; set++)
     {
-	s = sets[set];
-	if (!s)
+	if (!sets[set])
 	    continue;
-	for (f = 0; f < s->nfont; f++)
-	{
-	    if (FcDebug () & FC_DBG_MATCHV)
-	    {
-		printf ("Font %d ", f);
-		FcPatternPrint (s->fonts[f]);
-	    }
-	    if (!FcCompare (p, s->fonts[f], score, result, &data))
-            {
-                FcCompareDataClear (&data);
-		return 0;
-            }
-	    if (FcDebug () & FC_DBG_MATCHV)
-	    {
-		printf ("Score");
-		for (i = 0; i < PRI_END; i++)
-		{
-		    printf (" %g", score[i]);
-		}
-		printf ("\n");
-	    }
-	    for (i = 0; i < PRI_END; i++)
-	    {
-		if (best && bestscore[i] < score[i])
-		    break;
-		if (!best || score[i] < bestscore[i])
-		{
-		    for (i = 0; i < PRI_END; i++)
-			bestscore[i] = score[i];
-		    best = s->fonts[f];
-		    break;
-		}
-	    }
-	}
+	if (n == stamp->nsets ||
+	    stamp->sets[n] != sets[set] ||
+	    stamp->nfont[n] != sets[set]->nfont ||
+	    stamp->fonts[n] != sets[set]->fonts)
+	    return FcFalse;
+	n++;
     }
 
-    FcCompareDataClear (&data);
+    return n == stamp->nsets;
+}
 
-    /* Update the binding according to the score to indicate how exactly values matches on. */
-    if (best)
-    {
-	pat = FcPatternCreate ();
-	elt = FcPatternElts (best);
-	for (i = 0; i < FcPatternObjectCount (best); i++)
-	{
-	    const FcMatcher *match = FcObjectToMatcher (elt[i].object, FcFalse);
-	    FcValueListPtr l = FcPatternEltValues (&elt[i]);
+static FcPattern *
+FcFontSetsStampFont (const FcFontSetsStamp *stamp, int pos)
+{
+    int set;
 
-	    if (!match)
-		FcPatternObjectListAdd(pat, elt[i].object,
-				       FcValueListDuplicate(l), FcTrue);
-	    else
-	    {
-		FcValueBinding binding = FcValueBindingWeak;
-		FcValueListPtr new = NULL, ll, t = NULL;
-		FcValue v;
+    for (set = 0; pos >= stamp->nfont[set]; set++)
+	pos -= stamp->nfont[set];
 
-		/* If the value was matched exactly, update the binding to Strong. */
-		if (bestscore[match->strong] < 1000)
-		    binding = FcValueBindingStrong;
+    return stamp->sets[set]->fonts[pos];
+}
 
-		for (ll = l; ll != NULL; ll = FcValueListNext (ll))
-		{
-		    if (!new)
-		    {
-			t = new = FcValueListCreate ();
-		    }
-		    else
-		    {
-			t->next = FcValueListCreate ();
-			t = FcValueListNext (t);
-		    }
-		    v = FcValueCanonicalize (&ll->value);
-		    t->value = FcValueSave (v);
-		    t->binding = binding;
-		    t->next = NULL;
-		}
-		FcPatternObjectListAdd (pat, elt[i].object, new, FcTrue);
-	    }
-	}
+/*
+ * Gather the font sets of config, in the order they are matched.
+ */
+static int
+FcConfigFontSets (FcConfig *config, FcFontSet **sets)
+{
+    int nsets = 0;
+
+    if (config->fonts[FcSetSystem])
+	sets[nsets++] = config->fonts[FcSetSystem];
+    if (config->fonts[FcSetApplication])
+	sets[nsets++] = config->fonts[FcSetApplication];
+
+    return nsets;
+}
+
+/*
+ * Whether sets are the font sets of config, give or take NULL entries.
+ */
+static FcBool
+FcConfigFontSetsAre (FcConfig *config, FcFontSet **sets, int nsets)
+{
+    FcFontSet	*csets[FcSetApplication + 1];
+    int		ncsets, set, n = 0;
+
+    ncsets = FcConfigFontSets (config, csets);
+    for (set = 0; set < nsets; set++)
+    {
+	if (!sets[set])
+	    continue;
+	if (n == ncsets || csets[n] != sets[set])
+	    return FcFalse;
+	n++;
     }
-    if (FcDebug () & FC_DBG_MATCH)
+
+    return n == ncsets;
+}
+
+struct _FcScoreTable {
+    FcFontSetsStamp	stamp;
+    int			nfont;
+    int			*mask;		/* columns each font has an entry in */
+    double		*begin[FC_SCORE_NCOLUMN];	/* one allocation, with mask */
+    double		*end[FC_SCORE_NCOLUMN];
+};
+
+void
+FcScoreTableDestroy (FcScoreTable *table)
+{
+    if (!table)
+	return;
+    free (table->begin[0]);
+    free (table);
+}
+
+static FcScoreTable *
+FcScoreTableCreate (FcFontSet **sets, int nsets)
+{
+    FcScoreTable    *table;
+    FcPatternElt    *elt;
+    FcValueListPtr  l;
+    double	    *values;
+    int		    set, f, c, pos = 0;
+
+    table = calloc (1, sizeof (FcScoreTable));
+    if (!table)
+	return NULL;
+    if (!FcFontSetsStampInit (&table->stamp, sets, nsets))
+	goto bail;
+    for (set = 0; set < table->stamp.nsets; set++)
+	table->nfont += table->stamp.nfont[set];
+
+    /* The doubles go first so that they stay aligned */
+    values = malloc (table->nfont * (2 * FC_SCORE_NCOLUMN * sizeof (double) + sizeof (int)));
+    if (!values)
+	goto bail;
+    for (c = 0; c < FC_SCORE_NCOLUMN; c++)
     {
-	printf ("Best score");
-	for (i = 0; i < PRI_END; i++)
-	    printf (" %g", bestscore[i]);
-	printf ("\n");
-	FcPatternPrint (pat);
+	table->begin[c] = values;
+	values += table->nfont;
+	table->end[c] = values;
+	values += table->nfont;
     }
-    if (FcDebug () & FC_DBG_MATCH2)
+    table->mask = (int *) values;
+
+    for (set = 0; set < table->stamp.nsets; set++)
     {
-	char *env = getenv ("FC_DBG_MATCH_FILTER");
-	FcObjectSet *os = NULL;
+	FcFontSet *s = table->stamp.sets[set];
 
-	if (env)
+	for (f = 0; f < s->nfont; f++, pos++)
 	{
-	    char *ss, *s;
-	    char *p;
-	    FcBool f = FcTrue;
-
-	    ss = s = strdup (env);
-	    os = FcObjectSetCreate ();
-	    while (f)
+	    table->mask[pos] = 0;
+	    for (c = 0; c < FC_SCORE_NCOLUMN; c++)
 	    {
-		size_t len;
-		char *x;
-
-		if (!(p = strchr (s, ',')))
-		{
-		    f = FcFalse;
-		    len = strlen (s);
-		}
-		else
-		{
-		    len = (p - s);
-		}
-		x = malloc (sizeof (char) * (len + 1));
-		if (x)
-		{
-		    strcpy (x, s);
-		    if (FcObjectFromName (x) > 0)
-			FcObjectSetAdd (os, x);
-		    s = p + 1;
-		    free (x);
-		}
+		table->begin[c][pos] = table->end[c][pos] = 0;
+		elt = FcPatternObjectFindElt (s->fonts[f], _FcScoreColumns[c].object);
+		if (!elt)
+		    continue;
+		l = FcPatternEltValues (elt);
+		if (FcValueListNext (l))
+		    continue;
+		if (FcScoreValue (_FcScoreColumns[c].kind, &l->value,
+				  &table->begin[c][pos], &table->end[c][pos]))
+		    table->mask[pos] |= 1 << c;
 	    }
-	    free (ss);
 	}
-	FcPatternPrint2 (p, pat, os);
-	if (os)
-	    FcObjectSetDestroy (os);
     }
-    /* assuming that 'result' is initialized with FcResultNoMatch
-     * outside this function */
-    if (pat)
-	*result = FcResultMatch;
 
-    return pat;
+    return table;
+
+bail:
+    FcScoreTableDestroy (table);
+
+    return NULL;
 }
 
-FcPattern *
-FcFontSetMatch (FcConfig    *config,
-		FcFontSet   **sets,
-		int	    nsets,
-		FcPattern   *p,
-		FcResult    *result)
+/*
+ * Return the score table of @config if it covers @sets, building it
+ * on first use like the family index.
+ */
+static FcScoreTable *
+FcConfigScoreTable (FcConfig	*config,
+		    FcFontSet	**sets,
+		    int		nsets)
 {
-    FcPattern	    *best, *ret = NULL;
-
-    assert (sets != NULL);
-    assert (p != NULL);
-    assert (result != NULL);
+    FcScoreTable    *table;
+
+retry:
+    table = fc_atomic_ptr_get (&config->scoreTable);
+    if (!table)
+    {
+	if (!FcConfigFontSetsAre (config, sets, nsets))
+	    return NULL;
+	table = FcScoreTableCreate (sets, nsets);
+	if (!table)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->scoreTable, NULL, table))
+	{
+	    FcScoreTableDestroy (table);
+	    goto retry;
+	}
+    }
+    if (!FcFontSetsStampValid (&table->stamp, sets, nsets))
+	return NULL;
+
+    return table;
+}
+
+/*
+ * Pick the columns the values in p can be scored from.
+ */
+static void
+FcCompareDataSetTable (FcCompareData	*data,
+		       FcPattern	*p,
+		       const FcScoreTable *table)
+{
+    FcScoreQuery    *query = &data->query;
+    FcPatternElt    *elt;
+    FcValueListPtr  l;
+    int		    c, j;
+
+    data->table = NULL;
+    query->mask = 0;
+    /* Per-object scores are only printed by FcCompareValueList */
+    if (!table || (FcDebug () & FC_DBG_MATCHV))
+	return;
+    for (c = 0; c < FC_SCORE_NCOLUMN; c++)
+    {
+	elt = FcPatternObjectFindElt (p, _FcScoreColumns[c].object);
+	if (!elt)
+	    continue;
+	for (l = FcPatternEltValues (elt), j = 0; l; l = FcValueListNext (l), j++)
+	{
+	    if (j == FC_SCORE_MAX_VALUES ||
+		!FcScoreValue (_FcScoreColumns[c].kind, &l->value,
+			       &query->begin[c][j], &query->end[c][j]))
+		break;
+	}
+	if (l)
+	    continue;
+	query->nvalue[c] = j;
+	query->mask |= 1 << c;
+    }
+    if (query->mask)
+	data->table = table;
+}
+
+/*
+ * The columns FcCompare should leave alone for the font at pos.
+ */
+static int
+FcCompareDataSkip (const FcCompareData *data, int pos)
+{
+    if (!data->table)
+	return 0;
+
+    return data->query.mask & data->table->mask[pos];
+}
+
+/*
+ * Add the column scores of fonts first .. first + nfont - 1 to the
+ * score vectors at value, stride bytes apart, the way
+ * FcCompareValueList would for a single font value.
+ */
+static void
+FcCompareDataScore (const FcCompareData *data,
+		    int			first,
+		    int			nfont,
+		    double		*value,
+		    size_t		stride)
+{
+    const FcScoreTable	*table = data->table;
+    const FcScoreQuery	*query = &data->query;
+    int			c, i, j;
+
+    if (!table)
+	return;
+    for (c = 0; c < FC_SCORE_NCOLUMN; c++)
+    {
+	FcScoreKind	kind = _FcScoreColumns[c].kind;
+	const double	*begin = table->begin[c] + first;
+	const double	*end = table->end[c] + first;
+	const int	*mask = table->mask + first;
+	double		*v = value + _FcScoreColumns[c].pri;
+	int		bit = 1 << c;
+	int		nvalue = query->nvalue[c];
+
+	if (!(query->mask & bit))
+	    continue;
+	for (i = 0; i < nfont; i++, v = (double *) ((char *) v + stride))
+	{
+	    double best = 1e99;
+
+	    if (!(mask[i] & bit))
+		continue;
+	    for (j = 0; j < nvalue; j++)
+	    {
+		double s = FcScoreCompare (kind, query->begin[c][j], query->end[c][j],
+					   begin[i], end[i]) * 1000 + j * 100;
+		if (s < best)
+		    best = s;
+		if (best < 1000)
+		    break;
+	    }
+	    *v += best;
+	}
+    }
+}
+
+/*
+ * Fonts indexed by family name.  FcFontSetMatch scores the fonts
+ * carrying one of the requested families (and those without any
+ * family at all) first; everything else only gets looked at when
+ * that doesn't already settle the match.
+ */
+typedef struct _FcFamilyIndexEntry {
+    int		nfont;
+    int		sfont;
+    int		*fonts;
+} FcFamilyIndexEntry;
+
+struct _FcFamilyIndex {
+    FcFontSetsStamp	stamp;
+    FcHashTable		*families;
+    FcFamilyIndexEntry	nofamily;
+};
+
+static FcBool
+FcFamilyIndexEntryAdd (FcFamilyIndexEntry *e, int pos)
+{
+    if (e->nfont && e->fonts[e->nfont - 1] == pos)
+	return FcTrue;
+    if (e->nfont == e->sfont)
+    {
+	int sfont = e->sfont ? e->sfont * 2 : 4;
+	int *fonts = realloc (e->fonts, sfont * sizeof (int));
+
+	if (!fonts)
+	    return FcFalse;
+	e->fonts = fonts;
+	e->sfont = sfont;
+    }
+    e->fonts[e->nfont++] = pos;
+
+    return FcTrue;
+}
+
+static void
+FcFamilyIndexEntryDestroy (void *data)
+{
+    FcFamilyIndexEntry *e = data;
+
+    free (e->fonts);
+    free (e);
+}
+
+void
+FcFamilyIndexDestroy (FcFamilyIndex *index)
+{
+    if (!index)
+	return;
+    if (index->families)
+	FcHashTableDestroy (index->families);
+    free (index->nofamily.fonts);
+    free (index);
+}
+
+static FcFamilyIndex *
+FcFamilyIndexCreate (FcFontSet **sets, int nsets)
+{
+    FcFamilyIndex	*index;
+    FcFamilyIndexEntry	*e;
+    FcPatternElt	*elt;
+    FcValueListPtr	l;
+    const FcChar8	*key;
+    int			set, f, pos = 0;
+
+    index = calloc (1, sizeof (FcFamilyIndex));
+    if (!index)
+	return NULL;
+    index->families = FcHashTableCreate ((FcHashFunc) FcStrHashIgnoreBlanksAndCase,
+					 (FcCompareFunc) FcStrCmpIgnoreBlanksAndCase,
+					 NULL,
+					 NULL,
+					 NULL,
+					 FcFamilyIndexEntryDestroy);
+    if (!index->families)
+	goto bail;
+
+    if (!FcFontSetsStampInit (&index->stamp, sets, nsets))
+	goto bail;
+    for (set = 0; set < index->stamp.nsets; set++)
+    {
+	FcFontSet *s = index->stamp.sets[set];
+
+	for (f = 0; f < s->nfont; f++, pos++)
+	{
+	    elt = FcPatternObjectFindElt (s->fonts[f], FC_FAMILY_OBJECT);
+	    if (!elt)
+	    {
+		if (!FcFamilyIndexEntryAdd (&index->nofamily, pos))
+		    goto bail;
+		continue;
+	    }
+	    for (l = FcPatternEltValues (elt); l; l = FcValueListNext (l))
+	    {
+		if (l->value.type != FcTypeString)
+		    continue;
+		key = FcValueString (&l->value);
+		if (!FcHashTableFind (index->families, key, (void **) &e))
+		{
+		    e = calloc (1, sizeof (FcFamilyIndexEntry));
+		    if (!e)
+			goto bail;
+		    if (!FcHashTableAdd (index->families, (void *) key, e))
+		    {
+			free (e);
+			goto bail;
+		    }
+		}
+		if (!FcFamilyIndexEntryAdd (e, pos))
+		    goto bail;
+	    }
+	}
+    }
+
+    return index;
+
+bail:
+    FcFamilyIndexDestroy (index);
+
+    return NULL;
+}
+
+static int
+FcFamilyIndexPosCompare (const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/* Room for the candidates of a typical pattern on the stack */
+#define FC_FAMILY_INDEX_CANDIDATES	256
+
+/*
+ * Collect the positions of all fonts which may have a finite family
+ * score for @p, in ascending order and without duplicates.  They go
+ * into @buf if there is room for them; otherwise *candidates is
+ * allocated and must be freed by the caller.
+ */
+static FcBool
+FcFamilyIndexCandidates (const FcFamilyIndex	*index,
+			 FcPattern		*p,
+			 int			*buf,
+			 int			nbuf,
+			 int			**candidates,
+			 int			*ncandidates)
+{
+    FcPatternElt	*elt;
+    FcValueListPtr	l;
+    FcFamilyIndexEntry	*e;
+    int			*c, n, i, j;
+
+    elt = FcPatternObjectFindElt (p, FC_FAMILY_OBJECT);
+    n = index->nofamily.nfont;
+    for (l = FcPatternEltValues (elt); l; l = FcValueListNext (l))
+	if (FcHashTableFind (index->families, FcValueString (&l->value), (void **) &e))
+	    n += e->nfont;
+    *candidates = NULL;
+    *ncandidates = 0;
+    if (!n)
+	return FcTrue;
+
+    c = n <= nbuf ? buf : malloc (n * sizeof (int));
+    if (!c)
+	return FcFalse;
+    n = index->nofamily.nfont;
+    if (n)
+	memcpy (c, index->nofamily.fonts, n * sizeof (int));
+    for (l = FcPatternEltValues (elt); l; l = FcValueListNext (l))
+	if (FcHashTableFind (index->families, FcValueString (&l->value), (void **) &e))
+	{
+	    memcpy (c + n, e->fonts, e->nfont * sizeof (int));
+	    n += e->nfont;
+	}
+    qsort (c, n, sizeof (int), FcFamilyIndexPosCompare);
+    for (i = 0, j = 0; i < n; i++)
+	if (!j || c[j - 1] != c[i])
+	    c[j++] = c[i];
+
+    *candidates = c;
+    *ncandidates = j;
+
+    return FcTrue;
+}
+
+/*
+ * Everything not returned by FcFamilyIndexCandidates scores 1e99 on
+ * both family priorities and nothing below zero elsewhere, so it can
+ * no longer win once the best candidate is perfect up to the family
+ * and has a finite family score.
+ */
+static FcBool
+FcFamilyIndexBestIsFinal (const double *bestscore)
+{
+    int i;
+
+    for (i = 0; i < PRI_FAMILY_STRONG; i++)
+	if (bestscore[i] != 0)
+	    return FcFalse;
+    if (bestscore[PRI_FAMILY_STRONG] < 1e99)
+	return FcTrue;
+    for (i = PRI_FAMILY_STRONG + 1; i < PRI_FAMILY_WEAK; i++)
+	if (bestscore[i] != 0)
+	    return FcFalse;
+
+    return bestscore[PRI_FAMILY_WEAK] < 1e99;
+}
+
+/*
+ * Return the family index of @config if it covers @sets, building it
+ * on first use.  The fonts of a configuration are not modified while
+ * it is being used for matching, so racing builders only need to
+ * agree on which copy gets published.
+ */
+static FcFamilyIndex *
+FcConfigFamilyIndex (FcConfig	*config,
+		     FcFontSet	**sets,
+		     int	nsets)
+{
+    FcFamilyIndex   *index;
+
+retry:
+    index = fc_atomic_ptr_get (&config->familyIndex);
+    if (!index)
+    {
+	if (!FcConfigFontSetsAre (config, sets, nsets))
+	    return NULL;
+	index = FcFamilyIndexCreate (sets, nsets);
+	if (!index)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->familyIndex, NULL, index))
+	{
+	    FcFamilyIndexDestroy (index);
+	    goto retry;
+	}
+    }
+    if (!FcFontSetsStampValid (&index->stamp, sets, nsets))
+	return NULL;
+
+    return index;
+}
+
+/*
+ * Fonts indexed by the Unicode pages (ucs4 >> 8) their charsets have a
+ * leaf for.  Each posting keeps the leaf alongside the font position,
+ * so a code point can be checked without searching the charset; the
+ * leaves are those of the charsets themselves, which the freezer has
+ * already merged for fonts coming from the cache.
+ */
+struct _FcCoverageIndex {
+    FcFontSetsStamp	stamp;
+    int			npage;
+    FcChar16		*pages;		/* sorted */
+    int			*start;		/* postings of pages[i] begin at start[i] */
+    int			*fonts;		/* font positions, ascending per page */
+    const FcCharLeaf	**leaves;	/* one allocation, with pages and start */
+};
+
+void
+FcCoverageIndexDestroy (FcCoverageIndex *index)
+{
+    if (!index)
+	return;
+    free ((void *) index->leaves);
+    free (index);
+}
+
+static FcCoverageIndex *
+FcCoverageIndexCreate (FcFontSet **sets, int nsets)
+{
+    FcCoverageIndex *index;
+    FcCharSet	    *cs;
+    int		    *slot;
+    int		    set, f, i, pos, npage = 0, nposting = 0;
+    char	    *mem;
+
+    index = calloc (1, sizeof (FcCoverageIndex));
+    if (!index)
+	return NULL;
+    if (!FcFontSetsStampInit (&index->stamp, sets, nsets))
+	goto bail0;
+    /* Count the postings of each page, then turn counts into slots */
+    slot = calloc (0x10000, sizeof (int));
+    if (!slot)
+	goto bail0;
+    for (set = 0; set < index->stamp.nsets; set++)
+    {
+	FcFontSet *s = index->stamp.sets[set];
+
+	for (f = 0; f < s->nfont; f++)
+	{
+	    if (FcPatternGetCharSet (s->fonts[f], FC_CHARSET, 0, &cs) != FcResultMatch)
+		continue;
+	    for (i = 0; i < cs->num; i++)
+		if (!slot[FcCharSetNumbers (cs)[i]]++)
+		    npage++;
+	    nposting += cs->num;
+	}
+    }
+    mem = malloc (npage * sizeof (FcChar16) + (npage + 1) * sizeof (int) +
+		  nposting * (sizeof (int) + sizeof (FcCharLeaf *)));
+    if (!mem)
+	goto bail1;
+    index->leaves = (const FcCharLeaf **) mem;
+    index->fonts = (int *) (index->leaves + nposting);
+    index->start = index->fonts + nposting;
+    index->pages = (FcChar16 *) (index->start + npage + 1);
+    index->npage = npage;
+    for (i = 0, npage = 0, nposting = 0; i < 0x10000; i++)
+    {
+	if (!slot[i])
+	    continue;
+	index->pages[npage] = i;
+	index->start[npage++] = nposting;
+	nposting += slot[i];
+	slot[i] = nposting - slot[i];
+    }
+    index->start[npage] = nposting;
+
+    for (set = 0, pos = 0; set < index->stamp.nsets; set++)
+    {
+	FcFontSet *s = index->stamp.sets[set];
+
+	for (f = 0; f < s->nfont; f++, pos++)
+	{
+	    if (FcPatternGetCharSet (s->fonts[f], FC_CHARSET, 0, &cs) != FcResultMatch)
+		continue;
+	    for (i = 0; i < cs->num; i++)
+	    {
+		int p = slot[FcCharSetNumbers (cs)[i]]++;
+
+		index->fonts[p] = pos;
+		index->leaves[p] = FcCharSetLeaf (cs, i);
+	    }
+	}
+    }
+    free (slot);
+
+    return index;
+
+bail1:
+    free (slot);
+bail0:
+    free (index);
+
+    return NULL;
+}
+
+/*
+ * Return the position in index->pages of page, or -1.
+ */
+static int
+FcCoverageIndexFind (const FcCoverageIndex *index, FcChar32 page)
+{
+    int low = 0, high = index->npage - 1;
+
+    while (low <= high)
+    {
+	int mid = (low + high) >> 1;
+
+	if (index->pages[mid] == page)
+	    return mid;
+	if (index->pages[mid] < page)
+	    low = mid + 1;
+	else
+	    high = mid - 1;
+    }
+
+    return -1;
+}
+
+/*
+ * Return the coverage index of @config if it covers @sets, building it
+ * on first use like the family index.
+ */
+static FcCoverageIndex *
+FcConfigCoverageIndex (FcConfig	*config,
+		       FcFontSet	**sets,
+		       int		nsets)
+{
+    FcCoverageIndex *index;
+
+retry:
+    index = fc_atomic_ptr_get (&config->coverageIndex);
+    if (!index)
+    {
+	if (!FcConfigFontSetsAre (config, sets, nsets))
+	    return NULL;
+	index = FcCoverageIndexCreate (sets, nsets);
+	if (!index)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->coverageIndex, NULL, index))
+	{
+	    FcCoverageIndexDestroy (index);
+	    goto retry;
+	}
+    }
+    if (!FcFontSetsStampValid (&index->stamp, sets, nsets))
+	return NULL;
+
+    return index;
+}
+
+static FcBool
+FcFontSetMatchFont (FcPattern	    *p,
+		    FcPattern	    *font,
+		    int		    pos,
+		    FcCompareData   *data,
+		    double	    *bestscore,
+		    FcPattern	    **best,
+		    int		    *bestpos,
+		    FcResult	    *result)
+{
+    double  score[PRI_END];
+    int	    i;
+
+    if (FcDebug () & FC_DBG_MATCHV)
+    {
+	printf ("Font %d ", pos);
+	FcPatternPrint (font);
+    }
+    if (!FcCompare (p, font, score, result, data, FcCompareDataSkip (data, pos)))
+	return FcFalse;
+    FcCompareDataScore (data, pos, 1, score, 0);
+    if (FcDebug () & FC_DBG_MATCHV)
+    {
+	printf ("Score");
+	for (i = 0; i < PRI_END; i++)
+	{
+	    printf (" %g", score[i]);
+	}
+	printf ("\n");
+    }
+    for (i = 0; i < PRI_END; i++)
+    {
+	if (*best && bestscore[i] != score[i])
+	    break;
+    }
+    /* On a tie, the font found earlier in the sets wins. */
+    if (!*best || (i < PRI_END ? score[i] < bestscore[i] : pos < *bestpos))
+    {
+	for (i = 0; i < PRI_END; i++)
+	    bestscore[i] = score[i];
+	*best = font;
+	*bestpos = pos;
+    }
+
+    return FcTrue;
+}
+
+static FcPattern *
+FcFontSetMatchInternal (FcFontSet	**sets,
+			int		nsets,
+			FcPattern	*p,
+			FcFamilyIndex	*index,
+			FcScoreTable	*table,
+			FcResult	*result)
+{
+    double    	    bestscore[PRI_END];
+    int		    f, pos, bestpos = 0;
+    FcFontSet	    *s;
+    FcPattern	    *best, *pat = NULL;
+    int		    i;
+    int		    set;
+    int		    candidate_buf[FC_FAMILY_INDEX_CANDIDATES];
+    int		    *candidates = NULL, ncandidates = 0;
+    FcCompareData   data;
+    const FcPatternElt *elt;
+
+    for (i = 0; i < PRI_END; i++)
+	bestscore[i] = 0;
+    best = 0;
+    if (FcDebug () & FC_DBG_MATCH)
+    {
+	printf ("Match ");
+	FcPatternPrint (p);
+    }
+
+    FcCompareDataInit (p, &data);
+    FcCompareDataSetTable (&data, p, table);
+
+    if (index && FcPatternObjectFindElt (p, FC_FAMILY_OBJECT) &&
+	!FcFamilyIndexCandidates (index, p, candidate_buf, FC_FAMILY_INDEX_CANDIDATES,
+				  &candidates, &ncandidates))
+	ncandidates = 0;
+    for (i = 0; i < ncandidates; i++)
+    {
+	if (!FcFontSetMatchFont (p, FcFontSetsStampFont (&index->stamp, candidates[i]),
+				 candidates[i], &data,
+				 bestscore, &best, &bestpos, result))
+	    goto bail;
+    }
+
+    if (!best || !FcFamilyIndexBestIsFinal (bestscore))
+    {
+	pos = 0;
+	i = 0;
+	for (set = 0; set < nsets; set++)
+	{
+	    s = sets[set];
+	    if (!s)
+		continue;
+	    for (f = 0; f < s->nfont; f++, pos++)
+	    {
+		if (i < ncandidates && candidates[i] == pos)
+		{
+		    i++;
+		    continue;
+		}
+		if (!FcFontSetMatchFont (p, s->fonts[f], pos, &data,
+					 bestscore, &best, &bestpos, result))
+		    goto bail;
+	    }
+	}
+    }
+
+    if (candidates != candidate_buf)
+	free (candidates);
+    FcCompareDataClear (&data);
+
+    /* Update the binding according to the score to indicate how exactly values matches on. */
+    if (best)
+    {
+	pat = FcPatternCreate ();
+	elt = FcPatternElts (best);
+	for (i = 0; i < FcPatternObjectCount (best); i++)
+	{
+	    const FcMatcher *match = FcObjectToMatcher (elt[i].object, FcFalse);
+	    FcValueListPtr l = FcPatternEltValues (&elt[i]);
+
+	    if (!match)
+		FcPatternObjectListAdd(pat, elt[i].object,
+				       FcValueListDuplicate(l), FcTrue);
+	    else
+	    {
+		FcValueBinding binding = FcValueBindingWeak;
+		FcValueListPtr new = NULL, ll, t = NULL;
+		FcValue v;
+
+		/* If the value was matched exactly, update the binding to Strong. */
+		if (bestscore[match->strong] < 1000)
+		    binding = FcValueBindingStrong;
+
+		for (ll = l; ll != NULL; ll = FcValueListNext (ll))
+		{
+		    if (!new)
+		    {
+			t = new = FcValueListCreate ();
+		    }
+		    else
+		    {
+			t->next = FcValueListCreate ();
+			t = FcValueListNext (t);
+		    }
+		    v = FcValueCanonicalize (&ll->value);
+		    t->value = FcValueSave (v);
+		    t->binding = binding;
+		    t->next = NULL;
+		}
+		FcPatternObjectListAdd (pat, elt[i].object, new, FcTrue);
+	    }
+	}
+    }
+    if (FcDebug () & FC_DBG_MATCH)
+    {
+	printf ("Best score");
+	for (i = 0; i < PRI_END; i++)
+	    printf (" %g", bestscore[i]);
+	printf ("\n");
+	FcPatternPrint (pat);
+    }
+    if (FcDebug () & FC_DBG_MATCH2)
+    {
+	char *env = getenv ("FC_DBG_MATCH_FILTER");
+	FcObjectSet *os = NULL;
+
+	if (env)
+	{
+	    char *ss, *s;
+	    char *p;
+	    FcBool f = FcTrue;
+
+	    ss = s = strdup (env);
+	    os = FcObjectSetCreate ();
+	    while (f)
+	    {
+		size_t len;
+		char *x;
+
+		if (!(p = strchr (s, ',')))
+		{
+		    f = FcFalse;
+		    len = strlen (s);
+		}
+		else
+		{
+		    len = (p - s);
+		}
+		x = malloc (sizeof (char) * (len + 1));
+		if (x)
+		{
+		    strcpy (x, s);
+		    if (FcObjectFromName (x) > 0)
+			FcObjectSetAdd (os, x);
+		    s = p + 1;
+		    free (x);
+		}
+	    }
+	    free (ss);
+	}
+	FcPatternPrint2 (p, pat, os);
+	if (os)
+	    FcObjectSetDestroy (os);
+    }
+    /* assuming that 'result' is initialized with FcResultNoMatch
+     * outside this function */
+    if (pat)
+	*result = FcResultMatch;
+
+    return pat;
+
+bail:
+    if (candidates != candidate_buf)
+	free (candidates);
+    FcCompareDataClear (&data);
+
+    return NULL;
+}
+
+/*
+ * Results of FcFontMatch and FcFontSort, remembered per configuration
+ * for callers which keep asking the same questions.  Entries are kept
+ * in a hash table keyed on the query pattern and recycled in least
+ * recently used order; the cache is disabled until a size is set.
+ */
+#define FC_MATCH_CACHE_MATCH	0
+#define FC_MATCH_CACHE_SORT	1
+#define FC_MATCH_CACHE_TRIM	2
+#define FC_MATCH_CACHE_CHARSET	4
+
+typedef struct _FcMatchCacheEntry FcMatchCacheEntry;
+
+struct _FcMatchCacheEntry {
+    FcMatchCacheEntry	*next;		/* hash chain */
+    FcMatchCacheEntry	*lru_prev;
+    FcMatchCacheEntry	*lru_next;
+    FcChar32		hash;
+    int			kind;
+    FcPattern		*pattern;
+    FcResult		result;
+    FcPattern		*match;		/* FcFontMatch result */
+    FcFontSet		*fonts;		/* FcFontSort result */
+    FcCharSet		*cs;
+};
+
+struct _FcMatchCache {
+    FcMutex		lock;
+    int			size;
+    int			nentry;
+    int			nbucket;
+    FcMatchCacheEntry	**buckets;
+    FcMatchCacheEntry	lru;		/* lru.lru_next is the most recent */
+    unsigned int	serial;
+    unsigned long	hits;
+    unsigned long	misses;
+};
+
+static void
+FcMatchCacheEntryDestroy (FcMatchCacheEntry *e)
+{
+    FcPatternDestroy (e->pattern);
+    if (e->match)
+	FcPatternDestroy (e->match);
+    if (e->fonts)
+	FcFontSetDestroy (e->fonts);
+    if (e->cs)
+	FcCharSetDestroy (e->cs);
+    free (e);
+}
+
+static void
+FcMatchCacheUnlink (FcMatchCache *cache, FcMatchCacheEntry *e)
+{
+    FcMatchCacheEntry **prev;
+
+    for (prev = &cache->buckets[e->hash & (cache->nbucket - 1)]; *prev != e; prev = &(*prev)->next)
+	;
+    *prev = e->next;
+    e->lru_prev->lru_next = e->lru_next;
+    e->lru_next->lru_prev = e->lru_prev;
+    cache->nentry--;
+}
+
+static void
+FcMatchCacheFlushLocked (FcMatchCache *cache)
+{
+    while (cache->lru.lru_next != &cache->lru)
+    {
+	FcMatchCacheEntry *e = cache->lru.lru_next;
+
+	FcMatchCacheUnlink (cache, e);
+	FcMatchCacheEntryDestroy (e);
+    }
+    cache->serial++;
+}
+
+void
+FcMatchCacheFlush (FcMatchCache *cache)
+{
+    if (!cache)
+	return;
+    FcMutexLock (&cache->lock);
+    FcMatchCacheFlushLocked (cache);
+    FcMutexUnlock (&cache->lock);
+}
+
+void
+FcMatchCacheDestroy (FcMatchCache *cache)
+{
+    if (!cache)
+	return;
+    FcMatchCacheFlushLocked (cache);
+    free (cache->buckets);
+    FcMutexFinish (&cache->lock);
+    free (cache);
+}
+
+/*
+ * FcPatternEqual ignores bindings, which do matter for matching.
+ */
+static FcBool
+FcMatchCachePatternEqual (const FcPattern *a, const FcPattern *b)
+{
+    FcValueListPtr la, lb;
+    int i;
+
+    if (!FcPatternEqual (a, b))
+	return FcFalse;
+    for (i = 0; i < a->num; i++)
+    {
+	for (la = FcPatternEltValues (&FcPatternElts (a)[i]),
+	     lb = FcPatternEltValues (&FcPatternElts (b)[i]);
+	     la && lb;
+	     la = FcValueListNext (la), lb = FcValueListNext (lb))
+	    if (la->binding != lb->binding)
+		return FcFalse;
+    }
+
+    return FcTrue;
+}
+
+/*
+ * Look up @p; on success the entry is left locked for the caller to
+ * copy the result out, otherwise the current serial is returned so
+ * that a result computed meanwhile isn't stored after a flush.
+ */
+static FcMatchCacheEntry *
+FcMatchCacheLookup (FcMatchCache    *cache,
+		    FcPattern	    *p,
+		    int		    kind,
+		    unsigned int    *serial)
+{
+    FcMatchCacheEntry	*e;
+    FcChar32		hash;
+
+    FcMutexLock (&cache->lock);
+    if (!cache->size)
+    {
+	FcMutexUnlock (&cache->lock);
+	return NULL;
+    }
+    hash = FcPatternHash (p) ^ kind;
+    for (e = cache->buckets[hash & (cache->nbucket - 1)]; e; e = e->next)
+    {
+	if (e->hash == hash && e->kind == kind &&
+	    FcMatchCachePatternEqual (e->pattern, p))
+	{
+	    e->lru_prev->lru_next = e->lru_next;
+	    e->lru_next->lru_prev = e->lru_prev;
+	    e->lru_prev = &cache->lru;
+	    e->lru_next = cache->lru.lru_next;
+	    e->lru_next->lru_prev = e;
+	    cache->lru.lru_next = e;
+	    cache->hits++;
+	    return e;
+	}
+    }
+    cache->misses++;
+    *serial = cache->serial;
+    FcMutexUnlock (&cache->lock);
+
+    return NULL;
+}
+
+/*
+ * Takes ownership of @match, @fonts and @cs.
+ */
+static void
+FcMatchCacheInsert (FcMatchCache    *cache,
+		    FcPattern	    *p,
+		    int		    kind,
+		    unsigned int    serial,
+		    FcResult	    result,
+		    FcPattern	    *match,
+		    FcFontSet	    *fonts,
+		    FcCharSet	    *cs)
+{
+    FcMatchCacheEntry	*e;
+    FcMatchCacheEntry	**bucket;
+
+    e = malloc (sizeof (FcMatchCacheEntry));
+    if (!e)
+	goto bail;
+    e->pattern = FcPatternDuplicate (p);
+    if (!e->pattern)
+    {
+	free (e);
+	goto bail;
+    }
+    e->hash = FcPatternHash (p) ^ kind;
+    e->kind = kind;
+    e->result = result;
+    e->match = match;
+    e->fonts = fonts;
+    e->cs = cs;
+
+    FcMutexLock (&cache->lock);
+    if (!cache->size || cache->serial != serial)
+    {
+	FcMutexUnlock (&cache->lock);
+	FcMatchCacheEntryDestroy (e);
+	return;
+    }
+    while (cache->nentry >= cache->size)
+    {
+	FcMatchCacheEntry *old = cache->lru.lru_prev;
+
+	FcMatchCacheUnlink (cache, old);
+	FcMatchCacheEntryDestroy (old);
+    }
+    bucket = &cache->buckets[e->hash & (cache->nbucket - 1)];
+    e->next = *bucket;
+    *bucket = e;
+    e->lru_prev = &cache->lru;
+    e->lru_next = cache->lru.lru_next;
+    e->lru_next->lru_prev = e;
+    cache->lru.lru_next = e;
+    cache->nentry++;
+    FcMutexUnlock (&cache->lock);
+
+    return;
+
+bail:
+    if (match)
+	FcPatternDestroy (match);
+    if (fonts)
+	FcFontSetDestroy (fonts);
+    if (cs)
+	FcCharSetDestroy (cs);
+}
+
+static FcFontSet *
+FcMatchCacheCopyFonts (const FcFontSet *fonts)
+{
+    FcFontSet	*ret;
+    int		i;
+
+    ret = FcFontSetCreate ();
+    if (!ret)
+	return NULL;
+    for (i = 0; i < fonts->nfont; i++)
+    {
+	FcPatternReference (fonts->fonts[i]);
+	if (!FcFontSetAdd (ret, fonts->fonts[i]))
+	{
+	    FcPatternDestroy (fonts->fonts[i]);
+	    FcFontSetDestroy (ret);
+	    return NULL;
+	}
+    }
+
+    return ret;
+}
+
+FcBool
+FcConfigSetMatchCacheSize (FcConfig *config, int size)
+{
+    FcMatchCache    *cache;
+    int		    nbucket;
+
+    if (size < 0)
+	return FcFalse;
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+retry:
+    cache = fc_atomic_ptr_get (&config->matchCache);
+    if (!cache)
+    {
+	cache = calloc (1, sizeof (FcMatchCache));
+	if (!cache)
+	    goto bail;
+	FcMutexInit (&cache->lock);
+	cache->lru.lru_prev = cache->lru.lru_next = &cache->lru;
+	if (!fc_atomic_ptr_cmpexch (&config->matchCache, NULL, cache))
+	{
+	    FcMatchCacheDestroy (cache);
+	    goto retry;
+	}
+    }
+
+    for (nbucket = 16; nbucket < size; nbucket *= 2)
+	;
+    FcMutexLock (&cache->lock);
+    FcMatchCacheFlushLocked (cache);
+    if (nbucket != cache->nbucket)
+    {
+	FcMatchCacheEntry **buckets = calloc (nbucket, sizeof (FcMatchCacheEntry *));
+
+	if (!buckets)
+	{
+	    FcMutexUnlock (&cache->lock);
+	    goto bail;
+	}
+	free (cache->buckets);
+	cache->buckets = buckets;
+	cache->nbucket = nbucket;
+    }
+    cache->size = size;
+    FcMutexUnlock (&cache->lock);
+    FcConfigDestroy (config);
+
+    return FcTrue;
+
+bail:
+    FcConfigDestroy (config);
+
+    return FcFalse;
+}
+
+int
+FcConfigGetMatchCacheSize (FcConfig *config)
+{
+    FcMatchCache    *cache;
+    int		    ret = 0;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return 0;
+    cache = fc_atomic_ptr_get (&config->matchCache);
+    if (cache)
+    {
+	FcMutexLock (&cache->lock);
+	ret = cache->size;
+	FcMutexUnlock (&cache->lock);
+    }
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+void
+FcConfigGetMatchCacheStats (FcConfig	    *config,
+			    unsigned long   *hits,
+			    unsigned long   *misses)
+{
+    FcMatchCache    *cache;
+
+    if (hits)
+	*hits = 0;
+    if (misses)
+	*misses = 0;
+    config = FcConfigReference (config);
+    if (!config)
+	return;
+    cache = fc_atomic_ptr_get (&config->matchCache);
+    if (cache)
+    {
+	FcMutexLock (&cache->lock);
+	if (hits)
+	    *hits = cache->hits;
+	if (misses)
+	    *misses = cache->misses;
+	FcMutexUnlock (&cache->lock);
+    }
+    FcConfigDestroy (config);
+}
+
+FcPattern *
+FcFontSetMatch (FcConfig    *config,
+		FcFontSet   **sets,
+		int	    nsets,
+		FcPattern   *p,
+		FcResult    *result)
+{
+    FcPattern	    *best, *ret = NULL;
+
+    assert (sets != NULL);
+    assert (p != NULL);
+    assert (result != NULL);
 
     *result = FcResultNoMatch;
 
     config = FcConfigReference (config);
     if (!config)
 	    return NULL;
-    best = FcFontSetMatchInternal (sets, nsets, p, result);
+    best = FcFontSetMatchInternal (sets, nsets, p,
+				   FcConfigFamilyIndex (config, sets, nsets),
+				   FcConfigScoreTable (config, sets, nsets),
+				   result);
+    if (best)
+    {
+	ret = FcFontRenderPrepare (config, p, best);
+	FcPatternDestroy (best);
+    }
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcPattern *
+FcFontMatch (FcConfig	*config,
+	     FcPattern	*p,
+	     FcResult	*result)
+{
+    FcFontSet	*sets[2];
+    int		nsets;
+    FcPattern   *best, *ret = NULL;
+    FcMatchCache *cache;
+    FcMatchCacheEntry *e;
+    unsigned int serial = 0;
+
+    assert (p != NULL);
+    assert (result != NULL);
+
+    *result = FcResultNoMatch;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+    cache = fc_atomic_ptr_get (&config->matchCache);
+    if (cache && (e = FcMatchCacheLookup (cache, p, FC_MATCH_CACHE_MATCH, &serial)))
+    {
+	if (e->match)
+	{
+	    ret = FcPatternDuplicate (e->match);
+	    if (ret)
+		*result = e->result;
+	}
+	FcMutexUnlock (&cache->lock);
+	goto bail;
+    }
+    nsets = 0;
+    if (config->fonts[FcSetSystem])
+	sets[nsets++] = config->fonts[FcSetSystem];
+    if (config->fonts[FcSetApplication])
+	sets[nsets++] = config->fonts[FcSetApplication];
+
+    best = FcFontSetMatchInternal (sets, nsets, p,
+				   FcConfigFamilyIndex (config, sets, nsets),
+				   FcConfigScoreTable (config, sets, nsets),
+				   result);
     if (best)
     {
 	ret = FcFontRenderPrepare (config, p, best);
 	FcPatternDestroy (best);
     }
+    if (cache && (ret || (!best && *result == FcResultNoMatch)))
+    {
+	FcPattern *match = NULL;
+
+	if (!ret || (match = FcPatternDuplicate (ret)))
+	    FcMatchCacheInsert (cache, p, FC_MATCH_CACHE_MATCH, serial,
+				*result, match, NULL, NULL);
+    }
 
+bail:
     FcConfigDestroy (config);
 
     return ret;
 }
 
-FcPattern *
-FcFontMatch (FcConfig	*config,
-	     FcPattern	*p,
-	     FcResult	*result)
-{
-    FcFontSet	*sets[2];
-    int		nsets;
-    FcPattern   *best, *ret = NULL;
+typedef struct _FcSortNode {
+    FcPattern	*pattern;
+    double	score[PRI_END];
+} FcSortNode;
+
+static int
+FcSortCompare (const void *aa, const void *ab)
+{
+    FcSortNode  *a = *(FcSortNode **) aa;
+    FcSortNode  *b = *(FcSortNode **) ab;
+    double	*as = &a->score[0];
+    double	*bs = &b->score[0];
+    double	ad = 0, bd = 0;
+    int         i;
+
+    i = PRI_END;
+    while (i-- && (ad = *as++) == (bd = *bs++))
+	;
+    if (ad != bd)
+	return ad < bd ? -1 : 1;
+    /* Nodes are laid out in set and font order; keep ties that way. */
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/*
+ * Score nodes[0..nnode-1], the fonts at positions pos onwards, against
+ * p.  Nothing written by FcCompare is shared between nodes and the
+ * compare data is only read, so disjoint ranges of nodes can be scored
+ * concurrently.
+ */
+static FcBool
+FcSortScore (FcPattern	    *p,
+	     FcSortNode	    *nodes,
+	     int	    nnode,
+	     int	    pos,
+	     FcCompareData  *data,
+	     FcResult	    *result)
+{
+    FcSortNode	*node;
+    int		i;
+
+    for (node = nodes; node < nodes + nnode; node++)
+    {
+	if (FcDebug () & FC_DBG_MATCHV)
+	{
+	    printf ("Font %d ", (int) (node - nodes));
+	    FcPatternPrint (node->pattern);
+	}
+	if (!FcCompare (p, node->pattern, node->score, result, data,
+			FcCompareDataSkip (data, pos + (int) (node - nodes))))
+	    return FcFalse;
+	if (FcDebug () & FC_DBG_MATCHV)
+	{
+	    printf ("Score");
+	    for (i = 0; i < PRI_END; i++)
+	    {
+		printf (" %g", node->score[i]);
+	    }
+	    printf ("\n");
+	}
+    }
+    if (nnode)
+	FcCompareDataScore (data, pos, nnode, nodes->score, sizeof (FcSortNode));
+
+    return FcTrue;
+}
+
+#if defined(HAVE_PTHREAD) && !defined(FC_NO_MT)
+
+#define FC_SORT_MAX_THREADS		16
+#define FC_SORT_MIN_NODES_PER_THREAD	256
+
+typedef struct _FcSortScoreJob {
+    FcPattern	    *p;
+    FcSortNode	    *nodes;
+    int		    nnode;
+    int		    pos;
+    FcCompareData   *data;
+    FcResult	    result;
+    FcBool	    ret;
+} FcSortScoreJob;
+
+static void *
+FcSortScoreThread (void *arg)
+{
+    FcSortScoreJob *job = arg;
+
+    job->ret = FcSortScore (job->p, job->nodes, job->nnode, job->pos,
+			    job->data, &job->result);
+
+    return NULL;
+}
+
+/*
+ * The number of threads FcFontSetSort may use for scoring, from
+ * FC_SORT_THREADS; scoring is done serially unless that is set.
+ */
+static int
+FcSortThreads (void)
+{
+    const char	*env = getenv ("FC_SORT_THREADS");
+    long	n;
+
+    if (!env)
+	return 1;
+    n = strtol (env, NULL, 10);
+    if (n < 1)
+	return 1;
+
+    return n > FC_SORT_MAX_THREADS ? FC_SORT_MAX_THREADS : n;
+}
+
+static FcBool
+FcSortScoreParallel (FcPattern	    *p,
+		     FcSortNode	    *nodes,
+		     int	    nnode,
+		     int	    pos,
+		     FcCompareData  *data,
+		     FcResult	    *result)
+{
+    FcSortScoreJob  jobs[FC_SORT_MAX_THREADS];
+    pthread_t	    threads[FC_SORT_MAX_THREADS];
+    FcBool	    started[FC_SORT_MAX_THREADS];
+    FcBool	    ret = FcTrue;
+    int		    nthread, i, start;
+
+    nthread = FcSortThreads ();
+    if (nthread > nnode / FC_SORT_MIN_NODES_PER_THREAD)
+	nthread = nnode / FC_SORT_MIN_NODES_PER_THREAD;
+    /* Debugging output has to come out in order */
+    if (nthread < 2 || (FcDebug () & FC_DBG_MATCHV))
+	return FcSortScore (p, nodes, nnode, pos, data, result);
+
+    for (i = 0, start = 0; i < nthread; i++)
+    {
+	int end = (int) ((long) nnode * (i + 1) / nthread);
+
+	jobs[i].p = p;
+	jobs[i].nodes = nodes + start;
+	jobs[i].nnode = end - start;
+	jobs[i].pos = pos + start;
+	jobs[i].data = data;
+	jobs[i].result = *result;
+	start = end;
+    }
+    /* The calling thread takes the first range itself. */
+    for (i = 1; i < nthread; i++)
+	started[i] = pthread_create (&threads[i], NULL, FcSortScoreThread, &jobs[i]) == 0;
+    FcSortScoreThread (&jobs[0]);
+    for (i = 1; i < nthread; i++)
+    {
+	if (started[i])
+	    pthread_join (threads[i], NULL);
+	else
+	    FcSortScoreThread (&jobs[i]);
+    }
+    for (i = 0; i < nthread; i++)
+    {
+	if (!jobs[i].ret)
+	{
+	    *result = jobs[i].result;
+	    ret = FcFalse;
+	    break;
+	}
+    }
+
+    return ret;
+}
+
+#else
 
-    assert (p != NULL);
-    assert (result != NULL);
+#define FcSortScoreParallel FcSortScore
 
-    *result = FcResultNoMatch;
+#endif
 
-    config = FcConfigReference (config);
-    if (!config)
-	return NULL;
-    nsets = 0;
-    if (config->fonts[FcSetSystem])
-	sets[nsets++] = config->fonts[FcSetSystem];
-    if (config->fonts[FcSetApplication])
-	sets[nsets++] = config->fonts[FcSetApplication];
+/*
+ * Binary min-heap of sort nodes in FcSortCompare order, used when only
+ * the head of the sorted list is wanted.
+ */
+static void
+FcSortHeapDown (FcSortNode **heap, int nnode, int i)
+{
+    FcSortNode	*node = heap[i];
+    int		child;
 
-    best = FcFontSetMatchInternal (sets, nsets, p, result);
-    if (best)
+    while ((child = 2 * i + 1) < nnode)
     {
-	ret = FcFontRenderPrepare (config, p, best);
-	FcPatternDestroy (best);
+	if (child + 1 < nnode && FcSortCompare (&heap[child + 1], &heap[child]) < 0)
+	    child++;
+	if (FcSortCompare (&heap[child], &node) >= 0)
+	    break;
+	heap[i] = heap[child];
+	i = child;
     }
+    heap[i] = node;
+}
 
-    FcConfigDestroy (config);
+static void
+FcSortHeapify (FcSortNode **heap, int nnode)
+{
+    int i;
 
-    return ret;
+    for (i = nnode / 2 - 1; i >= 0; i--)
+	FcSortHeapDown (heap, nnode, i);
 }
 
-typedef struct _FcSortNode {
-    FcPattern	*pattern;
-    double	score[PRI_END];
-} FcSortNode;
+static FcSortNode *
+FcSortHeapPop (FcSortNode **heap, int nnode)
+{
+    FcSortNode *top = heap[0];
 
-static int
-FcSortCompare (const void *aa, const void *ab)
+    heap[0] = heap[nnode - 1];
+    FcSortHeapDown (heap, nnode - 1, 0);
+
+    return top;
+}
+
+/*
+ * Check whether node covers one of the pattern languages not yet
+ * covered by an earlier node, and mark it covered if so.
+ */
+static FcBool
+FcSortNodeSatisfiesLang (FcPattern  *p,
+			 FcSortNode *node,
+			 int	    nPatternLang,
+			 FcBool	    *patternLangSat)
 {
-    FcSortNode  *a = *(FcSortNode **) aa;
-    FcSortNode  *b = *(FcSortNode **) ab;
-    double	*as = &a->score[0];
-    double	*bs = &b->score[0];
-    double	ad = 0, bd = 0;
-    int         i;
+    FcValue patternLang;
+    int	    i;
 
-    i = PRI_END;
-    while (i-- && (ad = *as++) == (bd = *bs++))
-	;
-    return ad < bd ? -1 : ad > bd ? 1 : 0;
+    for (i = 0; i < nPatternLang; i++)
+    {
+	FcValue	    nodeLang;
+
+	if (!patternLangSat[i] &&
+	    FcPatternGet (p, FC_LANG, i, &patternLang) == FcResultMatch &&
+	    FcPatternGet (node->pattern, FC_LANG, 0, &nodeLang) == FcResultMatch)
+	{
+	    FcValue matchValue;
+	    double  compare = FcCompareLang (&patternLang, &nodeLang, &matchValue);
+	    if (compare >= 0 && compare < 2)
+	    {
+		if (FcDebug () & FC_DBG_MATCHV)
+		{
+		    FcChar8 *family;
+		    FcChar8 *style;
+
+		    if (FcPatternGetString (node->pattern, FC_FAMILY, 0, &family) == FcResultMatch &&
+			FcPatternGetString (node->pattern, FC_STYLE, 0, &style) == FcResultMatch)
+			printf ("Font %s:%s matches language %d\n", family, style, i);
+		}
+		patternLangSat[i] = FcTrue;
+		return FcTrue;
+	    }
+	}
+    }
+
+    return FcFalse;
 }
 
+/*
+ * Emit fonts in sorted order.  With heap set, n is a heap and nodes
+ * are popped from it as they are needed.  The walk stops after limit
+ * fonts, if limit is positive, or once target is covered.
+ */
 static FcBool
-FcSortWalk (FcSortNode **n, int nnode, FcFontSet *fs, FcCharSet **csp, FcBool trim)
+FcSortWalk (FcSortNode	    **n,
+	    int		    nnode,
+	    FcBool	    heap,
+	    FcFontSet	    *fs,
+	    FcCharSet	    **csp,
+	    FcBool	    trim,
+	    int		    limit,
+	    const FcCharSet *target)
 {
     FcBool ret = FcFalse;
     FcCharSet *cs;
     int i;
 
     cs = 0;
-    if (trim || csp)
+    if (trim || csp || target)
     {
 	cs = FcCharSetCreate ();
 	if (cs == NULL)
@@ -1131,11 +2715,16 @@ FcSortWalk (FcSortNode **n, int nnode, FcFontSet *fs, FcCharSet **csp, FcBool tr
 
     for (i = 0; i < nnode; i++)
     {
-	FcSortNode	*node = *n++;
+	FcSortNode	*node;
 	FcBool		adds_chars = FcFalse;
 
+	if (limit > 0 && fs->nfont >= limit)
+	    break;
+	node = heap ? FcSortHeapPop (n, nnode - i) : n[i];
+
 	/*
-	 * Only fetch node charset if we'd need it
+	 * Only fetch node charset if we'd need it.  Fonts without one are
+	 * dropped as FcFontSort does, which doesn't look at a target.
 	 */
 	if (cs)
 	{
@@ -1143,9 +2732,11 @@ FcSortWalk (FcSortNode **n, int nnode, FcFontSet *fs, FcCharSet **csp, FcBool tr
 
 	    if (FcPatternGetCharSet (node->pattern, FC_CHARSET, 0, &ncs) !=
 		FcResultMatch)
-	        continue;
-
-	    if (!FcCharSetMerge (cs, ncs, &adds_chars))
+	    {
+		if (trim || csp)
+		    continue;
+	    }
+	    else if (!FcCharSetMerge (cs, ncs, &adds_chars))
 		goto bail;
 	}
 
@@ -1167,6 +2758,9 @@ FcSortWalk (FcSortNode **n, int nnode, FcFontSet *fs, FcCharSet **csp, FcBool tr
 		goto bail;
 	    }
 	}
+
+	if (target && adds_chars && FcCharSetIsSubset (target, cs))
+	    break;
     }
     if (csp)
     {
@@ -1189,14 +2783,67 @@ FcFontSetSortDestroy (FcFontSet *fs)
     FcFontSetDestroy (fs);
 }
 
-FcFontSet *
-FcFontSetSort (FcConfig	    *config FC_UNUSED,
-	       FcFontSet    **sets,
-	       int	    nsets,
-	       FcPattern    *p,
-	       FcBool	    trim,
-	       FcCharSet    **csp,
-	       FcResult	    *result)
+/*
+ * Only the first limit fonts are wanted.  Instead of sorting everything
+ * twice, settle the languages by popping nodes that match any of them
+ * off a heap, in sorted order, until each is covered; then heapify all
+ * nodes with their final scores for FcSortWalk to pop from.
+ */
+static FcBool
+FcSortPartial (FcPattern    *p,
+	       FcSortNode   **nodeps,
+	       int	    nnodes,
+	       int	    nPatternLang,
+	       FcBool	    *patternLangSat)
+{
+    FcSortNode	**heap, **sat;
+    double	*satscore;
+    int		nheap = 0, nsat = 0;
+    int		f;
+
+    heap = malloc (nnodes * sizeof (FcSortNode *) +
+		   nPatternLang * (sizeof (FcSortNode *) + sizeof (double)));
+    if (!heap)
+	return FcFalse;
+    sat = heap + nnodes;
+    satscore = (double *) (sat + nPatternLang);
+
+    for (f = 0; f < nnodes; f++)
+	if (nodeps[f]->score[PRI_LANG] < 2000)
+	    heap[nheap++] = nodeps[f];
+    FcSortHeapify (heap, nheap);
+    while (nheap && nsat < nPatternLang)
+    {
+	FcSortNode *node = FcSortHeapPop (heap, nheap--);
+
+	if (FcSortNodeSatisfiesLang (p, node, nPatternLang, patternLangSat))
+	{
+	    sat[nsat] = node;
+	    satscore[nsat] = node->score[PRI_LANG];
+	    nsat++;
+	}
+    }
+
+    for (f = 0; f < nnodes; f++)
+	nodeps[f]->score[PRI_LANG] = 10000.0;
+    for (f = 0; f < nsat; f++)
+	sat[f]->score[PRI_LANG] = satscore[f];
+    free (heap);
+
+    FcSortHeapify (nodeps, nnodes);
+
+    return FcTrue;
+}
+
+static FcFontSet *
+FcFontSetSortInternal (FcFontSet    **sets,
+		       int	    nsets,
+		       FcPattern    *p,
+		       FcBool	    trim,
+		       int	    limit,
+		       FcScoreTable *table,
+		       FcCharSet    **csp,
+		       FcResult	    *result)
 {
     FcFontSet	    *ret;
     FcFontSet	    *s;
@@ -1210,6 +2857,7 @@ FcFontSetSort (FcConfig	    *config FC_UNUSED,
     int		    nPatternLang;
     FcBool    	    *patternLangSat;
     FcValue	    patternLang;
+    FcCharSet	    *target = NULL;
     FcCompareData   data;
 
     assert (sets != NULL);
@@ -1256,6 +2904,7 @@ FcFontSetSort (FcConfig	    *config FC_UNUSED,
     patternLangSat = (FcBool *) (nodeps + nnodes);
 
     FcCompareDataInit (p, &data);
+    FcCompareDataSetTable (&data, p, table);
 
     new = nodes;
     nodep = nodeps;
@@ -1266,93 +2915,63 @@ FcFontSetSort (FcConfig	    *config FC_UNUSED,
 	    continue;
 	for (f = 0; f < s->nfont; f++)
 	{
-	    if (FcDebug () & FC_DBG_MATCHV)
-	    {
-		printf ("Font %d ", f);
-		FcPatternPrint (s->fonts[f]);
-	    }
 	    new->pattern = s->fonts[f];
-	    if (!FcCompare (p, new->pattern, new->score, result, &data))
-		goto bail1;
-	    if (FcDebug () & FC_DBG_MATCHV)
-	    {
-		printf ("Score");
-		for (i = 0; i < PRI_END; i++)
-		{
-		    printf (" %g", new->score[i]);
-		}
-		printf ("\n");
-	    }
 	    *nodep = new;
 	    new++;
 	    nodep++;
 	}
     }
 
+    if (!FcSortScoreParallel (p, nodes, new - nodes, 0, &data, result))
+    {
+	FcCompareDataClear (&data);
+	goto bail1;
+    }
+
     FcCompareDataClear (&data);
 
     nnodes = new - nodes;
 
-    qsort (nodeps, nnodes, sizeof (FcSortNode *),
-	   FcSortCompare);
-
     for (i = 0; i < nPatternLang; i++)
 	patternLangSat[i] = FcFalse;
 
-    for (f = 0; f < nnodes; f++)
+    if (limit > 0)
     {
-	FcBool	satisfies = FcFalse;
-	/*
-	 * If this node matches any language, go check
-	 * which ones and satisfy those entries
-	 */
-	if (nodeps[f]->score[PRI_LANG] < 2000)
+	if (!FcSortPartial (p, nodeps, nnodes, nPatternLang, patternLangSat))
+	    goto bail1;
+	if (FcPatternGetCharSet (p, FC_CHARSET, 0, &target) != FcResultMatch)
+	    target = NULL;
+    }
+    else
+    {
+	qsort (nodeps, nnodes, sizeof (FcSortNode *),
+	       FcSortCompare);
+
+	for (f = 0; f < nnodes; f++)
 	{
-	    for (i = 0; i < nPatternLang; i++)
+	    /*
+	     * If this node matches any language, go check
+	     * which ones and satisfy those entries
+	     */
+	    if (nodeps[f]->score[PRI_LANG] >= 2000 ||
+		!FcSortNodeSatisfiesLang (p, nodeps[f], nPatternLang, patternLangSat))
 	    {
-		FcValue	    nodeLang;
-
-		if (!patternLangSat[i] &&
-		    FcPatternGet (p, FC_LANG, i, &patternLang) == FcResultMatch &&
-		    FcPatternGet (nodeps[f]->pattern, FC_LANG, 0, &nodeLang) == FcResultMatch)
-		{
-		    FcValue matchValue;
-		    double  compare = FcCompareLang (&patternLang, &nodeLang, &matchValue);
-		    if (compare >= 0 && compare < 2)
-		    {
-			if (FcDebug () & FC_DBG_MATCHV)
-			{
-			    FcChar8 *family;
-			    FcChar8 *style;
-
-			    if (FcPatternGetString (nodeps[f]->pattern, FC_FAMILY, 0, &family) == FcResultMatch &&
-				FcPatternGetString (nodeps[f]->pattern, FC_STYLE, 0, &style) == FcResultMatch)
-				printf ("Font %s:%s matches language %d\n", family, style, i);
-			}
-			patternLangSat[i] = FcTrue;
-			satisfies = FcTrue;
-			break;
-		    }
-		}
+		nodeps[f]->score[PRI_LANG] = 10000.0;
 	    }
 	}
-	if (!satisfies)
-	{
-	    nodeps[f]->score[PRI_LANG] = 10000.0;
-	}
-    }
 
-    /*
-     * Re-sort once the language issues have been settled
-     */
-    qsort (nodeps, nnodes, sizeof (FcSortNode *),
-	   FcSortCompare);
+	/*
+	 * Re-sort once the language issues have been settled
+	 */
+	qsort (nodeps, nnodes, sizeof (FcSortNode *),
+	       FcSortCompare);
+    }
 
     ret = FcFontSetCreate ();
     if (!ret)
 	goto bail1;
 
-    if (!FcSortWalk (nodeps, nnodes, ret, csp, trim))
+    if (!FcSortWalk (nodeps, nnodes, limit > 0, ret, csp, trim, limit, target))
 	goto bail2;
 
     free (nodes);
@@ -1375,6 +2994,20 @@ bail0:
     return 0;
 }
 
+FcFontSet *
+FcFontSetSort (FcConfig	    *config,
+	       FcFontSet    **sets,
+	       int	    nsets,
+	       FcPattern    *p,
+	       FcBool	    trim,
+	       FcCharSet    **csp,
+	       FcResult	    *result)
+{
+    return FcFontSetSortInternal (sets, nsets, p, trim, -1,
+				  config ? FcConfigScoreTable (config, sets, nsets) : NULL,
+				  csp, result);
+}
+
 FcFontSet *
 FcFontSort (FcConfig	*config,
 	    FcPattern	*p,
@@ -1384,6 +3017,10 @@ FcFontSort (FcConfig	*config,
 {
     FcFontSet	*sets[2], *ret;
     int		nsets;
+    FcMatchCache *cache;
+    FcMatchCacheEntry *e;
+    unsigned int serial = 0;
+    int		kind;
 
     assert (p != NULL);
     assert (result != NULL);
@@ -1393,16 +3030,240 @@ FcFontSort (FcConfig	*config,
     config = FcConfigReference (config);
     if (!config)
 	return NULL;
+    kind = FC_MATCH_CACHE_SORT;
+    if (trim)
+	kind |= FC_MATCH_CACHE_TRIM;
+    if (csp)
+	kind |= FC_MATCH_CACHE_CHARSET;
+    cache = fc_atomic_ptr_get (&config->matchCache);
+    if (cache && (e = FcMatchCacheLookup (cache, p, kind, &serial)))
+    {
+	ret = FcMatchCacheCopyFonts (e->fonts);
+	if (ret && csp && e->cs)
+	{
+	    *csp = FcCharSetCopy (e->cs);
+	    if (!*csp)
+	    {
+		FcFontSetDestroy (ret);
+		ret = NULL;
+	    }
+	}
+	if (ret)
+	    *result = e->result;
+	FcMutexUnlock (&cache->lock);
+	goto bail;
+    }
     nsets = 0;
     if (config->fonts[FcSetSystem])
 	sets[nsets++] = config->fonts[FcSetSystem];
     if (config->fonts[FcSetApplication])
 	sets[nsets++] = config->fonts[FcSetApplication];
+    if (cache && csp)
+	*csp = NULL;
     ret = FcFontSetSort (config, sets, nsets, p, trim, csp, result);
+    if (cache && ret)
+    {
+	FcFontSet *fonts = FcMatchCacheCopyFonts (ret);
+	FcCharSet *cs = csp && *csp ? FcCharSetCopy (*csp) : NULL;
+
+	if (fonts && (!csp || !*csp || cs))
+	    FcMatchCacheInsert (cache, p, kind, serial,
+				*result, NULL, fonts, cs);
+	else
+	{
+	    if (fonts)
+		FcFontSetDestroy (fonts);
+	    if (cs)
+		FcCharSetDestroy (cs);
+	}
+    }
+
+bail:
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcFontSet *
+FcFontSortTopN (FcConfig    *config,
+		FcPattern   *p,
+		FcBool	    trim,
+		int	    n,
+		FcCharSet   **csp,
+		FcResult    *result)
+{
+    FcFontSet	*sets[2], *ret;
+    int		nsets;
+
+    assert (p != NULL);
+    assert (result != NULL);
+
+    if (n <= 0)
+	return FcFontSort (config, p, trim, csp, result);
+
+    *result = FcResultNoMatch;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+    nsets = 0;
+    if (config->fonts[FcSetSystem])
+	sets[nsets++] = config->fonts[FcSetSystem];
+    if (config->fonts[FcSetApplication])
+	sets[nsets++] = config->fonts[FcSetApplication];
+    ret = FcFontSetSortInternal (sets, nsets, p, trim, n,
+				 FcConfigScoreTable (config, sets, nsets),
+				 csp, result);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+/*
+ * Only the fonts with a leaf for the page of ucs4 shared by the fewest
+ * fonts are looked at and scored.  Without a coverage index, every font
+ * is checked against the whole run, as FcFontSetMatch does without a
+ * family index.
+ */
+FcFontSet *
+FcFontSortForChars (FcConfig	    *config,
+		    FcPattern	    *p,
+		    const FcChar32  *ucs4,
+		    int		    n,
+		    FcResult	    *result)
+{
+    FcFontSet	    *sets[2], *ret = NULL;
+    int		    nsets;
+    FcCoverageIndex *index;
+    FcFontSetsStamp stamp;
+    FcCompareData   data;
+    FcSortNode	    *nodes, **nodeps;
+    int		    nnode = 0, rarest = -1, others = 0;
+    int		    first, last, pos, i, j;
+
+    assert (p != NULL);
+    assert (result != NULL);
+
+    *result = FcResultNoMatch;
+    if (n < 0 || !ucs4)
+	n = 0;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+    nsets = FcConfigFontSets (config, sets);
+    if (!FcFontSetsStampInit (&stamp, sets, nsets))
+	goto bail0;
+    index = FcConfigCoverageIndex (config, sets, nsets);
+    for (i = 0; index && i < n; i++)
+    {
+	int page = FcCoverageIndexFind (index, ucs4[i] >> 8);
+
+	if (page < 0)
+	{
+	    /* Nothing covers ucs4[i] */
+	    ret = FcFontSetCreate ();
+	    goto bail0;
+	}
+	if (rarest < 0 ||
+	    index->start[page + 1] - index->start[page] <
+	    index->start[rarest + 1] - index->start[rarest])
+	    rarest = page;
+    }
+    if (!index)
+	others = n;
+    for (i = 0; index && i < n; i++)
+	if ((ucs4[i] >> 8) != index->pages[rarest])
+	    others++;
+    if (rarest >= 0)
+    {
+	first = index->start[rarest];
+	last = index->start[rarest + 1];
+    }
+    else
+    {
+	/* Every font covers an empty string */
+	first = 0;
+	for (last = 0, i = 0; i < stamp.nsets; i++)
+	    last += stamp.nfont[i];
+    }
+
+    if (first == last)
+    {
+	ret = FcFontSetCreate ();
+	goto bail0;
+    }
+    nodes = malloc ((last - first) * (sizeof (FcSortNode) + sizeof (FcSortNode *)));
+    if (!nodes)
+	goto bail0;
+    nodeps = (FcSortNode **) (nodes + (last - first));
+    FcCompareDataInit (p, &data);
+    FcCompareDataSetTable (&data, p, FcConfigScoreTable (config, sets, nsets));
+    for (j = first; j < last; j++)
+    {
+	FcSortNode  *node = &nodes[nnode];
+	FcCharSet   *cs;
+
+	if (rarest >= 0)
+	{
+	    const FcCharLeaf *leaf = index->leaves[j];
+
+	    for (i = 0; i < n; i++)
+	    {
+		FcChar32 c = ucs4[i];
+
+		if ((c >> 8) == index->pages[rarest] &&
+		    !(leaf->map[(c & 0xff) >> 5] & (1U << (c & 0x1f))))
+		    break;
+	    }
+	    if (i < n)
+		continue;
+	    pos = index->fonts[j];
+	}
+	else
+	    pos = j;
+	node->pattern = FcFontSetsStampFont (&stamp, pos);
+	if (others &&
+	    (FcPatternGetCharSet (node->pattern, FC_CHARSET, 0, &cs) != FcResultMatch ||
+	     FcCharSetHasChars (cs, ucs4, n, NULL) != n))
+	    continue;
+	if (!FcCompare (p, node->pattern, node->score, result, &data,
+			FcCompareDataSkip (&data, pos)))
+	{
+	    FcCompareDataClear (&data);
+	    goto bail1;
+	}
+	FcCompareDataScore (&data, pos, 1, node->score, sizeof (FcSortNode));
+	nodeps[nnode++] = node;
+    }
+    FcCompareDataClear (&data);
+
+    qsort (nodeps, nnode, sizeof (FcSortNode *), FcSortCompare);
+
+    ret = FcFontSetCreate ();
+    if (!ret)
+	goto bail1;
+    for (i = 0; i < nnode; i++)
+    {
+	FcPatternReference (nodeps[i]->pattern);
+	if (!FcFontSetAdd (ret, nodeps[i]->pattern))
+	{
+	    FcPatternDestroy (nodeps[i]->pattern);
+	    FcFontSetDestroy (ret);
+	    ret = NULL;
+	    goto bail1;
+	}
+    }
+    *result = nnode ? FcResultMatch : FcResultNoMatch;
+
+bail1:
+    free (nodes);
+bail0:
     FcConfigDestroy (config);
 
     return ret;
 }
+
 #define __fcmatch__
 #include "fcaliastail.h"
 #undef __fcmatch__
@@ -346,6 +346,182 @@ FcExprDestroy (FcExpr *e)
     e->op = FcOpNil;
 }
 
+/*
+ * Replace the value of an operator by a literal once its operands are
+ * all literals; FcConfigEvaluate doesn't need the pattern for those.
+ */
+static FcBool
+FcExprFoldValue (FcExpr *e)
+{
+    FcValue v = FcConfigEvaluate (NULL, NULL, FcMatchPattern, e);
+
+    switch ((int) v.type) {
+    case FcTypeVoid:
+    case FcTypeInteger:
+    case FcTypeDouble:
+    case FcTypeString:
+    case FcTypeBool:
+    case FcTypeCharSet:
+    case FcTypeLangSet:
+    case FcTypeRange:
+	break;
+    default:
+	FcValueDestroy (v);
+	return FcFalse;
+    }
+    switch (FC_OP_GET_OP (e->op)) {
+    case FcOpNot:
+    case FcOpFloor:
+    case FcOpCeil:
+    case FcOpRound:
+    case FcOpTrunc:
+	FcExprDestroy (e->u.tree.left);
+	break;
+    default:
+	FcExprDestroy (e->u.tree.left);
+	FcExprDestroy (e->u.tree.right);
+	break;
+    }
+    switch ((int) v.type) {
+    case FcTypeVoid:
+	e->op = FcOpNil;
+	break;
+    case FcTypeInteger:
+	e->op = FcOpInteger;
+	e->u.ival = v.u.i;
+	break;
+    case FcTypeDouble:
+	e->op = FcOpDouble;
+	e->u.dval = v.u.d;
+	break;
+    case FcTypeString:
+	e->op = FcOpString;
+	e->u.sval = (FcChar8 *) v.u.s;
+	break;
+    case FcTypeBool:
+	e->op = FcOpBool;
+	e->u.bval = v.u.b;
+	break;
+    case FcTypeCharSet:
+	e->op = FcOpCharSet;
+	e->u.cval = (FcCharSet *) v.u.c;
+	break;
+    case FcTypeLangSet:
+	e->op = FcOpLangSet;
+	e->u.lval = (FcLangSet *) v.u.l;
+	break;
+    case FcTypeRange:
+	e->op = FcOpRange;
+	e->u.rval = (FcRange *) v.u.r;
+	break;
+    }
+
+    return FcTrue;
+}
+
+/*
+ * Work out the parts of a rule's expression which don't depend on the
+ * pattern once, instead of on every substitution: constant names are
+ * looked up, operators on literals are replaced by their value and
+ * <if> with a literal condition by the branch it takes.  Returns
+ * whether e ends up as a literal.
+ */
+static FcBool
+FcExprFold (FcExpr *e)
+{
+    FcExpr  *cond, *branch, *other;
+    FcBool  l, r;
+    int	    i;
+
+    if (!e)
+	return FcFalse;
+    switch (FC_OP_GET_OP (e->op)) {
+    case FcOpInteger:
+    case FcOpDouble:
+    case FcOpString:
+    case FcOpBool:
+    case FcOpCharSet:
+    case FcOpLangSet:
+    case FcOpRange:
+    case FcOpNil:
+	return FcTrue;
+    case FcOpConst:
+	if (!FcNameConstant (e->u.constant, &i))
+	    return FcFalse;
+	FcFree (e->u.constant);
+	e->op = FcOpInteger;
+	e->u.ival = i;
+	return FcTrue;
+    case FcOpMatrix:
+	FcExprFold (e->u.mexpr->xx);
+	FcExprFold (e->u.mexpr->xy);
+	FcExprFold (e->u.mexpr->yx);
+	FcExprFold (e->u.mexpr->yy);
+	return FcFalse;
+    case FcOpQuest:
+	/* The branches hang off a second FcOpQuest node */
+	if (!e->u.tree.right || FC_OP_GET_OP (e->u.tree.right->op) != FcOpQuest)
+	    return FcFalse;
+	cond = e->u.tree.left;
+	l = FcExprFold (cond);
+	FcExprFold (e->u.tree.right->u.tree.left);
+	FcExprFold (e->u.tree.right->u.tree.right);
+	if (!l || FC_OP_GET_OP (cond->op) != FcOpBool)
+	    return FcFalse;
+	if (cond->u.bval)
+	{
+	    branch = e->u.tree.right->u.tree.left;
+	    other = e->u.tree.right->u.tree.right;
+	}
+	else
+	{
+	    branch = e->u.tree.right->u.tree.right;
+	    other = e->u.tree.right->u.tree.left;
+	}
+	if (!branch)
+	    return FcFalse;
+	FcExprDestroy (other);
+	/* The nodes themselves belong to the config's pool */
+	*e = *branch;
+	branch->op = FcOpNil;
+	return FcExprFold (e);
+    case FcOpComma:
+	FcExprFold (e->u.tree.left);
+	FcExprFold (e->u.tree.right);
+	return FcFalse;
+    case FcOpOr:
+    case FcOpAnd:
+    case FcOpEqual:
+    case FcOpNotEqual:
+    case FcOpLess:
+    case FcOpLessEqual:
+    case FcOpMore:
+    case FcOpMoreEqual:
+    case FcOpContains:
+    case FcOpNotContains:
+    case FcOpListing:
+    case FcOpPlus:
+    case FcOpMinus:
+    case FcOpTimes:
+    case FcOpDivide:
+	l = FcExprFold (e->u.tree.left);
+	r = FcExprFold (e->u.tree.right);
+	if (!l || !r)
+	    return FcFalse;
+	return FcExprFoldValue (e);
+    case FcOpNot:
+    case FcOpFloor:
+    case FcOpCeil:
+    case FcOpRound:
+    case FcOpTrunc:
+	if (!FcExprFold (e->u.tree.left))
+	    return FcFalse;
+	return FcExprFoldValue (e);
+    default:
+	return FcFalse;
+    }
+}
+
 void
 FcEditDestroy (FcEdit *e)
 {
@@ -617,6 +793,9 @@ FcConfigMessage (FcConfigParse *parse, FcConfigSeverity severe, const char *fmt,
 		     (int)XML_GetCurrentLineNumber (parse->parser));
 	if (severe >= FcSevereError)
 	    parse->error = FcTrue;
+	/* Don't save a result which would skip the message next time */
+	if (severe >= FcSevereWarning)
+	    parse->config->uncompilable = FcTrue;
     }
     else
 	fprintf (stderr, "Fontconfig %s: ", s);
@@ -803,6 +982,7 @@ FcTestCreate (FcConfigParse *parse,
 	o = FcNameGetObjectType (FcObjectName (test->object));
 	if (o)
 	    FcTypecheckExpr (parse, expr, o->type);
+	FcExprFold (expr);
     }
     return test;
 }
@@ -827,6 +1007,7 @@ FcEditCreate (FcConfigParse	*parse,
 	o = FcNameGetObjectType (FcObjectName (e->object));
 	if (o)
 	    FcTypecheckExpr (parse, expr, o->type);
+	FcExprFold (expr);
     }
     return e;
 }
@@ -1315,11 +1496,15 @@ _get_real_paths_from_prefix(FcConfigParse *parse, const FcChar8 *path, const FcC
 		return NULL;
 	    }
 	}
-	else if (FcStrCmp (prefix, (const FcChar8 *) "default") == 0 ||
-		 FcStrCmp (prefix, (const FcChar8 *) "cwd") == 0)
+	else if (FcStrCmp (prefix, (const FcChar8 *) "default") == 0)
 	{
 	    /* Nothing to do */
 	}
+	else if (FcStrCmp (prefix, (const FcChar8 *) "cwd") == 0)
+	{
+	    /* The result depends on where the program was started */
+	    parse->config->uncompilable = FcTrue;
+	}
 	else if (FcStrCmp (prefix, (const FcChar8 *) "relative") == 0)
 	{
 	    FcChar8 *p = FcStrRealPath (parse->name);
@@ -2602,6 +2787,7 @@ FcParseInclude (FcConfigParse *parse)
 	    FcPtrListIterAdd (parse->config->subst[k], &iter, ruleset);
 	}
     }
+    FcConfigRulesChanged (parse->config);
     FcRuleSetDestroy (ruleset);
     if (!_FcConfigParse (parse->config, s, !ignore_missing, !parse->scanOnly))
 	parse->error = FcTrue;
@@ -3569,6 +3755,7 @@ FcConfigParseAndLoadFromMemoryInternal (FcConfig       *config,
 		FcPtrListIterAdd (parse.config->subst[k], &iter, parse.ruleset);
 	    }
 	}
+	FcConfigRulesChanged (parse.config);
     }
     FcPtrListIterInitAtLast (parse.config->rulesetList, &liter);
     FcRuleSetReference (parse.ruleset);
@@ -3610,6 +3797,9 @@ _FcConfigParse (FcConfig	*config,
     filename = FcConfigGetFilename (config, name);
     if (!filename)
     {
+	/* Parsing again has to notice if this turns up */
+	if (name && !FcStrSetAdd (config->missingConfigFiles, name))
+	    config->uncompilable = FcTrue;
 	FcStrBufString (&reason, (FcChar8 *)"No such file: ");
 	FcStrBufString (&reason, name ? name : (FcChar8 *)"(null)");
 	goto bail0;
@@ -3730,6 +3920,1214 @@ FcConfigParseAndLoadFromMemory (FcConfig       *config,
     return FcConfigParseAndLoadFromMemoryInternal (config, (const FcChar8 *)"memory", buffer, complain, FcTrue);
 }
 
+/*
+ * Compiled configurations
+ *
+ * Parsing the configuration files is a good share of the start-up time
+ * of short-lived programs, so FcInitLoadOwnConfig keeps the parsed
+ * result in a cache file and loads that instead while none of the files
+ * which went into it have changed.  The file is a stream of native
+ * values: a header, the key naming the environment it was parsed in,
+ * the state of each file the parse looked at and then the parsed
+ * directories, rules and selections.  It is read into a scratch
+ * configuration which is only moved into place once all of it has
+ * been decoded.
+ */
+
+#define FC_COMPILED_CONFIG_MAGIC    0xFC02FC06
+#define FC_COMPILED_CONFIG_VERSION  2
+
+typedef struct _FcCompiledReader {
+    const FcChar8   *p;
+    const FcChar8   *end;
+    FcBool	    failed;
+} FcCompiledReader;
+
+static void
+FcCompiledPutInt (FcStrBuf *buf, int i)
+{
+    FcStrBufData (buf, (const FcChar8 *) &i, sizeof (i));
+}
+
+static void
+FcCompiledPutLong (FcStrBuf *buf, int64_t l)
+{
+    FcStrBufData (buf, (const FcChar8 *) &l, sizeof (l));
+}
+
+static void
+FcCompiledPutDouble (FcStrBuf *buf, double d)
+{
+    FcStrBufData (buf, (const FcChar8 *) &d, sizeof (d));
+}
+
+static void
+FcCompiledPutString (FcStrBuf *buf, const FcChar8 *s)
+{
+    int len;
+
+    if (!s)
+    {
+	FcCompiledPutInt (buf, -1);
+	return;
+    }
+    len = strlen ((const char *) s);
+    FcCompiledPutInt (buf, len);
+    FcStrBufData (buf, s, len + 1);
+}
+
+static void
+FcCompiledPutObject (FcStrBuf *buf, FcObject object)
+{
+    FcCompiledPutString (buf, (const FcChar8 *) FcObjectName (object));
+}
+
+static void
+FcCompiledPutStrSet (FcStrBuf *buf, FcStrSet *set, FcBool triples)
+{
+    int i;
+
+    FcCompiledPutInt (buf, set->num);
+    for (i = 0; i < set->num; i++)
+    {
+	FcCompiledPutString (buf, set->strs[i]);
+	if (triples)
+	{
+	    FcCompiledPutString (buf, FcStrTripleSecond (set->strs[i]));
+	    FcCompiledPutString (buf, FcStrTripleThird (set->strs[i]));
+	}
+    }
+}
+
+static FcBool
+FcCompiledPutCharSet (FcStrBuf *buf, const FcCharSet *c)
+{
+    FcChar32 map[FC_CHARSET_MAP_SIZE], next, page;
+
+    for (page = FcCharSetFirstPage (c, map, &next);
+	 page != FC_CHARSET_DONE;
+	 page = FcCharSetNextPage (c, map, &next))
+    {
+	FcStrBufData (buf, (const FcChar8 *) &page, sizeof (page));
+	FcStrBufData (buf, (const FcChar8 *) map, sizeof (map));
+    }
+    FcStrBufData (buf, (const FcChar8 *) &page, sizeof (page));
+
+    return FcTrue;
+}
+
+static FcBool
+FcCompiledPutLangSet (FcStrBuf *buf, const FcLangSet *ls)
+{
+    FcStrSet *langs = FcLangSetGetLangs (ls);
+
+    if (!langs)
+	return FcFalse;
+    FcCompiledPutStrSet (buf, langs, FcFalse);
+    FcStrSetDestroy (langs);
+
+    return FcTrue;
+}
+
+static FcBool
+FcCompiledPutValue (FcStrBuf *buf, const FcValue *v)
+{
+    double begin, end;
+
+    FcCompiledPutInt (buf, v->type);
+    switch (v->type) {
+    case FcTypeVoid:
+	break;
+    case FcTypeInteger:
+	FcCompiledPutInt (buf, v->u.i);
+	break;
+    case FcTypeDouble:
+	FcCompiledPutDouble (buf, v->u.d);
+	break;
+    case FcTypeString:
+	FcCompiledPutString (buf, v->u.s);
+	break;
+    case FcTypeBool:
+	FcCompiledPutInt (buf, v->u.b);
+	break;
+    case FcTypeMatrix:
+	FcCompiledPutDouble (buf, v->u.m->xx);
+	FcCompiledPutDouble (buf, v->u.m->xy);
+	FcCompiledPutDouble (buf, v->u.m->yx);
+	FcCompiledPutDouble (buf, v->u.m->yy);
+	break;
+    case FcTypeCharSet:
+	return FcCompiledPutCharSet (buf, v->u.c);
+    case FcTypeLangSet:
+	return FcCompiledPutLangSet (buf, v->u.l);
+    case FcTypeRange:
+	FcRangeGetDouble (v->u.r, &begin, &end);
+	FcCompiledPutDouble (buf, begin);
+	FcCompiledPutDouble (buf, end);
+	break;
+    default:
+	return FcFalse;
+    }
+
+    return FcTrue;
+}
+
+static FcBool
+FcCompiledPutPattern (FcStrBuf *buf, FcPattern *p)
+{
+    FcPatternIter   iter;
+    FcValue	    v;
+    FcValueBinding  binding;
+    int		    i, n;
+
+    FcCompiledPutInt (buf, FcPatternObjectCount (p));
+    FcPatternIterStart (p, &iter);
+    if (FcPatternIterIsValid (p, &iter))
+    {
+	do
+	{
+	    FcCompiledPutString (buf, (const FcChar8 *) FcPatternIterGetObject (p, &iter));
+	    n = FcPatternIterValueCount (p, &iter);
+	    FcCompiledPutInt (buf, n);
+	    for (i = 0; i < n; i++)
+	    {
+		if (FcPatternIterGetValue (p, &iter, i, &v, &binding) != FcResultMatch)
+		    return FcFalse;
+		FcCompiledPutInt (buf, binding);
+		if (!FcCompiledPutValue (buf, &v))
+		    return FcFalse;
+	    }
+	} while (FcPatternIterNext (p, &iter));
+    }
+
+    return FcTrue;
+}
+
+static FcBool
+FcCompiledPutExpr (FcStrBuf *buf, const FcExpr *e)
+{
+    double begin, end;
+
+    if (!e)
+    {
+	FcCompiledPutInt (buf, -1);
+	return FcTrue;
+    }
+    FcCompiledPutInt (buf, e->op);
+    switch (FC_OP_GET_OP (e->op)) {
+    case FcOpInteger:
+	FcCompiledPutInt (buf, e->u.ival);
+	break;
+    case FcOpDouble:
+	FcCompiledPutDouble (buf, e->u.dval);
+	break;
+    case FcOpString:
+	FcCompiledPutString (buf, e->u.sval);
+	break;
+    case FcOpMatrix:
+	return FcCompiledPutExpr (buf, e->u.mexpr->xx) &&
+	    FcCompiledPutExpr (buf, e->u.mexpr->xy) &&
+	    FcCompiledPutExpr (buf, e->u.mexpr->yx) &&
+	    FcCompiledPutExpr (buf, e->u.mexpr->yy);
+    case FcOpRange:
+	FcRangeGetDouble (e->u.rval, &begin, &end);
+	FcCompiledPutDouble (buf, begin);
+	FcCompiledPutDouble (buf, end);
+	break;
+    case FcOpBool:
+	FcCompiledPutInt (buf, e->u.bval);
+	break;
+    case FcOpCharSet:
+	return FcCompiledPutCharSet (buf, e->u.cval);
+    case FcOpLangSet:
+	return FcCompiledPutLangSet (buf, e->u.lval);
+    case FcOpField:
+	FcCompiledPutObject (buf, e->u.name.object);
+	FcCompiledPutInt (buf, e->u.name.kind);
+	break;
+    case FcOpConst:
+	FcCompiledPutString (buf, e->u.constant);
+	break;
+    case FcOpNil:
+    case FcOpInvalid:
+	break;
+    default:
+	return FcCompiledPutExpr (buf, e->u.tree.left) &&
+	    FcCompiledPutExpr (buf, e->u.tree.right);
+    }
+
+    return FcTrue;
+}
+
+static FcBool
+FcCompiledPutRule (FcStrBuf *buf, const FcRule *rule)
+{
+    const FcRule    *r;
+    int		    n = 0;
+
+    for (r = rule; r; r = r->next)
+	n++;
+    FcCompiledPutInt (buf, n);
+    for (r = rule; r; r = r->next)
+    {
+	FcCompiledPutInt (buf, r->type);
+	switch (r->type) {
+	case FcRuleTest:
+	    FcCompiledPutInt (buf, r->u.test->kind);
+	    FcCompiledPutInt (buf, r->u.test->qual);
+	    FcCompiledPutObject (buf, r->u.test->object);
+	    FcCompiledPutInt (buf, r->u.test->op);
+	    if (!FcCompiledPutExpr (buf, r->u.test->expr))
+		return FcFalse;
+	    break;
+	case FcRuleEdit:
+	    FcCompiledPutObject (buf, r->u.edit->object);
+	    FcCompiledPutInt (buf, r->u.edit->op);
+	    FcCompiledPutInt (buf, r->u.edit->binding);
+	    if (!FcCompiledPutExpr (buf, r->u.edit->expr))
+		return FcFalse;
+	    break;
+	default:
+	    return FcFalse;
+	}
+    }
+
+    return FcTrue;
+}
+
+/*
+ * Rule sets are written once each and referred to by their index
+ * from the lists they are on; a file containing <include> is split
+ * into several rule sets, not all of which are on every list.
+ */
+static int
+FcCompiledRuleSetIndex (FcPtrList *rulesets, FcRuleSet *rs)
+{
+    FcPtrListIter   iter;
+    int		    i = 0;
+
+    FcPtrListIterInit (rulesets, &iter);
+    for (; FcPtrListIterIsValid (rulesets, &iter); FcPtrListIterNext (rulesets, &iter), i++)
+	if (FcPtrListIterGetValue (rulesets, &iter) == rs)
+	    return i;
+
+    return -1;
+}
+
+static FcBool
+FcCompiledPutRuleSetList (FcStrBuf *buf, FcPtrList *rulesets, FcPtrList *list)
+{
+    FcPtrListIter   iter;
+    int		    n = 0;
+
+    FcPtrListIterInit (list, &iter);
+    for (; FcPtrListIterIsValid (list, &iter); FcPtrListIterNext (list, &iter))
+	n++;
+    FcCompiledPutInt (buf, n);
+    FcPtrListIterInit (list, &iter);
+    for (; FcPtrListIterIsValid (list, &iter); FcPtrListIterNext (list, &iter))
+	FcCompiledPutInt (buf, FcCompiledRuleSetIndex (rulesets, FcPtrListIterGetValue (list, &iter)));
+
+    return FcTrue;
+}
+
+static FcBool
+FcCompiledAddRuleSets (FcPtrList *rulesets, FcPtrList *list)
+{
+    FcPtrListIter   iter, last;
+    FcRuleSet	    *rs;
+
+    FcPtrListIterInit (list, &iter);
+    for (; FcPtrListIterIsValid (list, &iter); FcPtrListIterNext (list, &iter))
+    {
+	rs = FcPtrListIterGetValue (list, &iter);
+	if (FcCompiledRuleSetIndex (rulesets, rs) < 0)
+	{
+	    FcPtrListIterInitAtLast (rulesets, &last);
+	    FcRuleSetReference (rs);
+	    if (!FcPtrListIterAdd (rulesets, &last, rs))
+	    {
+		FcRuleSetDestroy (rs);
+		return FcFalse;
+	    }
+	}
+    }
+
+    return FcTrue;
+}
+
+static void
+FcCompiledPutStat (FcStrBuf *buf, const FcChar8 *file)
+{
+    struct stat statb;
+
+    if (FcStat (file, &statb) < 0)
+    {
+	FcCompiledPutLong (buf, -1);
+	FcCompiledPutLong (buf, 0);
+	FcCompiledPutLong (buf, 0);
+	return;
+    }
+    FcCompiledPutLong (buf, (int64_t) statb.st_mtime);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    FcCompiledPutLong (buf, (int64_t) statb.st_mtim.tv_nsec);
+#else
+    FcCompiledPutLong (buf, 0);
+#endif
+    FcCompiledPutLong (buf, (int64_t) statb.st_size);
+}
+
+static FcBool
+FcCompiledPutConfig (FcStrBuf *buf, FcConfig *config, const FcChar8 *key)
+{
+    FcPtrList	    *rulesets;
+    FcPtrListIter   iter;
+    FcRuleSet	    *rs;
+    FcMatchKind	    k;
+    FcBool	    ret = FcFalse;
+    int		    i, n;
+
+    FcCompiledPutInt (buf, FC_COMPILED_CONFIG_MAGIC);
+    FcCompiledPutInt (buf, FC_COMPILED_CONFIG_VERSION);
+    FcCompiledPutString (buf, key);
+
+    /* What the result depends on */
+    FcCompiledPutInt (buf, config->availConfigFiles->num);
+    for (i = 0; i < config->availConfigFiles->num; i++)
+    {
+	FcCompiledPutString (buf, config->availConfigFiles->strs[i]);
+	FcCompiledPutStat (buf, config->availConfigFiles->strs[i]);
+    }
+    FcCompiledPutStrSet (buf, config->missingConfigFiles, FcFalse);
+
+    FcCompiledPutStrSet (buf, config->configDirs, FcFalse);
+    FcCompiledPutStrSet (buf, config->fontDirs, FcTrue);
+    FcCompiledPutStrSet (buf, config->cacheDirs, FcFalse);
+    FcCompiledPutStrSet (buf, config->configFiles, FcFalse);
+    FcCompiledPutStrSet (buf, config->availConfigFiles, FcFalse);
+    FcCompiledPutStrSet (buf, config->acceptGlobs, FcFalse);
+    FcCompiledPutStrSet (buf, config->rejectGlobs, FcFalse);
+    FcCompiledPutInt (buf, config->acceptPatterns->nfont);
+    for (i = 0; i < config->acceptPatterns->nfont; i++)
+	if (!FcCompiledPutPattern (buf, config->acceptPatterns->fonts[i]))
+	    return FcFalse;
+    FcCompiledPutInt (buf, config->rejectPatterns->nfont);
+    for (i = 0; i < config->rejectPatterns->nfont; i++)
+	if (!FcCompiledPutPattern (buf, config->rejectPatterns->fonts[i]))
+	    return FcFalse;
+    FcCompiledPutInt (buf, config->rescanInterval);
+
+    rulesets = FcPtrListCreate ((FcDestroyFunc) FcRuleSetDestroy);
+    if (!rulesets)
+	return FcFalse;
+    if (!FcCompiledAddRuleSets (rulesets, config->rulesetList))
+	goto bail;
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	if (!FcCompiledAddRuleSets (rulesets, config->subst[k]))
+	    goto bail;
+    n = 0;
+    FcPtrListIterInit (rulesets, &iter);
+    for (; FcPtrListIterIsValid (rulesets, &iter); FcPtrListIterNext (rulesets, &iter))
+	n++;
+    FcCompiledPutInt (buf, n);
+    FcPtrListIterInit (rulesets, &iter);
+    for (; FcPtrListIterIsValid (rulesets, &iter); FcPtrListIterNext (rulesets, &iter))
+    {
+	rs = FcPtrListIterGetValue (rulesets, &iter);
+	FcCompiledPutString (buf, rs->name);
+	FcCompiledPutString (buf, rs->description);
+	FcCompiledPutString (buf, rs->domain);
+	FcCompiledPutInt (buf, rs->enabled);
+	for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	{
+	    FcPtrListIter iter2;
+
+	    n = 0;
+	    FcPtrListIterInit (rs->subst[k], &iter2);
+	    for (; FcPtrListIterIsValid (rs->subst[k], &iter2); FcPtrListIterNext (rs->subst[k], &iter2))
+		n++;
+	    FcCompiledPutInt (buf, n);
+	    FcPtrListIterInit (rs->subst[k], &iter2);
+	    for (; FcPtrListIterIsValid (rs->subst[k], &iter2); FcPtrListIterNext (rs->subst[k], &iter2))
+		if (!FcCompiledPutRule (buf, FcPtrListIterGetValue (rs->subst[k], &iter2)))
+		    goto bail;
+	}
+    }
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	FcCompiledPutRuleSetList (buf, rulesets, config->subst[k]);
+    FcCompiledPutRuleSetList (buf, rulesets, config->rulesetList);
+    ret = !buf->failed;
+bail:
+    FcPtrListDestroy (rulesets);
+
+    return ret;
+}
+
+static const FcChar8 *
+FcCompiledGet (FcCompiledReader *r, int len)
+{
+    const FcChar8 *p = r->p;
+
+    if (r->failed || len < 0 || r->end - r->p < len)
+    {
+	r->failed = FcTrue;
+	return NULL;
+    }
+    r->p += len;
+
+    return p;
+}
+
+static int
+FcCompiledGetInt (FcCompiledReader *r)
+{
+    const FcChar8   *p = FcCompiledGet (r, sizeof (int));
+    int		    i = 0;
+
+    if (p)
+	memcpy (&i, p, sizeof (i));
+
+    return i;
+}
+
+static int64_t
+FcCompiledGetLong (FcCompiledReader *r)
+{
+    const FcChar8   *p = FcCompiledGet (r, sizeof (int64_t));
+    int64_t	    l = 0;
+
+    if (p)
+	memcpy (&l, p, sizeof (l));
+
+    return l;
+}
+
+static double
+FcCompiledGetDouble (FcCompiledReader *r)
+{
+    const FcChar8   *p = FcCompiledGet (r, sizeof (double));
+    double	    d = 0;
+
+    if (p)
+	memcpy (&d, p, sizeof (d));
+
+    return d;
+}
+
+/* Strings are used in place; NULL is a valid string too, check failed */
+static const FcChar8 *
+FcCompiledGetString (FcCompiledReader *r)
+{
+    int		    len = FcCompiledGetInt (r);
+    const FcChar8   *s;
+
+    if (len == -1)
+	return NULL;
+    s = FcCompiledGet (r, len + 1);
+    if (s && s[len] != '\0')
+    {
+	r->failed = FcTrue;
+	return NULL;
+    }
+
+    return s;
+}
+
+static FcObject
+FcCompiledGetObject (FcCompiledReader *r)
+{
+    const FcChar8 *name = FcCompiledGetString (r);
+
+    return name ? FcObjectFromName ((const char *) name) : 0;
+}
+
+static FcBool
+FcCompiledGetStrSet (FcCompiledReader *r, FcStrSet *set, FcBool triples)
+{
+    const FcChar8   *s, *second, *third;
+    int		    i, n = FcCompiledGetInt (r);
+
+    for (i = 0; !r->failed && i < n; i++)
+    {
+	s = FcCompiledGetString (r);
+	if (triples)
+	{
+	    second = FcCompiledGetString (r);
+	    third = FcCompiledGetString (r);
+	    if (!r->failed && !FcStrSetAddTriple (set, s, second, third))
+		return FcFalse;
+	}
+	else if (!r->failed && !FcStrSetAdd (set, s))
+	    return FcFalse;
+    }
+
+    return !r->failed;
+}
+
+static FcCharSet *
+FcCompiledGetCharSet (FcCompiledReader *r)
+{
+    FcCharSet	    *c = FcCharSetCreate ();
+    const FcChar8   *p;
+    FcChar32	    page, map[FC_CHARSET_MAP_SIZE];
+    int		    i, j;
+
+    if (!c)
+	return NULL;
+    for (;;)
+    {
+	p = FcCompiledGet (r, sizeof (page));
+	if (!p)
+	    goto bail;
+	memcpy (&page, p, sizeof (page));
+	if (page == FC_CHARSET_DONE)
+	    break;
+	p = FcCompiledGet (r, sizeof (map));
+	if (!p)
+	    goto bail;
+	memcpy (map, p, sizeof (map));
+	for (i = 0; i < FC_CHARSET_MAP_SIZE; i++)
+	    for (j = 0; j < 32; j++)
+		if ((map[i] & (1U << j)) && !FcCharSetAddChar (c, page + i * 32 + j))
+		    goto bail;
+    }
+
+    return c;
+
+bail:
+    FcCharSetDestroy (c);
+
+    return NULL;
+}
+
+static FcLangSet *
+FcCompiledGetLangSet (FcCompiledReader *r)
+{
+    FcLangSet	    *ls = FcLangSetCreate ();
+    const FcChar8   *s;
+    int		    i, n = FcCompiledGetInt (r);
+
+    if (!ls)
+	return NULL;
+    for (i = 0; i < n; i++)
+    {
+	s = FcCompiledGetString (r);
+	if (!s || !FcLangSetAdd (ls, s))
+	{
+	    FcLangSetDestroy (ls);
+	    return NULL;
+	}
+    }
+
+    return ls;
+}
+
+/*
+ * Read a value; what it refers to is created for it and has to be
+ * released with FcValueDestroy.
+ */
+static FcBool
+FcCompiledGetValue (FcCompiledReader *r, FcValue *v)
+{
+    double begin, end;
+
+    v->type = FcCompiledGetInt (r);
+    switch (v->type) {
+    case FcTypeVoid:
+	break;
+    case FcTypeInteger:
+	v->u.i = FcCompiledGetInt (r);
+	break;
+    case FcTypeDouble:
+	v->u.d = FcCompiledGetDouble (r);
+	break;
+    case FcTypeString:
+	v->u.s = FcCompiledGetString (r);
+	if (!v->u.s || !(v->u.s = FcStrdup (v->u.s)))
+	    return FcFalse;
+	break;
+    case FcTypeBool:
+	v->u.b = FcCompiledGetInt (r);
+	break;
+    case FcTypeMatrix:
+	{
+	    FcMatrix m;
+
+	    m.xx = FcCompiledGetDouble (r);
+	    m.xy = FcCompiledGetDouble (r);
+	    m.yx = FcCompiledGetDouble (r);
+	    m.yy = FcCompiledGetDouble (r);
+	    if (r->failed || !(v->u.m = FcMatrixCopy (&m)))
+		return FcFalse;
+	}
+	break;
+    case FcTypeCharSet:
+	return (v->u.c = FcCompiledGetCharSet (r)) != NULL;
+    case FcTypeLangSet:
+	return (v->u.l = FcCompiledGetLangSet (r)) != NULL;
+    case FcTypeRange:
+	begin = FcCompiledGetDouble (r);
+	end = FcCompiledGetDouble (r);
+	if (r->failed || !(v->u.r = FcRangeCreateDouble (begin, end)))
+	    return FcFalse;
+	break;
+    default:
+	r->failed = FcTrue;
+	return FcFalse;
+    }
+
+    return !r->failed;
+}
+
+static FcPattern *
+FcCompiledGetPattern (FcCompiledReader *r)
+{
+    FcPattern	    *p = FcPatternCreate ();
+    FcObject	    object;
+    FcValue	    v;
+    FcValueBinding  binding;
+    FcBool	    ok;
+    int		    i, j, n, nvalue;
+
+    if (!p)
+	return NULL;
+    n = FcCompiledGetInt (r);
+    for (i = 0; !r->failed && i < n; i++)
+    {
+	object = FcCompiledGetObject (r);
+	nvalue = FcCompiledGetInt (r);
+	for (j = 0; j < nvalue; j++)
+	{
+	    binding = FcCompiledGetInt (r);
+	    if (!FcCompiledGetValue (r, &v))
+		goto bail;
+	    ok = FcPatternObjectAddWithBinding (p, object, v, binding, FcTrue);
+	    FcValueDestroy (v);
+	    if (!ok)
+		goto bail;
+	}
+    }
+    if (!r->failed)
+	return p;
+bail:
+    FcPatternDestroy (p);
+
+    return NULL;
+}
+
+static FcExpr *
+FcCompiledGetExpr (FcCompiledReader *r, FcConfig *config)
+{
+    FcExpr	    *e = NULL;
+    FcExprMatrix    m;
+    FcExprName	    name;
+    FcRange	    *range;
+    FcCharSet	    *c;
+    FcLangSet	    *ls;
+    const FcChar8   *s;
+    FcExpr	    *left, *right;
+    int		    op = FcCompiledGetInt (r);
+    double	    begin, end;
+
+    if (r->failed || op == -1)
+	return NULL;
+    switch (FC_OP_GET_OP (op)) {
+    case FcOpInteger:
+	e = FcExprCreateInteger (config, FcCompiledGetInt (r));
+	break;
+    case FcOpDouble:
+	e = FcExprCreateDouble (config, FcCompiledGetDouble (r));
+	break;
+    case FcOpString:
+	if ((s = FcCompiledGetString (r)))
+	    e = FcExprCreateString (config, s);
+	break;
+    case FcOpMatrix:
+	m.xx = FcCompiledGetExpr (r, config);
+	m.xy = FcCompiledGetExpr (r, config);
+	m.yx = FcCompiledGetExpr (r, config);
+	m.yy = FcCompiledGetExpr (r, config);
+	if (!r->failed)
+	    e = FcExprCreateMatrix (config, &m);
+	if (!e)
+	{
+	    FcExprDestroy (m.xx);
+	    FcExprDestroy (m.xy);
+	    FcExprDestroy (m.yx);
+	    FcExprDestroy (m.yy);
+	}
+	break;
+    case FcOpRange:
+	begin = FcCompiledGetDouble (r);
+	end = FcCompiledGetDouble (r);
+	if (!r->failed && (range = FcRangeCreateDouble (begin, end)))
+	{
+	    e = FcExprCreateRange (config, range);
+	    FcRangeDestroy (range);
+	}
+	break;
+    case FcOpBool:
+	e = FcExprCreateBool (config, FcCompiledGetInt (r));
+	break;
+    case FcOpCharSet:
+	if ((c = FcCompiledGetCharSet (r)))
+	{
+	    e = FcExprCreateCharSet (config, c);
+	    FcCharSetDestroy (c);
+	}
+	break;
+    case FcOpLangSet:
+	if ((ls = FcCompiledGetLangSet (r)))
+	{
+	    e = FcExprCreateLangSet (config, ls);
+	    FcLangSetDestroy (ls);
+	}
+	break;
+    case FcOpField:
+	name.object = FcCompiledGetObject (r);
+	name.kind = FcCompiledGetInt (r);
+	e = FcExprCreateName (config, name);
+	break;
+    case FcOpConst:
+	if ((s = FcCompiledGetString (r)))
+	    e = FcExprCreateConst (config, s);
+	break;
+    case FcOpNil:
+	e = FcConfigAllocExpr (config);
+	break;
+    default:
+	if (FC_OP_GET_OP (op) >= FcOpInvalid)
+	    break;
+	left = FcCompiledGetExpr (r, config);
+	right = FcCompiledGetExpr (r, config);
+	if (!r->failed)
+	    e = FcExprCreateOp (config, left, op, right);
+	if (!e)
+	{
+	    FcExprDestroy (left);
+	    FcExprDestroy (right);
+	}
+	break;
+    }
+    if (r->failed || !e)
+    {
+	FcExprDestroy (e);
+	r->failed = FcTrue;
+	return NULL;
+    }
+    e->op = op;
+
+    return e;
+}
+
+static FcRule *
+FcCompiledGetRule (FcCompiledReader *r, FcConfig *config)
+{
+    FcRule	*rule = NULL, **prev = &rule;
+    FcTest	*test;
+    FcEdit	*edit;
+    int		i, n = FcCompiledGetInt (r);
+
+    for (i = 0; !r->failed && i < n; i++)
+    {
+	switch (FcCompiledGetInt (r)) {
+	case FcRuleTest:
+	    test = (FcTest *) malloc (sizeof (FcTest));
+	    if (!test)
+		goto bail;
+	    test->kind = FcCompiledGetInt (r);
+	    test->qual = FcCompiledGetInt (r);
+	    test->object = FcCompiledGetObject (r);
+	    test->op = FcCompiledGetInt (r);
+	    test->expr = FcCompiledGetExpr (r, config);
+	    if (r->failed || !(*prev = FcRuleCreate (FcRuleTest, test)))
+	    {
+		FcTestDestroy (test);
+		goto bail;
+	    }
+	    break;
+	case FcRuleEdit:
+	    edit = (FcEdit *) malloc (sizeof (FcEdit));
+	    if (!edit)
+		goto bail;
+	    edit->object = FcCompiledGetObject (r);
+	    edit->op = FcCompiledGetInt (r);
+	    edit->binding = FcCompiledGetInt (r);
+	    edit->expr = FcCompiledGetExpr (r, config);
+	    if (r->failed || !(*prev = FcRuleCreate (FcRuleEdit, edit)))
+	    {
+		FcEditDestroy (edit);
+		goto bail;
+	    }
+	    break;
+	default:
+	    goto bail;
+	}
+	prev = &(*prev)->next;
+    }
+    if (!r->failed && rule)
+	return rule;
+bail:
+    r->failed = FcTrue;
+    if (rule)
+	FcRuleDestroy (rule);
+
+    return NULL;
+}
+
+static FcBool
+FcCompiledGetRuleSetList (FcCompiledReader *r, FcRuleSet **rulesets, int nruleset, FcPtrList *list)
+{
+    FcPtrListIter   iter;
+    int		    i, n = FcCompiledGetInt (r), id;
+
+    for (i = 0; !r->failed && i < n; i++)
+    {
+	id = FcCompiledGetInt (r);
+	if (id < 0 || id >= nruleset)
+	    return FcFalse;
+	FcPtrListIterInitAtLast (list, &iter);
+	FcRuleSetReference (rulesets[id]);
+	if (!FcPtrListIterAdd (list, &iter, rulesets[id]))
+	{
+	    FcRuleSetDestroy (rulesets[id]);
+	    return FcFalse;
+	}
+    }
+
+    return !r->failed;
+}
+
+static FcBool
+FcCompiledGetConfig (FcCompiledReader *r, FcConfig *config)
+{
+    FcRuleSet	    **rulesets = NULL;
+    FcRuleSet	    *rs;
+    FcPattern	    *p;
+    FcRule	    *rule;
+    FcMatchKind	    k;
+    const FcChar8   *name, *description, *domain;
+    FcBool	    ret = FcFalse;
+    int		    i, j, n, nruleset = 0, nrule, maxObjects;
+
+    if (!FcCompiledGetStrSet (r, config->configDirs, FcFalse) ||
+	!FcCompiledGetStrSet (r, config->fontDirs, FcTrue) ||
+	!FcCompiledGetStrSet (r, config->cacheDirs, FcFalse) ||
+	!FcCompiledGetStrSet (r, config->configFiles, FcFalse) ||
+	!FcCompiledGetStrSet (r, config->availConfigFiles, FcFalse) ||
+	!FcCompiledGetStrSet (r, config->acceptGlobs, FcFalse) ||
+	!FcCompiledGetStrSet (r, config->rejectGlobs, FcFalse))
+	return FcFalse;
+    for (j = 0; j < 2; j++)
+    {
+	n = FcCompiledGetInt (r);
+	for (i = 0; !r->failed && i < n; i++)
+	{
+	    if (!(p = FcCompiledGetPattern (r)))
+		return FcFalse;
+	    if (!FcConfigPatternsAdd (config, p, j == 0))
+	    {
+		FcPatternDestroy (p);
+		return FcFalse;
+	    }
+	}
+    }
+    config->rescanInterval = FcCompiledGetInt (r);
+
+    n = FcCompiledGetInt (r);
+    if (r->failed || n < 0 || n > (r->end - r->p) / (int) sizeof (int))
+	return FcFalse;
+    rulesets = calloc (n + 1, sizeof (FcRuleSet *));
+    if (!rulesets)
+	return FcFalse;
+    for (nruleset = 0; nruleset < n; nruleset++)
+    {
+	name = FcCompiledGetString (r);
+	description = FcCompiledGetString (r);
+	domain = FcCompiledGetString (r);
+	if (r->failed || !(rs = FcRuleSetCreate (name)))
+	    goto bail;
+	rulesets[nruleset] = rs;
+	FcRuleSetEnable (rs, FcCompiledGetInt (r));
+	FcRuleSetAddDescription (rs, domain, description);
+	for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	{
+	    nrule = FcCompiledGetInt (r);
+	    for (i = 0; !r->failed && i < nrule; i++)
+	    {
+		if (!(rule = FcCompiledGetRule (r, config)))
+		    goto bail;
+		if ((maxObjects = FcRuleSetAdd (rs, rule, k)) == -1)
+		{
+		    FcRuleDestroy (rule);
+		    goto bail;
+		}
+		if (config->maxObjects < maxObjects)
+		    config->maxObjects = maxObjects;
+	    }
+	}
+    }
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	if (!FcCompiledGetRuleSetList (r, rulesets, nruleset, config->subst[k]))
+	    goto bail;
+    if (!FcCompiledGetRuleSetList (r, rulesets, nruleset, config->rulesetList))
+	goto bail;
+    ret = !r->failed && r->p == r->end;
+bail:
+    for (i = 0; i < n && rulesets[i]; i++)
+	FcRuleSetDestroy (rulesets[i]);
+    free (rulesets);
+
+    return ret;
+}
+
+/*
+ * Check that every file the compiled configuration was made from is
+ * still the same, and that the includes which were missing still are.
+ */
+static FcBool
+FcCompiledUpToDate (FcCompiledReader *r, FcConfig *config)
+{
+    const FcChar8   *file;
+    FcChar8	    *found;
+    struct stat	    statb;
+    int64_t	    mtime, nsec, size, cur_nsec;
+    int		    i, n;
+
+    n = FcCompiledGetInt (r);
+    for (i = 0; !r->failed && i < n; i++)
+    {
+	file = FcCompiledGetString (r);
+	mtime = FcCompiledGetLong (r);
+	nsec = FcCompiledGetLong (r);
+	size = FcCompiledGetLong (r);
+	if (r->failed || !file)
+	    return FcFalse;
+	if (FcStat (file, &statb) < 0)
+	{
+	    if (mtime != -1)
+		return FcFalse;
+	    continue;
+	}
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	cur_nsec = statb.st_mtim.tv_nsec;
+#else
+	cur_nsec = 0;
+#endif
+	if (mtime != (int64_t) statb.st_mtime || nsec != cur_nsec ||
+	    size != (int64_t) statb.st_size)
+	{
+	    if (FcDebug () & FC_DBG_CACHE)
+		printf ("FcCompiledUpToDate \"%s\" has changed\n", file);
+	    return FcFalse;
+	}
+    }
+    n = FcCompiledGetInt (r);
+    for (i = 0; !r->failed && i < n; i++)
+    {
+	file = FcCompiledGetString (r);
+	if (r->failed || !file)
+	    return FcFalse;
+	found = FcConfigGetFilename (config, file);
+	if (found)
+	{
+	    if (FcDebug () & FC_DBG_CACHE)
+		printf ("FcCompiledUpToDate \"%s\" has appeared\n", found);
+	    FcStrFree (found);
+	    return FcFalse;
+	}
+    }
+
+    return !r->failed;
+}
+
+/*
+ * Move what was loaded into scratch over to config, which is still
+ * empty.
+ */
+static void
+FcCompiledMove (FcConfig *config, FcConfig *scratch)
+{
+    FcMatchKind	k;
+
+#define FC_COMPILED_SWAP(type,member) \
+    do { type t = config->member; config->member = scratch->member; scratch->member = t; } while (0)
+    FC_COMPILED_SWAP (FcStrSet *, configDirs);
+    FC_COMPILED_SWAP (FcStrSet *, fontDirs);
+    FC_COMPILED_SWAP (FcStrSet *, cacheDirs);
+    FC_COMPILED_SWAP (FcStrSet *, configFiles);
+    FC_COMPILED_SWAP (FcStrSet *, availConfigFiles);
+    FC_COMPILED_SWAP (FcStrSet *, acceptGlobs);
+    FC_COMPILED_SWAP (FcStrSet *, rejectGlobs);
+    FC_COMPILED_SWAP (FcGlobMatcher *, acceptGlobMatcher);
+    FC_COMPILED_SWAP (FcGlobMatcher *, rejectGlobMatcher);
+    FC_COMPILED_SWAP (FcFontSet *, acceptPatterns);
+    FC_COMPILED_SWAP (FcFontSet *, rejectPatterns);
+    FC_COMPILED_SWAP (FcSelectorIndex *, acceptPatternIndex);
+    FC_COMPILED_SWAP (FcSelectorIndex *, rejectPatternIndex);
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	FC_COMPILED_SWAP (FcPtrList *, subst[k]);
+    FC_COMPILED_SWAP (FcPtrList *, rulesetList);
+    FC_COMPILED_SWAP (FcExprPage *, expr_pool);
+#undef FC_COMPILED_SWAP
+    config->maxObjects = scratch->maxObjects;
+    config->rescanInterval = scratch->rescanInterval;
+    FcConfigRulesChanged (config);
+}
+
+static FcBool
+FcCompiledLoad (FcConfig *config, const FcChar8 *data, size_t size, void *closure)
+{
+    const FcChar8	*key = closure;
+    FcCompiledReader	r;
+    FcConfig		*scratch;
+    const FcChar8	*s;
+    FcBool		ret = FcFalse;
+
+    r.p = data;
+    r.end = data + size;
+    r.failed = FcFalse;
+    if (FcCompiledGetInt (&r) != (int) FC_COMPILED_CONFIG_MAGIC ||
+	FcCompiledGetInt (&r) != FC_COMPILED_CONFIG_VERSION)
+	return FcFalse;
+    s = FcCompiledGetString (&r);
+    if (!s || strcmp ((const char *) s, (const char *) key) != 0)
+	return FcFalse;
+    if (!FcCompiledUpToDate (&r, config))
+	return FcFalse;
+
+    scratch = FcConfigCreate ();
+    if (!scratch)
+	return FcFalse;
+    if (FcCompiledGetConfig (&r, scratch))
+    {
+	FcCompiledMove (config, scratch);
+	ret = FcTrue;
+    }
+    FcConfigDestroy (scratch);
+
+    return ret;
+}
+
+/*
+ * The key names everything besides the files themselves that parsing
+ * them depends on.  There is none for a configuration that has
+ * already been added to, as the result wouldn't come from the files
+ * alone.
+ */
+FcChar8 *
+FcConfigCompiledKey (FcConfig *config)
+{
+    static const char *env[] = {
+	"FONTCONFIG_FILE", "FONTCONFIG_PATH",
+	"XDG_CONFIG_HOME", "XDG_DATA_HOME", "XDG_DATA_DIRS", "XDG_CACHE_HOME",
+    };
+    FcPtrListIter   iter;
+    FcStrBuf	    buf;
+    const FcChar8   *home;
+    FcChar8	    *file;
+    const char	    *e;
+    unsigned int    i;
+
+    FcPtrListIterInit (config->rulesetList, &iter);
+    if (FcPtrListIterIsValid (config->rulesetList, &iter) ||
+	config->availConfigFiles->num || config->configDirs->num ||
+	config->fontDirs->num || config->cacheDirs->num)
+	return NULL;
+
+    FcStrBufInit (&buf, NULL, 0);
+    FcStrBufString (&buf, (const FcChar8 *) "config " FC_CACHE_VERSION);
+    /* Where this build of the library looks when nothing says otherwise */
+    FcStrBufString (&buf, (const FcChar8 *) "\nconfigdir " CONFIGDIR);
+    FcStrBufString (&buf, (const FcChar8 *) "\ntemplatedir " FC_TEMPLATEDIR);
+    FcStrBufString (&buf, (const FcChar8 *) "\ndefaultfonts " FC_DEFAULT_FONTS);
+    if (config->sysRoot)
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\nsysroot ");
+	FcStrBufString (&buf, config->sysRoot);
+    }
+    /* NULL when the home directory is disabled */
+    home = FcConfigHome ();
+    if (home)
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\nhome ");
+	FcStrBufString (&buf, home);
+    }
+    for (i = 0; i < sizeof (env) / sizeof (env[0]); i++)
+    {
+	if (!(e = getenv (env[i])))
+	    continue;
+	FcStrBufChar (&buf, '\n');
+	FcStrBufString (&buf, (const FcChar8 *) env[i]);
+	FcStrBufChar (&buf, '=');
+	FcStrBufString (&buf, (const FcChar8 *) e);
+    }
+    /* The file FcConfigParseAndLoad starts from, as the path resolves it */
+    file = FcConfigGetFilename (config, NULL);
+    if (file)
+    {
+	FcStrBufString (&buf, (const FcChar8 *) "\nfile ");
+	FcStrBufString (&buf, file);
+	FcStrFree (file);
+    }
+
+    return FcStrBufDone (&buf);
+}
+
+/*
+ * Load config from an up to date compiled configuration for key.
+ */
+FcBool
+FcConfigLoadCompiled (FcConfig *config, const FcChar8 *key)
+{
+    if (!FcCompiledConfigProcess (config, key, FcCompiledLoad, (void *) key))
+	return FcFalse;
+    if (FcDebug () & FC_DBG_CONFIG)
+	printf ("\tLoaded compiled configuration\n");
+
+    return FcTrue;
+}
+
+/*
+ * Whether data is a compiled configuration which is still up to date,
+ * whatever its key.
+ */
+FcBool
+FcConfigCompiledCurrent (FcConfig *config, const FcChar8 *data, size_t size, void *closure FC_UNUSED)
+{
+    FcCompiledReader	r;
+
+    r.p = data;
+    r.end = data + size;
+    r.failed = FcFalse;
+    if (FcCompiledGetInt (&r) != (int) FC_COMPILED_CONFIG_MAGIC ||
+	FcCompiledGetInt (&r) != FC_COMPILED_CONFIG_VERSION ||
+	!FcCompiledGetString (&r))
+	return FcFalse;
+
+    return FcCompiledUpToDate (&r, config);
+}
+
+/*
+ * Save the result of parsing the configuration files for key; with
+ * system set, to the system cache directory if it is writable.
+ */
+FcBool
+FcConfigWriteCompiled (FcConfig *config, const FcChar8 *key, FcBool system)
+{
+    FcStrBuf	buf;
+    FcBool	ret = FcFalse;
+
+    if (config->uncompilable)
+	return FcFalse;
+    FcStrBufInit (&buf, NULL, 0);
+    if (FcCompiledPutConfig (&buf, config, key))
+	ret = FcCompiledConfigWrite (config, key, buf.buf, buf.len, system);
+    FcStrBufDestroy (&buf);
+
+    return ret;
+}
+
 #ifdef _WIN32
 static void
 _ensureWin32GettersReady()
@@ -0,0 +1,139 @@
+/*
+ * fontconfig/test/bench-charset.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Time the charset kernels the way FcFontSort and fc-list :lang= use
+ * them: every orthography against the charset of a font.  Set
+ * FC_NO_POPCNT to time the portable kernels on CPUs with POPCNT.
+ */
+
+#define NITER	200
+
+static FcCharSet *
+font_charset (void)
+{
+    FcPattern *pat = FcNameParse ((const FcChar8 *) "DejaVu Sans");
+    FcPattern *match = NULL;
+    FcCharSet *c = NULL, *fc;
+    FcResult result;
+
+    if (pat)
+    {
+	FcConfigSubstitute (NULL, pat, FcMatchPattern);
+	FcDefaultSubstitute (pat);
+	match = FcFontMatch (NULL, pat, &result);
+	FcPatternDestroy (pat);
+    }
+    if (match)
+    {
+	if (FcPatternGetCharSet (match, FC_CHARSET, 0, &fc) == FcResultMatch)
+	    c = FcCharSetCopy (fc);
+	FcPatternDestroy (match);
+    }
+
+    return c;
+}
+
+static double
+elapsed (clock_t start, int ncalls)
+{
+    return (double) (clock () - start) * 1e9 / CLOCKS_PER_SEC / ncalls;
+}
+
+int
+main (int argc, char **argv)
+{
+    FcStrSet *langs = FcGetLangs ();
+    FcStrList *list;
+    FcChar8 *lang;
+    const FcCharSet **sets;
+    FcCharSet *font;
+    FcChar32 sum = 0;
+    clock_t start;
+    int i, j, n = 0, niter = argc > 1 ? atoi (argv[1]) : NITER;
+
+    if (niter <= 0)
+	niter = NITER;
+    list = FcStrListCreate (langs);
+    while (FcStrListNext (list))
+	n++;
+    sets = malloc (n * sizeof (*sets));
+    if (!sets)
+	return 1;
+    FcStrListFirst (list);
+    for (n = 0; (lang = FcStrListNext (list)); n++)
+	sets[n] = FcLangGetCharSet (lang);
+    FcStrListDone (list);
+
+    /* Without fonts, the union of the orthographies stands in for one */
+    font = font_charset ();
+    if (!font)
+    {
+	font = FcCharSetCreate ();
+	for (i = 0; i < n; i++)
+	    FcCharSetMerge (font, sets[i], NULL);
+    }
+    printf ("%d orthographies against a font with %u chars%s\n",
+	    n, FcCharSetCount (font), getenv ("FC_NO_POPCNT") ? ", without POPCNT" : "");
+
+    start = clock ();
+    for (i = 0; i < niter; i++)
+	for (j = 0; j < n; j++)
+	    sum += FcCharSetSubtractCount (sets[j], font);
+    printf ("FcCharSetSubtractCount: %.1f ns/call\n", elapsed (start, niter * n));
+
+    start = clock ();
+    for (i = 0; i < niter; i++)
+	for (j = 0; j < n; j++)
+	    sum += FcCharSetIntersectCount (sets[j], font);
+    printf ("FcCharSetIntersectCount: %.1f ns/call\n", elapsed (start, niter * n));
+
+    start = clock ();
+    for (i = 0; i < niter; i++)
+	for (j = 0; j < n; j++)
+	    sum += FcCharSetIsSubset (sets[j], font);
+    printf ("FcCharSetIsSubset: %.1f ns/call\n", elapsed (start, niter * n));
+
+    start = clock ();
+    for (i = 0; i < niter; i++)
+	for (j = 0; j < n; j++)
+	    sum += FcCharSetCount (sets[j]);
+    printf ("FcCharSetCount: %.1f ns/call\n", elapsed (start, niter * n));
+
+    /* Keep the calls from being thrown away */
+    if (sum == 0)
+	printf ("no chars at all\n");
+
+    free (sets);
+    FcCharSetDestroy (font);
+    FcStrSetDestroy (langs);
+    FcFini ();
+
+    return 0;
+}
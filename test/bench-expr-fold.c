@@ -0,0 +1,95 @@
+/*
+ * fontconfig/test/bench-expr-fold.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Time FcConfigSubstitute over rules whose tests and edits are made of
+ * constants and arithmetic on literals, which the parser folds.
+ */
+
+#define NRULES	100
+#define NITER	20000
+
+static const char rule[] = ""
+    "  <match target=\"pattern\">\n"
+    "    <test name=\"weight\" compare=\"eq\"><const>bold</const></test>\n"
+    "    <test name=\"slant\" compare=\"eq\"><const>roman</const></test>\n"
+    "    <edit name=\"pixelsize\" mode=\"assign\">\n"
+    "      <plus><double>2</double><times><double>3</double><double>4</double></times></plus>\n"
+    "    </edit>\n"
+    "  </match>\n"
+    "";
+
+int
+main (int argc, char **argv)
+{
+    FcConfig *config = FcConfigCreate ();
+    FcPattern *pat, *p;
+    FcChar8 *doc;
+    size_t len;
+    clock_t start;
+    double us;
+    int i, niter = argc > 1 ? atoi (argv[1]) : NITER;
+
+    if (niter <= 0)
+	niter = NITER;
+    len = strlen ("<fontconfig>\n</fontconfig>\n") + NRULES * strlen (rule) + 1;
+    doc = malloc (len);
+    if (!doc)
+	return 1;
+    strcpy ((char *) doc, "<fontconfig>\n");
+    for (i = 0; i < NRULES; i++)
+	strcat ((char *) doc, rule);
+    strcat ((char *) doc, "</fontconfig>\n");
+    if (!FcConfigParseAndLoadFromMemory (config, doc, FcTrue))
+    {
+	fprintf (stderr, "E: Unable to load a config from memory\n");
+	return 1;
+    }
+    free (doc);
+
+    pat = FcPatternCreate ();
+    FcPatternAddInteger (pat, FC_WEIGHT, FC_WEIGHT_BOLD);
+    FcPatternAddInteger (pat, FC_SLANT, FC_SLANT_ROMAN);
+    FcPatternAddString (pat, FC_FAMILY, (const FcChar8 *) "sans-serif");
+
+    start = clock ();
+    for (i = 0; i < niter; i++)
+    {
+	p = FcPatternDuplicate (pat);
+	FcConfigSubstitute (config, p, FcMatchPattern);
+	FcPatternDestroy (p);
+    }
+    us = (double) (clock () - start) * 1e6 / CLOCKS_PER_SEC / niter;
+    printf ("FcConfigSubstitute, %d folded rules: %.2f us/call\n", NRULES, us);
+
+    FcPatternDestroy (pat);
+    FcConfigDestroy (config);
+
+    return 0;
+}
@@ -186,6 +186,17 @@ if [ -n "${SOURCE_DATE_EPOCH:-}" ] && [ ${#SOURCE_DATE_EPOCH} -gt 0 ]; then
 fi
 check
 
+dotest "Scanning with several jobs"
+prep
+mkdir "$FONTDIR"/a
+mkdir "$FONTDIR"/a/a
+mkdir "$FONTDIR"/b
+mkdir "$FONTDIR"/b/a
+cp "$FONT1" "$FONTDIR"/a
+cp "$FONT2" "$FONTDIR"/b/a
+$FCCACHE -j 4
+check
+
 dotest "Subdir with an out-of-date cache file"
 prep
 mkdir "$FONTDIR"/a
@@ -203,6 +214,53 @@ mkdir "$FONTDIR"/a
 cp "$FONT2" "$FONTDIR"/a
 check
 
+dotest "Merged font database"
+prep
+mkdir "$FONTDIR"/a
+cp "$FONT1" "$FONTDIR"
+cp "$FONT2" "$FONTDIR"/a
+$FCCACHE -m
+if FC_DEBUG=16 $FCLIST 2>&1 | grep "fontdb.*: used" > /dev/null; then : ; else
+    echo "*** Test failed: $TEST"
+    echo "font database not used"
+    exit 1
+fi
+check
+
+dotest "Out-of-date merged font database"
+prep
+mkdir "$FONTDIR"/a
+cp "$FONT1" "$FONTDIR"
+$FCCACHE -m
+sleep 1
+cp "$FONT2" "$FONTDIR"/a
+check
+
+dotest "Font database after a font is replaced in place"
+prep
+cp "$FONT1" "$FONTDIR"/a.pcf
+$FCCACHE -m
+# Same directory time, so only fc-cache -f notices the new font
+touch -r "$FONTDIR" "$BUILDTESTDIR"/dirtime
+sleep 1
+cat "$FONT2" > "$FONTDIR"/a.pcf
+touch -r "$BUILDTESTDIR"/dirtime "$FONTDIR"
+rm -f "$BUILDTESTDIR"/dirtime
+$FCCACHE -f
+if ls "$CACHEDIR"/*.fontdb-* > /dev/null 2>&1; then
+    echo "*** Test failed: $TEST"
+    echo "stale font database left behind"
+    exit 1
+fi
+$FCLIST - pixelsize > "$BUILDTESTDIR"/out
+echo ":pixelsize=16" > "$BUILDTESTDIR"/out.expected-db
+if cmp "$BUILDTESTDIR"/out "$BUILDTESTDIR"/out.expected-db > /dev/null ; then : ; else
+    echo "*** Test failed: $TEST"
+    echo "*** output is in 'out', expected output in 'out.expected-db'"
+    exit 1
+fi
+rm -f "$BUILDTESTDIR"/out "$BUILDTESTDIR"/out.expected-db
+
 dotest "Keep mtime of the font directory"
 prep
 cp "$FONT1" "$FONTDIR"
@@ -497,6 +555,41 @@ fi
 
 rm -rf "$MYCACHEBASEDIR" "$MYCONFIG" "$BUILDTESTDIR"/my-fonts.conf "$BUILDTESTDIR"/my-out "$BUILDTESTDIR"/my-out.expected
 
+dotest "Watching a font directory created later"
+prep
+rmdir "$FONTDIR"
+if test -x "$BUILDTESTDIR"/test-watch"$EXEEXT"; then
+    TESTEXE=test-watch"$EXEEXT"
+elif test -x "$BUILDTESTDIR"/test_watch"$EXEEXT"; then
+    TESTEXE=test_watch"$EXEEXT"
+else
+    echo "*** Test failed: no test case for watching"
+    exit 1
+fi
+# Only the missing directory counts among what turns up in its parent
+FC_WATCH=1 "$BUILDTESTDIR"/"$TESTEXE" \
+    "sleep 1; touch \"$BASEDIR\"/other" \
+    "sleep 1; mkdir \"$FONTDIR\"; cp \"$FONT1\" \"$FONTDIR\"" > "$BUILDTESTDIR"/out
+printf "up to date\nup to date\nchanged\n" > "$BUILDTESTDIR"/out.expected-watch
+if cmp "$BUILDTESTDIR"/out "$BUILDTESTDIR"/out.expected-watch > /dev/null ; then : ; else
+    echo "*** Test failed: $TEST"
+    echo "*** output is in 'out', expected output in 'out.expected-watch'"
+    exit 1
+fi
+rm -f "$BASEDIR"/other "$BUILDTESTDIR"/out "$BUILDTESTDIR"/out.expected-watch
+
+dotest "Watching a font directory changed while scanning"
+prep
+cp "$FONT1" "$FONTDIR"
+FC_WATCH=1 "$BUILDTESTDIR"/"$TESTEXE" -b "sleep 1; touch \"$FONTDIR\"" > "$BUILDTESTDIR"/out
+echo "changed" > "$BUILDTESTDIR"/out.expected-watch
+if cmp "$BUILDTESTDIR"/out "$BUILDTESTDIR"/out.expected-watch > /dev/null ; then : ; else
+    echo "*** Test failed: $TEST"
+    echo "*** output is in 'out', expected output in 'out.expected-watch'"
+    exit 1
+fi
+rm -f "$BUILDTESTDIR"/out "$BUILDTESTDIR"/out.expected-watch
+
 fi # if [ "x$EXEEXT" = "x" ]
 
 if [ -x "$BUILDTESTDIR"/test-crbug1004254 ]; then
@@ -540,6 +633,77 @@ unset XDG_CACHE_HOME
 unset old_HOME
 unset temp_HOME
 
+dotest "compiled configuration"
+prep
+export XDG_CACHE_HOME="$BASEDIR"/xdg-cache
+cp "$FONT1" "$FONT2" "$FONTDIR"
+if [ -n "${SOURCE_DATE_EPOCH:-}" ] && [ ${#SOURCE_DATE_EPOCH} -gt 0 ]; then
+    touch -m -t "$(fdate ${SOURCE_DATE_EPOCH})" "$FONTDIR"
+fi
+sed "s!@FONTDIR@!$FONTDIR!
+s!@REMAPDIR@!<include ignore_missing=\"yes\">$BUILDTESTDIR/my-local.conf</include>!
+s!@CACHEDIR@!$CACHEDIR!" < "$TESTDIR"/fonts.conf.in > "$BUILDTESTDIR"/my-fonts.conf
+FONTCONFIG_FILE="$BUILDTESTDIR"/my-fonts.conf $FCLIST - family pixelsize > /dev/null
+{
+    FONTCONFIG_FILE="$BUILDTESTDIR"/my-fonts.conf FC_DEBUG=16 $FCLIST - family pixelsize > "$BUILDTESTDIR"/my-out.log
+    grep -v "^Fixed:" "$BUILDTESTDIR"/my-out.log > "$BUILDTESTDIR"/out1
+    grep "^Fixed:" "$BUILDTESTDIR"/my-out.log | sort
+} > "$BUILDTESTDIR"/my-out
+if grep "FcCompiledConfigProcess.*: used" "$BUILDTESTDIR"/out1 > /dev/null ; then : ; else
+  echo "*** Test failed: $TEST"
+  echo "compiled configuration wasn't used"
+  cat "$BUILDTESTDIR"/out1
+  exit 1
+fi
+sed -n '1,/^=/p' "$BUILDTESTDIR"/"$EXPECTED" | grep -v "^=" > "$BUILDTESTDIR"/my-out.expected
+if cmp "$BUILDTESTDIR"/my-out "$BUILDTESTDIR"/my-out.expected > /dev/null ; then : ; else
+  echo "*** Test failed: $TEST"
+  echo "*** output is in 'my-out', expected output in 'my-out.expected'"
+  exit 1
+fi
+echo "<fontconfig><selectfont><rejectfont><glob>$FONTDIR/4x6.pcf</glob></rejectfont></selectfont></fontconfig>" > "$BUILDTESTDIR"/my-local.conf
+FONTCONFIG_FILE="$BUILDTESTDIR"/my-fonts.conf FC_DEBUG=16 $FCLIST - family pixelsize > "$BUILDTESTDIR"/my-out.log
+if grep "FcCompiledConfigProcess.*: used" "$BUILDTESTDIR"/my-out.log > /dev/null ; then
+  echo "*** Test failed: $TEST"
+  echo "compiled configuration was used after a new file turned up"
+  exit 1
+fi
+if grep "pixelsize=6" "$BUILDTESTDIR"/my-out.log > /dev/null ; then
+  echo "*** Test failed: $TEST"
+  echo "new configuration file wasn't applied"
+  exit 1
+fi
+rm -rf "$XDG_CACHE_HOME" "$BUILDTESTDIR"/my-fonts.conf "$BUILDTESTDIR"/my-local.conf "$BUILDTESTDIR"/my-out "$BUILDTESTDIR"/my-out.expected "$BUILDTESTDIR"/my-out.log "$BUILDTESTDIR"/out1
+unset XDG_CACHE_HOME
+
+dotest "fc-cache removes stale compiled configurations"
+prep
+export XDG_CACHE_HOME="$BASEDIR"/xdg-cache
+cp "$FONT1" "$FONTDIR"
+sed "s!@FONTDIR@!$FONTDIR!
+s!@REMAPDIR@!<include ignore_missing=\"yes\">$BUILDTESTDIR/my-local.conf</include>!
+s!@CACHEDIR@!$XDG_CACHE_HOME/fontconfig!" < "$TESTDIR"/fonts.conf.in > "$BUILDTESTDIR"/my-fonts.conf
+echo "<fontconfig/>" > "$BUILDTESTDIR"/my-local.conf
+# Two environments, two compiled configurations
+FONTCONFIG_FILE="$BUILDTESTDIR"/my-fonts.conf FC_DEBUG=16 $FCLIST > "$BUILDTESTDIR"/my-out.log
+FONTCONFIG_FILE="$BUILDTESTDIR"/my-fonts.conf XDG_DATA_HOME="$BASEDIR" $FCLIST > /dev/null
+if grep "FcCompiledConfigWrite file .*//" "$BUILDTESTDIR"/my-out.log > /dev/null ; then
+  echo "*** Test failed: $TEST"
+  echo "compiled configuration path has an empty component"
+  exit 1
+fi
+sleep 1
+echo "<fontconfig><dir>$BASEDIR/other</dir></fontconfig>" > "$BUILDTESTDIR"/my-local.conf
+FONTCONFIG_FILE="$BUILDTESTDIR"/my-fonts.conf $FCCACHE
+if [ "$(ls "$XDG_CACHE_HOME"/fontconfig/*.config-* | wc -l)" -ne 1 ]; then
+  echo "*** Test failed: $TEST"
+  echo "stale compiled configuration left behind"
+  ls "$XDG_CACHE_HOME"/fontconfig
+  exit 1
+fi
+rm -rf "$XDG_CACHE_HOME" "$BUILDTESTDIR"/my-fonts.conf "$BUILDTESTDIR"/my-local.conf "$BUILDTESTDIR"/my-out.log
+unset XDG_CACHE_HOME
+
 fi # if [ "x$EXEEXT" = "x" ]
 
 rm -rf "$FONTDIR" "$CACHEFILE" "$CACHEDIR" "$BASEDIR" "$FONTCONFIG_FILE" out
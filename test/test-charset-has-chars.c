@@ -0,0 +1,146 @@
+/*
+ * fontconfig/test/test-charset-has-chars.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Check FcCharSetHasChars, with and without a coverage bitmap, against
+ * FcCharSetHasChar on each char of the run.
+ */
+
+#define MAXRUN	200
+
+static int
+check (const char *name, const FcCharSet *c, const FcChar32 *ucs4, int n)
+{
+    FcChar32 coverage[(MAXRUN + 31) / 32 + 1];
+    int i, expected = n, got, ret = 0;
+
+    for (i = 0; i < n; i++)
+    {
+	if (!FcCharSetHasChar (c, ucs4[i]))
+	{
+	    expected = i;
+	    break;
+	}
+    }
+    if ((got = FcCharSetHasChars (c, ucs4, n, NULL)) != expected)
+    {
+	fprintf (stderr, "E: %s: expected %d, got %d\n", name, expected, got);
+	ret = 1;
+    }
+
+    /* The word past the bitmap must be left alone */
+    memset (coverage, 0xff, sizeof (coverage));
+    if ((got = FcCharSetHasChars (c, ucs4, n, coverage)) != expected)
+    {
+	fprintf (stderr, "E: %s with coverage: expected %d, got %d\n", name, expected, got);
+	ret = 1;
+    }
+    for (i = 0; i < ((n + 31) & ~31); i++)
+    {
+	FcBool has = i < n && FcCharSetHasChar (c, ucs4[i]);
+
+	if (((coverage[i >> 5] >> (i & 0x1f)) & 1) != has)
+	{
+	    fprintf (stderr, "E: %s: coverage of %d (U+%04X) should be %d\n",
+		     name, i, i < n ? ucs4[i] : 0, has);
+	    ret = 1;
+	}
+    }
+    if (coverage[(n + 31) >> 5] != ~0U)
+    {
+	fprintf (stderr, "E: %s: coverage written past its end\n", name);
+	ret = 1;
+    }
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcCharSet *c = FcCharSetCreate ();
+    FcChar32 ucs4[MAXRUN];
+    FcChar32 i;
+    int n, ret = 0;
+
+    /* Latin, Greek, CJK, a musical symbol and an emoji, each with gaps */
+    for (i = 0x20; i < 0x7f; i++)
+	FcCharSetAddChar (c, i);
+    for (i = 0x391; i < 0x3c9; i += 2)
+	FcCharSetAddChar (c, i);
+    for (i = 0x4e00; i < 0x4e80; i++)
+	FcCharSetAddChar (c, i);
+    FcCharSetAddChar (c, 0x1d11e);
+    FcCharSetAddChar (c, 0x1f600);
+    FcCharSetAddChar (c, 0x1f602);
+
+    ucs4[0] = 'a';
+    ret |= check ("empty run", c, ucs4, 0);
+    ret |= check ("NULL charset", NULL, ucs4, 1);
+    ret |= check ("empty NULL charset run", NULL, ucs4, 0);
+
+    /* One page */
+    for (n = 0; n < 40; n++)
+	ucs4[n] = 'A' + n;
+    ret |= check ("ASCII", c, ucs4, n);
+    ucs4[n++] = 0x7f;
+    ret |= check ("ASCII then DEL", c, ucs4, n);
+
+    /* Moving between BMP pages more than once, which uses a page table */
+    n = 0;
+    for (i = 0; i < 60 && n < MAXRUN; i++)
+    {
+	ucs4[n++] = 'a' + i % 26;
+	ucs4[n++] = 0x391 + i % 40;
+	ucs4[n++] = 0x4e00 + i * 3;
+    }
+    ret |= check ("BMP pages", c, ucs4, n);
+    ucs4[n++] = 0x2000;
+    ret |= check ("BMP pages then a missing page", c, ucs4, n);
+
+    /* Outside the BMP, alone and mixed with BMP pages */
+    n = 0;
+    ucs4[n++] = 0x1f600;
+    ucs4[n++] = 0x1f602;
+    ucs4[n++] = 0x1d11e;
+    ret |= check ("astral", c, ucs4, n);
+    ucs4[n++] = 0x1f601;
+    ret |= check ("astral with a gap", c, ucs4, n);
+    for (i = 0; i < 40; i++)
+    {
+	ucs4[n++] = 'x';
+	ucs4[n++] = 0x4e10;
+	ucs4[n++] = i & 1 ? 0x1f600 : 0x1d11e;
+	ucs4[n++] = 0x10ffff;
+    }
+    ret |= check ("BMP and astral", c, ucs4, n);
+
+    FcCharSetDestroy (c);
+
+    return ret;
+}
@@ -0,0 +1,195 @@
+/*
+ * fontconfig/test/test-charset-kernels.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Check FcCharSetCount, FcCharSetIntersectCount, FcCharSetSubtractCount
+ * and FcCharSetIsSubset against loops over every code point.  The
+ * checks run once with the default kernels and once more, re-executed
+ * with FC_NO_POPCNT set, on the portable ones.
+ */
+
+#define NSETS	24
+#define MAXCHAR	0x30000
+
+static unsigned int seed = 1;
+
+static unsigned int
+next_random (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+/*
+ * A set of a few pages, each one empty, sparse, dense or full, so
+ * that pairs of sets share some pages and not others.
+ */
+static FcCharSet *
+random_charset (void)
+{
+    FcCharSet *c = FcCharSetCreate ();
+    int npages = 1 + next_random () % 16;
+    int i, j;
+
+    for (i = 0; c && i < npages; i++)
+    {
+	FcChar32 page = (next_random () % (MAXCHAR >> 8)) << 8;
+	int density = next_random () % 4;
+
+	for (j = 0; j < 256; j++)
+	{
+	    if (density == 3 ||
+		(density == 2 && next_random () % 4) ||
+		(density == 1 && next_random () % 32 == 0))
+		FcCharSetAddChar (c, page + j);
+	}
+    }
+
+    return c;
+}
+
+/*
+ * The code points of a set, one FcChar8 each, looked up one at a time
+ */
+static FcChar8 *
+members (const FcCharSet *c)
+{
+    FcChar8 *m = malloc (MAXCHAR);
+    FcChar32 ucs;
+
+    for (ucs = 0; m && ucs < MAXCHAR; ucs++)
+	m[ucs] = FcCharSetHasChar (c, ucs);
+
+    return m;
+}
+
+static FcChar32
+count_loop (const FcChar8 *a, const FcChar8 *b, FcBool in_b)
+{
+    FcChar32 ucs, count = 0;
+
+    for (ucs = 0; ucs < MAXCHAR; ucs++)
+	if (a[ucs] && (!b || b[ucs] == in_b))
+	    count++;
+
+    return count;
+}
+
+static int
+check (const FcCharSet *a, const FcCharSet *b, const FcChar8 *ma, const FcChar8 *mb, int i, int j)
+{
+    FcChar32 expected, got;
+    FcBool subset;
+    int ret = 0;
+
+    if (i == j && (got = FcCharSetCount (a)) != (expected = count_loop (ma, NULL, FcTrue)))
+    {
+	fprintf (stderr, "E: count of %d: expected %u, got %u\n", i, expected, got);
+	ret = 1;
+    }
+    if ((got = FcCharSetIntersectCount (a, b)) != (expected = count_loop (ma, mb, FcTrue)))
+    {
+	fprintf (stderr, "E: intersect count of %d and %d: expected %u, got %u\n", i, j, expected, got);
+	ret = 1;
+    }
+    if ((got = FcCharSetSubtractCount (a, b)) != (expected = count_loop (ma, mb, FcFalse)))
+    {
+	fprintf (stderr, "E: subtract count of %d and %d: expected %u, got %u\n", i, j, expected, got);
+	ret = 1;
+    }
+    subset = expected == 0;
+    if (FcCharSetIsSubset (a, b) != subset)
+    {
+	fprintf (stderr, "E: %d is%s a subset of %d\n", i, subset ? "" : " not", j);
+	ret = 1;
+    }
+
+    return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+    FcCharSet *sets[NSETS + 4];
+    FcChar8 *m[NSETS + 4];
+    FcStrSet *langs;
+    FcStrList *list;
+    FcChar8 *lang;
+    const char *no_popcnt = getenv ("FC_NO_POPCNT");
+    int i, j, n = 0, ret = 0;
+
+    (void) argc;
+    sets[n++] = FcCharSetCreate ();
+    for (i = 0; i < NSETS; i++)
+	sets[n++] = random_charset ();
+    /* Sets built from one another: a subset and a superset of the last one */
+    sets[n] = FcCharSetCopy (sets[n - 1]);
+    FcCharSetDelChar (sets[n], 0x20);
+    n++;
+    sets[n] = FcCharSetUnion (sets[n - 1], sets[1]);
+    n++;
+    /* A few real orthographies, which share the ASCII page */
+    langs = FcGetLangs ();
+    list = FcStrListCreate (langs);
+    while (n < NSETS + 4 && (lang = FcStrListNext (list)))
+    {
+	if (next_random () % 32 == 0)
+	    sets[n++] = FcCharSetCopy ((FcCharSet *) FcLangGetCharSet (lang));
+    }
+    FcStrListDone (list);
+    FcStrSetDestroy (langs);
+
+    for (i = 0; i < n; i++)
+    {
+	if (!sets[i] || !(m[i] = members (sets[i])))
+	{
+	    fprintf (stderr, "E: Unable to create the sets\n");
+	    return 1;
+	}
+    }
+    for (i = 0; i < n; i++)
+	for (j = 0; j < n; j++)
+	    ret |= check (sets[i], sets[j], m[i], m[j], i, j);
+    for (i = 0; i < n; i++)
+    {
+	FcCharSetDestroy (sets[i]);
+	free (m[i]);
+    }
+    fprintf (stderr, "D: %d sets checked%s\n", n, no_popcnt ? " without POPCNT" : "");
+
+    if (ret || no_popcnt)
+	return ret;
+
+    /* Again, on the portable kernels */
+    setenv ("FC_NO_POPCNT", "1", 1);
+    execv (argv[0], argv);
+    fprintf (stderr, "E: Unable to run %s again\n", argv[0]);
+
+    return 1;
+}
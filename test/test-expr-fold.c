@@ -0,0 +1,129 @@
+/*
+ * fontconfig/test/test-expr-fold.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Each edit below comes in pairs: the first one is folded when the
+ * config is parsed, the second one takes its operands from the pattern
+ * and is evaluated on every substitution.  Both have to agree.
+ */
+static const FcChar8 *doc = (const FcChar8 *) ""
+    "<fontconfig>\n"
+    "  <match target=\"pattern\">\n"
+    "    <test name=\"weight\" compare=\"eq\"><const>bold</const></test>\n"
+    "    <edit name=\"pixelsize\" mode=\"assign\">\n"
+    "      <plus><double>2</double><times><double>3</double><double>4</double></times></plus>\n"
+    "    </edit>\n"
+    "    <edit name=\"size\" mode=\"assign\">\n"
+    "      <plus><name>aspect</name><times><name>dpi</name><name>scale</name></times></plus>\n"
+    "    </edit>\n"
+    "    <edit name=\"spacing\" mode=\"assign\">\n"
+    "      <if><more><const>bold</const><const>medium</const></more>\n"
+    "        <const>mono</const><const>proportional</const></if>\n"
+    "    </edit>\n"
+    "    <edit name=\"index\" mode=\"assign\">\n"
+    "      <if><more><name>weight</name><const>medium</const></more>\n"
+    "        <const>mono</const><const>proportional</const></if>\n"
+    "    </edit>\n"
+    "    <edit name=\"style\" mode=\"assign\">\n"
+    "      <if><not><bool>true</bool></not><string>wrong</string><string>right</string></if>\n"
+    "    </edit>\n"
+    "    <edit name=\"fullname\" mode=\"assign\">\n"
+    "      <if><not><name>outline</name></not><string>wrong</string><string>right</string></if>\n"
+    "    </edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n"
+    "";
+
+static FcPattern *
+substitute (FcConfig *config, int weight)
+{
+    FcPattern *pat = FcPatternCreate ();
+
+    FcPatternAddInteger (pat, FC_WEIGHT, weight);
+    FcPatternAddDouble (pat, FC_ASPECT, 2);
+    FcPatternAddDouble (pat, FC_DPI, 3);
+    FcPatternAddDouble (pat, FC_SCALE, 4);
+    FcPatternAddBool (pat, FC_OUTLINE, FcTrue);
+    FcConfigSubstitute (config, pat, FcMatchPattern);
+
+    return pat;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate ();
+    FcPattern *pat;
+    double d1, d2;
+    int i1, i2;
+    FcChar8 *s1, *s2;
+    int ret = 0;
+
+    if (!FcConfigParseAndLoadFromMemory (config, doc, FcTrue))
+    {
+	fprintf (stderr, "E: Unable to load a config from memory\n");
+	return 1;
+    }
+
+    pat = substitute (config, FC_WEIGHT_BOLD);
+    if (FcPatternGetDouble (pat, FC_PIXEL_SIZE, 0, &d1) != FcResultMatch ||
+	FcPatternGetDouble (pat, FC_SIZE, 0, &d2) != FcResultMatch ||
+	d1 != 14 || d2 != 14)
+    {
+	fprintf (stderr, "E: arithmetic folded to a different value\n");
+	ret = 1;
+    }
+    if (FcPatternGetInteger (pat, FC_SPACING, 0, &i1) != FcResultMatch ||
+	FcPatternGetInteger (pat, FC_INDEX, 0, &i2) != FcResultMatch ||
+	i1 != FC_MONO || i2 != FC_MONO)
+    {
+	fprintf (stderr, "E: <if> on constants folded to a different branch\n");
+	ret = 1;
+    }
+    if (FcPatternGetString (pat, FC_STYLE, 0, &s1) != FcResultMatch ||
+	FcPatternGetString (pat, FC_FULLNAME, 0, &s2) != FcResultMatch ||
+	FcStrCmp (s1, (const FcChar8 *) "right") != 0 ||
+	FcStrCmp (s2, (const FcChar8 *) "right") != 0)
+    {
+	fprintf (stderr, "E: <if> on <not> folded to a different branch\n");
+	ret = 1;
+    }
+    FcPatternDestroy (pat);
+
+    /* The folded <const> test doesn't match anything else */
+    pat = substitute (config, FC_WEIGHT_REGULAR);
+    if (FcPatternGetDouble (pat, FC_PIXEL_SIZE, 0, &d1) != FcResultNoMatch)
+    {
+	fprintf (stderr, "E: folded test matched the wrong weight\n");
+	ret = 1;
+    }
+    FcPatternDestroy (pat);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * fontconfig/test/test-match-cache.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fontconfig/fontconfig.h>
+
+static int
+check_stats (FcConfig *config, unsigned long hits, unsigned long misses)
+{
+    unsigned long h, m;
+
+    FcConfigGetMatchCacheStats (config, &h, &m);
+    if (h != hits || m != misses)
+    {
+	fprintf (stderr, "E: expected %lu hits and %lu misses, got %lu and %lu\n",
+		 hits, misses, h, m);
+	return 1;
+    }
+
+    return 0;
+}
+
+static FcPattern *
+match (FcConfig *config, const char *name)
+{
+    FcPattern *pat = FcNameParse ((const FcChar8 *) name), *ret;
+    FcResult result;
+
+    FcConfigSubstitute (config, pat, FcMatchPattern);
+    FcDefaultSubstitute (pat);
+    ret = FcFontMatch (config, pat, &result);
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate ();
+    FcPattern *p1, *p2, *pat;
+    FcFontSet *fs1, *fs2;
+    FcResult result;
+    int ret = 0;
+
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *) FONTFILE))
+    {
+	fprintf (stderr, "E: Unable to add %s\n", FONTFILE);
+	return 1;
+    }
+
+    /* Disabled by default */
+    p1 = match (config, "sans-serif");
+    ret |= check_stats (config, 0, 0);
+    FcPatternDestroy (p1);
+
+    if (!FcConfigSetMatchCacheSize (config, 2) ||
+	FcConfigGetMatchCacheSize (config) != 2)
+    {
+	fprintf (stderr, "E: Unable to enable the cache\n");
+	return 1;
+    }
+    p1 = match (config, "sans-serif");
+    p2 = match (config, "sans-serif");
+    ret |= check_stats (config, 1, 1);
+    if (!p1 || !p2 || p1 == p2 || !FcPatternEqual (p1, p2))
+    {
+	fprintf (stderr, "E: cached match differs\n");
+	ret = 1;
+    }
+    FcPatternDestroy (p1);
+    FcPatternDestroy (p2);
+
+    /* Sort results are cached separately from matches */
+    pat = FcNameParse ((const FcChar8 *) "sans-serif");
+    FcConfigSubstitute (config, pat, FcMatchPattern);
+    FcDefaultSubstitute (pat);
+    fs1 = FcFontSort (config, pat, FcFalse, NULL, &result);
+    fs2 = FcFontSort (config, pat, FcFalse, NULL, &result);
+    ret |= check_stats (config, 2, 2);
+    if (!fs1 || !fs2 || fs1->nfont != fs2->nfont || fs1->nfont < 1 ||
+	fs1->fonts[0] != fs2->fonts[0])
+    {
+	fprintf (stderr, "E: cached sort differs\n");
+	ret = 1;
+    }
+    FcFontSetDestroy (fs1);
+    FcFontSetDestroy (fs2);
+    FcPatternDestroy (pat);
+
+    /* Least recently used entries are dropped */
+    p1 = match (config, "serif");
+    FcPatternDestroy (p1);
+    p1 = match (config, "sans-serif");
+    FcPatternDestroy (p1);
+    ret |= check_stats (config, 2, 4);
+
+    /* Adding fonts flushes the cache */
+    FcConfigAppFontAddFile (config, (const FcChar8 *) FONTFILE);
+    p1 = match (config, "sans-serif");
+    FcPatternDestroy (p1);
+    ret |= check_stats (config, 2, 5);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
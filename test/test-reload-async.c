@@ -0,0 +1,181 @@
+/*
+ * fontconfig/test/test-reload-async.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fontconfig/fontconfig.h>
+
+#define NTHREADS 4
+
+static pthread_mutex_t	lock = PTHREAD_MUTEX_INITIALIZER;
+static FcBool		stop;	    /* protected by lock */
+static int		nmatch;	    /* protected by lock */
+static int		nfail;	    /* protected by lock */
+
+static void *
+run_matches (void *arg)
+{
+    FcPattern *pat, *match;
+    FcResult result;
+    FcBool done;
+
+    (void) arg;
+    do
+    {
+	pat = FcNameParse ((const FcChar8 *) "Fixed");
+	FcConfigSubstitute (NULL, pat, FcMatchPattern);
+	FcDefaultSubstitute (pat);
+	match = FcFontMatch (NULL, pat, &result);
+	FcPatternDestroy (pat);
+
+	pthread_mutex_lock (&lock);
+	if (match)
+	    nmatch++;
+	else
+	    nfail++;
+	done = stop;
+	pthread_mutex_unlock (&lock);
+	if (match)
+	    FcPatternDestroy (match);
+    } while (!done);
+
+    return NULL;
+}
+
+static int
+count_fonts (void)
+{
+    FcPattern *pat = FcPatternCreate ();
+    FcFontSet *fs = FcFontList (NULL, pat, NULL);
+    int n = fs ? fs->nfont : -1;
+
+    FcPatternDestroy (pat);
+    if (fs)
+	FcFontSetDestroy (fs);
+
+    return n;
+}
+
+int
+main (void)
+{
+    char template[512] = "/tmp/reload-async-XXXXXX";
+    char *basedir, conf[1024], path[1024], cmd[2048];
+    pthread_t threads[NTHREADS];
+    FcConfig *config = NULL;
+    FILE *fp;
+    int i, n, ret = 0;
+
+    basedir = mkdtemp (template);
+    if (!basedir)
+    {
+	fprintf (stderr, "%s: %s\n", template, strerror (errno));
+	return 1;
+    }
+    snprintf (path, sizeof (path), "%s/fonts", basedir);
+    mkdir (path, 0755);
+    snprintf (cmd, sizeof (cmd), "cp %s %s/fonts/a.pcf", FONTFILE, basedir);
+    (void) system (cmd);
+    snprintf (conf, sizeof (conf), "%s/fonts.conf", basedir);
+    fp = fopen (conf, "w");
+    if (!fp)
+    {
+	fprintf (stderr, "%s: %s\n", conf, strerror (errno));
+	ret = 1;
+	goto bail;
+    }
+    fprintf (fp,
+	     "<fontconfig>\n"
+	     "  <dir>%s/fonts</dir>\n"
+	     "  <cachedir>%s/cache</cachedir>\n"
+	     "  <config><rescan><int>1</int></rescan></config>\n"
+	     "</fontconfig>\n",
+	     basedir, basedir);
+    fclose (fp);
+    setenv ("FONTCONFIG_FILE", conf, 1);
+
+    if (!FcInit () || count_fonts () != 1)
+    {
+	fprintf (stderr, "E: Unable to load the first configuration\n");
+	ret = 1;
+	goto bail;
+    }
+    /* Keep it around to tell whether it has been replaced */
+    config = FcConfigReference (NULL);
+
+    for (i = 0; i < NTHREADS; i++)
+	pthread_create (&threads[i], NULL, run_matches, NULL);
+
+    /* Let the rescan interval pass with a new font in the directory */
+    sleep (2);
+    snprintf (cmd, sizeof (cmd), "cp %s %s/fonts/b.pcf", FONTFILE, basedir);
+    (void) system (cmd);
+    sleep (1);
+
+    for (i = 0; i < 100 && FcConfigGetCurrent () == config; i++)
+    {
+	if (!FcInitBringUptoDateAsync ())
+	{
+	    fprintf (stderr, "E: Unable to start the reload\n");
+	    ret = 1;
+	    break;
+	}
+	usleep (100000);
+    }
+    if (FcConfigGetCurrent () == config)
+    {
+	fprintf (stderr, "E: config wasn't reloaded\n");
+	ret = 1;
+    }
+    else if ((n = count_fonts ()) != 2)
+    {
+	fprintf (stderr, "E: Unexpected the number of fonts: %d\n", n);
+	ret = 1;
+    }
+
+    pthread_mutex_lock (&lock);
+    stop = FcTrue;
+    pthread_mutex_unlock (&lock);
+    for (i = 0; i < NTHREADS; i++)
+	pthread_join (threads[i], NULL);
+    if (nfail || !nmatch)
+    {
+	fprintf (stderr, "E: %d of %d matches failed during the reload\n",
+		 nfail, nmatch + nfail);
+	ret = 1;
+    }
+
+bail:
+    if (config)
+	FcConfigDestroy (config);
+    FcFini ();
+    snprintf (cmd, sizeof (cmd), "rm -rf %s", basedir);
+    (void) system (cmd);
+
+    return ret;
+}
@@ -0,0 +1,137 @@
+/*
+ * fontconfig/test/test-reuse-cache.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * The pixel size of the only font, or -1.
+ */
+static double
+pixel_size (void)
+{
+    FcPattern *pat = FcPatternCreate ();
+    FcObjectSet *os = FcObjectSetBuild (FC_PIXEL_SIZE, NULL);
+    FcFontSet *fs = FcFontList (NULL, pat, os);
+    double size = -1;
+
+    if (fs && fs->nfont == 1)
+	FcPatternGetDouble (fs->fonts[0], FC_PIXEL_SIZE, 0, &size);
+    FcPatternDestroy (pat);
+    FcObjectSetDestroy (os);
+    if (fs)
+	FcFontSetDestroy (fs);
+
+    return size;
+}
+
+int
+main (void)
+{
+    char template[512] = "/tmp/reuse-cache-XXXXXX";
+    char *basedir, conf[1024], fontdir[1024], cmd[2048];
+    struct stat before, after;
+    FcCache *cache;
+    FILE *fp;
+    double size = -1;
+    int ret = 0;
+
+    basedir = mkdtemp (template);
+    if (!basedir)
+    {
+	fprintf (stderr, "%s: %s\n", template, strerror (errno));
+	return 1;
+    }
+    snprintf (fontdir, sizeof (fontdir), "%s/fonts", basedir);
+    mkdir (fontdir, 0755);
+    snprintf (cmd, sizeof (cmd), "cp %s %s/a.pcf", FONTFILE, fontdir);
+    (void) system (cmd);
+    snprintf (conf, sizeof (conf), "%s/fonts.conf", basedir);
+    fp = fopen (conf, "w");
+    if (!fp)
+    {
+	fprintf (stderr, "%s: %s\n", conf, strerror (errno));
+	ret = 1;
+	goto bail;
+    }
+    fprintf (fp,
+	     "<fontconfig>\n"
+	     "  <dir>%s</dir>\n"
+	     "  <cachedir>%s/cache</cachedir>\n"
+	     "</fontconfig>\n",
+	     fontdir, basedir);
+    fclose (fp);
+    setenv ("FONTCONFIG_FILE", conf, 1);
+
+    if (!FcInit () || (size = pixel_size ()) != 6)
+    {
+	fprintf (stderr, "E: Unexpected first font: %g\n", size);
+	ret = 1;
+	goto bail;
+    }
+
+    /* Overwriting a file doesn't change the directory */
+    stat (fontdir, &before);
+    snprintf (cmd, sizeof (cmd), "sleep 1; cat %s > %s/a.pcf", FONTFILE2, fontdir);
+    (void) system (cmd);
+    stat (fontdir, &after);
+    if (before.st_mtime != after.st_mtime)
+    {
+	fprintf (stderr, "D: the directory changed, nothing to test\n");
+	goto bail;
+    }
+
+    /* Rewrite the cache like fc-cache -f does */
+    cache = FcDirCacheRead ((const FcChar8 *) fontdir, FcTrue, NULL);
+    if (!cache)
+    {
+	fprintf (stderr, "E: Unable to rewrite the cache\n");
+	ret = 1;
+	goto bail;
+    }
+    FcDirCacheUnload (cache);
+
+    if (!FcInitReinitialize ())
+    {
+	fprintf (stderr, "E: Unable to reinitialize\n");
+	ret = 1;
+	goto bail;
+    }
+    if ((size = pixel_size ()) != 16)
+    {
+	fprintf (stderr, "E: the rewritten cache wasn't picked up: %g\n", size);
+	ret = 1;
+    }
+
+bail:
+    FcFini ();
+    snprintf (cmd, sizeof (cmd), "rm -rf %s", basedir);
+    (void) system (cmd);
+
+    return ret;
+}
@@ -0,0 +1,144 @@
+/*
+ * fontconfig/test/test-sort-for-chars.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Compare FcFontSortForChars with FcFontSort, keeping only the fonts
+ * which cover the run, with the coverage index and without one.
+ */
+
+static int
+check (FcConfig *config, FcPattern *p, const char *name, const FcChar32 *ucs4, int n)
+{
+    FcFontSet *sorted, *got;
+    FcResult result, got_result;
+    FcCharSet *cs;
+    int i, j, ret = 0;
+
+    sorted = FcFontSort (config, p, FcFalse, NULL, &result);
+    got = FcFontSortForChars (config, p, ucs4, n, &got_result);
+    if (!sorted || !got)
+    {
+	fprintf (stderr, "E: %s: no font set\n", name);
+	ret = 1;
+	goto bail;
+    }
+    for (i = 0, j = 0; i < sorted->nfont; i++)
+    {
+	if (FcPatternGetCharSet (sorted->fonts[i], FC_CHARSET, 0, &cs) != FcResultMatch ||
+	    FcCharSetHasChars (cs, ucs4, n, NULL) != n)
+	    continue;
+	if (j >= got->nfont || got->fonts[j] != sorted->fonts[i])
+	{
+	    fprintf (stderr, "E: %s: font %d differs\n", name, j);
+	    ret = 1;
+	    goto bail;
+	}
+	j++;
+    }
+    if (j != got->nfont)
+    {
+	fprintf (stderr, "E: %s: expected %d fonts, got %d\n", name, j, got->nfont);
+	ret = 1;
+    }
+    if (got_result != (j ? FcResultMatch : FcResultNoMatch))
+    {
+	fprintf (stderr, "E: %s: unexpected result %d for %d fonts\n", name, got_result, j);
+	ret = 1;
+    }
+bail:
+    if (sorted)
+	FcFontSetDestroy (sorted);
+    if (got)
+	FcFontSetDestroy (got);
+
+    return ret;
+}
+
+static int
+check_runs (FcConfig *config, FcPattern *p)
+{
+    static const FcChar32 upper[] = { 'A', 'B' };
+    static const FcChar32 lower[] = { 'a', 'b', 0xe9 };
+    static const FcChar32 missing[] = { 'a', 0x4e00 };
+    int ret = 0;
+
+    ret |= check (config, p, "upper case", upper, 2);
+    ret |= check (config, p, "lower case", lower, 3);
+    ret |= check (config, p, "a char no font covers", missing, 2);
+    ret |= check (config, p, "an empty run", upper, 0);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate ();
+    FcPattern *p, *extra;
+    FcCharSet *cs;
+    int ret = 0;
+
+    if (!config ||
+	!FcConfigAppFontAddFile (config, (const FcChar8 *) FONTFILE) ||
+	!FcConfigAppFontAddFile (config, (const FcChar8 *) FONTFILE2))
+    {
+	fprintf (stderr, "E: Unable to add the fonts\n");
+	return 1;
+    }
+    p = FcNameParse ((const FcChar8 *) "Fixed:pixelsize=16");
+    FcConfigSubstitute (config, p, FcMatchPattern);
+    FcDefaultSubstitute (p);
+
+    ret |= check_runs (config, p);
+
+    /*
+     * A font added to the set behind the configuration's back leaves
+     * it without a coverage index; this one only covers upper case.
+     */
+    cs = FcCharSetCreate ();
+    FcCharSetAddChar (cs, 'A');
+    FcCharSetAddChar (cs, 'B');
+    extra = FcPatternBuild (NULL,
+			    FC_FAMILY, FcTypeString, "Extra",
+			    FC_FILE, FcTypeString, "extra.pcf",
+			    FC_CHARSET, FcTypeCharSet, cs,
+			    NULL);
+    FcCharSetDestroy (cs);
+    if (!extra || !FcFontSetAdd (FcConfigGetFonts (config, FcSetApplication), extra))
+    {
+	fprintf (stderr, "E: Unable to add a font to the set\n");
+	ret = 1;
+    }
+    else
+	ret |= check_runs (config, p);
+
+    FcPatternDestroy (p);
+    FcConfigDestroy (config);
+
+    return ret;
+}
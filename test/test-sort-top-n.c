@@ -0,0 +1,157 @@
+/*
+ * fontconfig/test/test-sort-top-n.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Compare FcFontSortTopN with the head of the list FcFontSort returns.
+ * The list may only end before n fonts once the fonts in it cover the
+ * charset of p.
+ */
+
+static int
+check (FcConfig *config, FcPattern *p, const char *name, FcBool trim, FcBool want_cs, int n)
+{
+    FcFontSet *sorted, *got;
+    FcResult result, got_result;
+    FcCharSet *cs = NULL, *got_cs = NULL, *target, *covered;
+    int i, ret = 0;
+
+    sorted = FcFontSort (config, p, trim, want_cs ? &cs : NULL, &result);
+    got = FcFontSortTopN (config, p, trim, n, want_cs ? &got_cs : NULL, &got_result);
+    if (!sorted || !got)
+    {
+	fprintf (stderr, "E: %s: no font set\n", name);
+	ret = 1;
+	goto bail;
+    }
+    if (got->nfont > n || got->nfont > sorted->nfont)
+    {
+	fprintf (stderr, "E: %s: too many fonts: %d\n", name, got->nfont);
+	ret = 1;
+	goto bail;
+    }
+    covered = FcCharSetCreate ();
+    for (i = 0; i < got->nfont; i++)
+    {
+	FcCharSet *fcs;
+
+	if (got->fonts[i] != sorted->fonts[i])
+	{
+	    fprintf (stderr, "E: %s: font %d differs\n", name, i);
+	    ret = 1;
+	    break;
+	}
+	if (FcPatternGetCharSet (got->fonts[i], FC_CHARSET, 0, &fcs) == FcResultMatch)
+	    FcCharSetMerge (covered, fcs, NULL);
+    }
+    if (!ret && got->nfont < n && got->nfont < sorted->nfont &&
+	(FcPatternGetCharSet (p, FC_CHARSET, 0, &target) != FcResultMatch ||
+	 !FcCharSetIsSubset (target, covered)))
+    {
+	fprintf (stderr, "E: %s: ended after %d fonts of %d\n", name, got->nfont, sorted->nfont);
+	ret = 1;
+    }
+    FcCharSetDestroy (covered);
+    if (got_result != result)
+    {
+	fprintf (stderr, "E: %s: unexpected result %d\n", name, got_result);
+	ret = 1;
+    }
+bail:
+    if (sorted)
+	FcFontSetDestroy (sorted);
+    if (got)
+	FcFontSetDestroy (got);
+    if (cs)
+	FcCharSetDestroy (cs);
+    if (got_cs)
+	FcCharSetDestroy (got_cs);
+
+    return ret;
+}
+
+static int
+check_all (FcConfig *config, FcPattern *p, const char *name)
+{
+    static const int ns[] = { 1, 2, 3, 100 };
+    char buf[256];
+    int trim, want_cs, i, ret = 0;
+
+    for (trim = 0; trim < 2; trim++)
+	for (want_cs = 0; want_cs < 2; want_cs++)
+	    for (i = 0; i < (int) (sizeof (ns) / sizeof (ns[0])); i++)
+	    {
+		snprintf (buf, sizeof (buf), "%s, trim %d, charset %d, n %d",
+			  name, trim, want_cs, ns[i]);
+		ret |= check (config, p, buf, trim, want_cs, ns[i]);
+	    }
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate ();
+    FcPattern *p, *bare;
+    FcCharSet *cs;
+    int ret = 0;
+
+    if (!config ||
+	!FcConfigAppFontAddFile (config, (const FcChar8 *) FONTFILE) ||
+	!FcConfigAppFontAddFile (config, (const FcChar8 *) FONTFILE2))
+    {
+	fprintf (stderr, "E: Unable to add the fonts\n");
+	return 1;
+    }
+    /* A font without a charset, which matches the family best */
+    bare = FcPatternBuild (NULL,
+			   FC_FAMILY, FcTypeString, "Bare",
+			   FC_FILE, FcTypeString, "bare.pcf",
+			   NULL);
+    if (!bare || !FcFontSetAdd (FcConfigGetFonts (config, FcSetApplication), bare))
+    {
+	fprintf (stderr, "E: Unable to add a font to the set\n");
+	return 1;
+    }
+
+    p = FcNameParse ((const FcChar8 *) "Bare");
+    FcConfigSubstitute (config, p, FcMatchPattern);
+    FcDefaultSubstitute (p);
+    ret |= check_all (config, p, "no charset");
+
+    cs = FcCharSetCreate ();
+    FcCharSetAddChar (cs, 'A');
+    FcPatternAddCharSet (p, FC_CHARSET, cs);
+    FcCharSetDestroy (cs);
+    ret |= check_all (config, p, "charset");
+
+    FcPatternDestroy (p);
+    FcConfigDestroy (config);
+
+    return ret;
+}
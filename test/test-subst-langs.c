@@ -0,0 +1,116 @@
+/*
+ * fontconfig/test/test-subst-langs.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Substitute a pattern asking for lang, if not NULL, with the given
+ * languages, or the defaults when langs is NULL, and compare the
+ * languages it ends up with to expected, a colon separated list.
+ */
+static int
+check (FcConfig *config, const char *lang, const char *langs, const char *expected)
+{
+    FcPattern *pat = FcPatternCreate ();
+    FcStrSet *set = NULL;
+    FcChar8 *s;
+    char got[256] = "";
+    int i, ret = 0;
+
+    if (langs)
+    {
+	char buf[256], *l, *next;
+
+	set = FcStrSetCreate ();
+	strcpy (buf, langs);
+	for (l = buf; set && *l; l = next)
+	{
+	    next = l + strcspn (l, ":");
+	    if (*next)
+		*next++ = '\0';
+	    if (!FcStrSetAdd (set, (const FcChar8 *) l))
+		ret = 1;
+	}
+    }
+    if (lang)
+	FcPatternAddString (pat, FC_LANG, (const FcChar8 *) lang);
+    if (!pat || ret || !FcConfigSubstituteWithLangs (config, pat, set, FcMatchPattern))
+    {
+	fprintf (stderr, "E: substitution failed\n");
+	ret = 1;
+	goto bail;
+    }
+    for (i = 0; FcPatternGetString (pat, FC_LANG, i, &s) == FcResultMatch; i++)
+    {
+	if (i)
+	    strcat (got, ":");
+	strncat (got, (const char *) s, sizeof (got) - strlen (got) - 2);
+    }
+    if (strcmp (got, expected) != 0)
+    {
+	fprintf (stderr, "E: lang %s with langs %s: expected \"%s\", got \"%s\"\n",
+		 lang ? lang : "(none)", langs ? langs : "(default)", expected, got);
+	ret = 1;
+    }
+bail:
+    if (set)
+	FcStrSetDestroy (set);
+    if (pat)
+	FcPatternDestroy (pat);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config;
+    int ret = 0;
+
+    /* Read once, before the first substitution */
+    setenv ("FC_LANG", "und:fr", 1);
+    config = FcConfigCreate ();
+
+    /* Nothing after "und" is added */
+    ret |= check (config, NULL, NULL, "und");
+    ret |= check (config, "ja", NULL, "ja:und");
+
+    /* The given languages replace the defaults */
+    ret |= check (config, NULL, "de:it", "de:it");
+    ret |= check (config, "ja", "de:it", "ja:de:it");
+    ret |= check (config, NULL, "de:und:it", "de:und");
+    ret |= check (config, "und", "de:it", "und");
+
+    /* Up to the first one the pattern has already */
+    ret |= check (config, "it", "de:it:fr", "it:de");
+
+    /* An empty set adds nothing */
+    ret |= check (config, NULL, "", "");
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
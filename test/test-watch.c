@@ -0,0 +1,70 @@
+/*
+ * fontconfig/test/test-watch.c
+ *
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fontconfig/fontconfig.h>
+
+/*
+ * Load the configuration, run each argument as a shell command and
+ * print whether FcConfigUptoDate finds the configuration up to date
+ * before the first one and after every one of them.  With -b, the
+ * command following it runs after the configuration files are read and
+ * before the fonts are scanned.  Used by run-test.sh.
+ */
+static void
+print_uptodate (void)
+{
+    printf ("%s\n", FcConfigUptoDate (NULL) ? "up to date" : "changed");
+    fflush (stdout);
+}
+
+int
+main (int argc, char **argv)
+{
+    FcConfig *config;
+    int i = 1;
+
+    config = FcInitLoadConfig ();
+    if (argc > 2 && !strcmp (argv[1], "-b"))
+    {
+	(void) system (argv[2]);
+	i = 3;
+    }
+    if (!config || !FcConfigBuildFonts (config) || !FcConfigSetCurrent (config))
+    {
+	fprintf (stderr, "E: Unable to load the configuration\n");
+	return 1;
+    }
+    FcConfigDestroy (config);
+    print_uptodate ();
+    for (; i < argc; i++)
+    {
+	(void) system (argv[i]);
+	print_uptodate ();
+    }
+    FcFini ();
+
+    return 0;
+}